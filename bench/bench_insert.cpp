@@ -0,0 +1,37 @@
+// Insert latency as the table grows. With the free-space map the per-batch
+// average should stay flat instead of growing with the page count.
+//
+//   bench_insert [rows] [batch]
+#include "DBEngine.h"
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <string>
+
+using namespace tinydb;
+
+int main(int argc, char** argv) {
+    long rows  = argc > 1 ? std::atol(argv[1]) : 200000;
+    long batch = argc > 2 ? std::atol(argv[2]) : 20000;
+
+    std::string dir = "bench_insert_db";
+    std::filesystem::remove_all(dir);
+    {
+        DBEngine db(dir);
+        db.execute("CREATE TABLE t (id INT, name TEXT)");
+
+        std::cout << "rows_in_table,avg_insert_us\n";
+        for (long done = 0; done < rows; done += batch) {
+            auto t0 = std::chrono::steady_clock::now();
+            for (long i = done; i < done + batch; i++) {
+                db.execute("INSERT INTO t VALUES (" + std::to_string(i) + ", \"row_" + std::to_string(i) + "_payload\")");
+            }
+            auto t1 = std::chrono::steady_clock::now();
+            double us = std::chrono::duration<double, std::micro>(t1 - t0).count() / batch;
+            std::cout << done + batch << "," << us << "\n";
+        }
+    }
+    std::filesystem::remove_all(dir);
+    return 0;
+}
@@ -0,0 +1,58 @@
+// Insert and full-scan throughput per page size. Every run gets the same
+// pool memory, so larger pages mean fewer frames; the scan filters on an
+// unindexed column that matches nothing, so it reads every row without
+// building a result.
+//
+//   bench_page_size [rows] [pool_mb]
+#include "DBEngine.h"
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <string>
+
+using namespace tinydb;
+
+int main(int argc, char** argv) {
+    long rows   = argc > 1 ? std::atol(argv[1]) : 200000;
+    long poolMb = argc > 2 ? std::atol(argv[2]) : 16;
+
+    using clock = std::chrono::steady_clock;
+    std::cout << "page_size,insert_rows_per_s,scan_rows_per_s,reopen_scan_rows_per_s\n";
+    for (uint32_t size = MIN_PAGE_SIZE; size <= MAX_PAGE_SIZE; size *= 2) {
+        std::string dir = "bench_page_size_db";
+        std::filesystem::remove_all(dir);
+
+        DBOptions opts;
+        opts.pageSize = size;
+        opts.poolFrames = (size_t)poolMb * 1024 * 1024 / size;
+        opts.wal.policy = SyncPolicy::Bytes;
+
+        std::string scan = "SELECT * FROM t WHERE name = \"none\"";
+        double insertRate, scanRate, reopenRate;
+        {
+            DBEngine db(dir, opts);
+            db.execute("CREATE TABLE t (id INT, name TEXT)");
+            auto t0 = clock::now();
+            for (long i = 0; i < rows; i++) {
+                db.execute("INSERT INTO t VALUES (" + std::to_string(i) + ", \"row_" + std::to_string(i) + "_payload\")");
+            }
+            auto t1 = clock::now();
+            db.execute(scan);
+            auto t2 = clock::now();
+            insertRate = rows / std::chrono::duration<double>(t1 - t0).count();
+            scanRate = rows / std::chrono::duration<double>(t2 - t1).count();
+        }
+        {
+            // starts with an empty pool, so every page is read from the file
+            DBEngine db(dir, opts);
+            auto t0 = clock::now();
+            db.execute(scan);
+            auto t1 = clock::now();
+            reopenRate = rows / std::chrono::duration<double>(t1 - t0).count();
+        }
+        std::cout << size << "," << (long)insertRate << "," << (long)scanRate << "," << (long)reopenRate << "\n";
+        std::filesystem::remove_all(dir);
+    }
+    return 0;
+}
@@ -0,0 +1,58 @@
+// Full and filtered scan throughput per worker count, warm pool. The table
+// is written once and reopened for every count; each morsel of pages is
+// scanned, filtered and serialised by one worker, so the rates should grow
+// close to linearly until the cores or the memory bus run out.
+//
+//   bench_parallel_scan [rows] [max_threads]
+#include "DBEngine.h"
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <thread>
+
+using namespace tinydb;
+
+int main(int argc, char** argv) {
+    long rows = argc > 1 ? std::atol(argv[1]) : 500000;
+    unsigned maxThreads = argc > 2 ? (unsigned)std::atoi(argv[2]) : std::max(1u, std::thread::hardware_concurrency());
+
+    using clock = std::chrono::steady_clock;
+    std::string dir = "bench_parallel_scan_db";
+    std::filesystem::remove_all(dir);
+
+    DBOptions opts;
+    opts.wal.policy = SyncPolicy::Bytes;
+    opts.poolFrames = 1 << 16; // the whole table stays resident
+    {
+        DBEngine db(dir, opts);
+        db.execute("CREATE TABLE t (id INT, v INT, name TEXT)");
+        for (long i = 0; i < rows; i++) {
+            db.execute("INSERT INTO t VALUES (" + std::to_string(i) + ", " + std::to_string(i % 10000) +
+                       ", \"row_" + std::to_string(i) + "_payload\")");
+        }
+    }
+
+    const char* queries[] = {
+        "SELECT * FROM t",
+        "SELECT * FROM t WHERE v = -1",
+        "SELECT * FROM t WHERE v BETWEEN 100 AND 199",
+    };
+    std::cout << "threads,select_all_rows_per_s,filter_eq_rows_per_s,filter_range_rows_per_s\n";
+    for (unsigned threads = 1; threads <= maxThreads; threads *= 2) {
+        opts.indexThreads = threads;
+        DBEngine db(dir, opts);
+        std::cout << threads;
+        for (const char* q : queries) {
+            db.execute(q); // warm the pool
+            auto t0 = clock::now();
+            db.execute(q);
+            auto t1 = clock::now();
+            std::cout << "," << (long)(rows / std::chrono::duration<double>(t1 - t0).count());
+        }
+        std::cout << "\n";
+    }
+    std::filesystem::remove_all(dir);
+    return 0;
+}
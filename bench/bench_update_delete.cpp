@@ -0,0 +1,54 @@
+// Single-row UPDATE/DELETE latency for growing table sizes. Indexes are
+// maintained per touched row, so the averages should stay flat instead of
+// growing with the table. The log syncs by volume so the fdatasync per
+// statement does not hide the index cost.
+//
+//   bench_update_delete [max_rows] [ops]
+#include "DBEngine.h"
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <string>
+
+using namespace tinydb;
+
+int main(int argc, char** argv) {
+    long maxRows = argc > 1 ? std::atol(argv[1]) : 200000;
+    long ops     = argc > 2 ? std::atol(argv[2]) : 1000;
+
+    std::string dir = "bench_update_delete_db";
+    std::cout << "rows_in_table,avg_update_us,avg_delete_us\n";
+    for (long rows = maxRows / 16; rows <= maxRows; rows *= 4) {
+        std::filesystem::remove_all(dir);
+        {
+            DBOptions opts;
+            opts.wal.policy = SyncPolicy::Bytes;
+            DBEngine db(dir, opts);
+            db.execute("CREATE TABLE t (id INT, name TEXT)");
+            db.execute("CREATE INDEX t_id ON t(id)");
+            for (long i = 0; i < rows; i++) {
+                db.execute("INSERT INTO t VALUES (" + std::to_string(i) + ", \"row_" + std::to_string(i) + "_payload\")");
+            }
+
+            long n = ops < rows ? ops : rows;
+            long stride = rows / n;
+
+            auto t0 = std::chrono::steady_clock::now();
+            for (long i = 0; i < n; i++) {
+                db.execute("UPDATE t SET name = \"upd\" WHERE id = " + std::to_string(i * stride));
+            }
+            auto t1 = std::chrono::steady_clock::now();
+            for (long i = 0; i < n; i++) {
+                db.execute("DELETE FROM t WHERE id = " + std::to_string(i * stride));
+            }
+            auto t2 = std::chrono::steady_clock::now();
+
+            double upd = std::chrono::duration<double, std::micro>(t1 - t0).count() / n;
+            double del = std::chrono::duration<double, std::micro>(t2 - t1).count() / n;
+            std::cout << rows << "," << upd << "," << del << "\n";
+        }
+    }
+    std::filesystem::remove_all(dir);
+    return 0;
+}
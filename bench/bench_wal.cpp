@@ -0,0 +1,53 @@
+// Inserts/sec under each WAL sync policy.
+//
+//   bench_wal [rows]
+#include "DBEngine.h"
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <string>
+
+using namespace tinydb;
+
+static double run(const std::string& label, const WALOptions& w, long rows) {
+    std::string dir = "bench_wal_db";
+    std::filesystem::remove_all(dir);
+    double secs;
+    {
+        DBOptions opts;
+        opts.wal = w;
+        DBEngine db(dir, opts);
+        db.execute("CREATE TABLE t (id INT, name TEXT)");
+
+        auto t0 = std::chrono::steady_clock::now();
+        for (long i = 0; i < rows; i++) {
+            db.execute("INSERT INTO t VALUES (" + std::to_string(i) + ", \"row_" + std::to_string(i) + "\")");
+        }
+        auto t1 = std::chrono::steady_clock::now();
+        secs = std::chrono::duration<double>(t1 - t0).count();
+    }
+    std::filesystem::remove_all(dir);
+    std::cout << label << "," << rows / secs << "\n";
+    return secs;
+}
+
+int main(int argc, char** argv) {
+    long rows = argc > 1 ? std::atol(argv[1]) : 20000;
+
+    std::cout << "policy,inserts_per_sec\n";
+
+    WALOptions every;
+    run("every_commit", every, rows);
+
+    WALOptions interval;
+    interval.policy = SyncPolicy::Interval;
+    interval.intervalMs = 10;
+    run("interval_10ms", interval, rows);
+
+    WALOptions bytes;
+    bytes.policy = SyncPolicy::Bytes;
+    bytes.syncBytes = 1 << 20;
+    run("bytes_1MB", bytes, rows);
+    return 0;
+}
@@ -0,0 +1,66 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <variant>
+#include <vector>
+#include "ColumnBatch.h"
+#include "RowCodec.h"
+#include "SQLParser.h"
+
+namespace tinydb {
+
+// a result cell: NULL, an integer, an average or text
+using AggValue = std::variant<std::monostate, int64_t, double, std::string>;
+
+// the items of one aggregate SELECT over a schema. Each worker folds its
+// batches into a partial group table of its own; the partials are merged
+// once the scan is done.
+class Aggregation {
+public:
+    // running values of one item within one group
+    struct State {
+        int64_t count = 0;
+        int64_t sum = 0;
+        bool any = false;
+        int32_t minInt = 0, maxInt = 0;
+        std::string minText, maxText;
+    };
+    using Groups = std::unordered_map<Value, std::vector<State>>;
+
+    // checks the items against the schema; throws for unknown columns,
+    // SUM/AVG of TEXT and plain columns other than the GROUP BY one
+    Aggregation(const Schema& schema, const SelectAggStmt& stmt);
+
+    // the schema columns a batch must carry, each once
+    const std::vector<int>& columns() const { return cols; }
+    // the WHERE as bounds on columns()[0] when it is a plain range, for the
+    // batch kernels; null when the scan has to filter rows on their bytes
+    const ColumnRange* range() const { return ranged ? &rng : nullptr; }
+    // true when the answer is a count of matching rows alone: no GROUP BY
+    // and nothing but COUNTs (columns hold no NULLs)
+    bool countOnly() const;
+
+    void add(Groups& groups, const ColumnBatch& batch) const; // its selected rows
+    void addCount(Groups& groups, uint64_t rows) const;       // for countOnly()
+    void merge(Groups& into, Groups& from) const;
+
+    std::vector<std::string> header() const;
+    // groups in key order; without GROUP BY exactly one row, even over no rows
+    std::vector<std::vector<AggValue>> rows(const Groups& groups) const;
+
+private:
+    std::vector<SelectItem> items;
+    std::vector<ColType> itemTypes;
+    std::vector<int> itemSlot; // position in cols; -1 for COUNT(*)
+    std::vector<int> cols;
+    int groupSlot = -1;
+    ColumnRange rng;
+    bool ranged = false;
+
+    int slotOf(int col);
+    std::vector<State>& group(Groups& groups, const ColumnBatch& batch, uint32_t row) const;
+    void fold(State& st, const SelectItem& item, const ColumnVector* v, uint32_t row) const;
+};
+
+}
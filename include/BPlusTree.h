@@ -0,0 +1,82 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+#include "BufferPool.h"
+#include "RowCodec.h"
+#include "Schema.h"
+#include "SlottedPage.h"
+
+namespace tinydb {
+
+struct KeyBound {
+    Value key;
+    bool inclusive;
+};
+
+// persistent B+tree over (key, RowId) pairs, one file per indexed column,
+// paged through the buffer pool. Page 0 is a meta page; nodes keep a sorted
+// offset array so lookups binary-search the raw page. Duplicate keys are
+// ordered by RowId, which makes every entry unique. TEXT keys are stored
+// truncated to MAX_KEY_BYTES, so callers re-check the row for long strings.
+// Deletes never merge nodes.
+class BPlusTree {
+public:
+    static constexpr uint32_t MAX_KEY_BYTES = 256;
+
+    BPlusTree(BufferPool& pool, const std::string& path, ColType keyType);
+
+    bool empty();
+    void insert(const Value& key, const RowId& rid);
+    bool remove(const Value& key, const RowId& rid);
+    std::vector<RowId> find(const Value& key);
+
+    // visits entries within [lo, hi] (either bound optional) in key order
+    // until fn returns false
+    void scan(const KeyBound* lo, const KeyBound* hi,
+              const std::function<bool(const Value&, const RowId&)>& fn);
+
+    // builds the tree bottom-up from unsorted entries; the tree must be empty
+    void bulkLoad(std::vector<std::pair<Value, RowId>> entries);
+
+private:
+    struct Entry {
+        Value key;
+        RowId rid;
+        uint32_t child = 0; // internal nodes: subtree holding entries >= this one
+    };
+    struct Node {
+        bool leaf = true;
+        uint32_t link = 0; // leaf: right sibling; internal: leftmost child
+        std::vector<Entry> entries;
+    };
+
+    BufferPool& pool;
+    DiskFile& file;
+    ColType keyType;
+    uint32_t pageSize;
+
+    uint32_t root();
+    void setRoot(uint32_t pageId);
+
+    Value normalize(const Value& key) const;
+    int compareAt(const uint8_t* page, uint16_t i, const Value& key, const RowId& rid) const;
+    uint16_t lowerBound(const uint8_t* page, const Value& key, const RowId& rid) const;
+    uint32_t childFor(const uint8_t* page, const Value& key, const RowId& rid) const;
+    Entry entryAt(const uint8_t* page, uint16_t i) const;
+
+    Node decode(const uint8_t* page) const;
+    size_t entrySize(const Entry& e, bool leaf) const;
+    size_t encodedSize(const Node& n) const;
+    void encode(const Node& n, uint8_t* page) const;
+
+    uint32_t newNode(const Node& n);
+    void writeNode(uint32_t pageId, const Node& n);
+    void splitNode(std::vector<uint32_t>& path, Node& n);
+    void insertIntoParent(std::vector<uint32_t>& path, uint32_t leftId, const Entry& sep);
+    std::vector<uint32_t> descend(const Value& key, const RowId& rid);
+};
+
+}
@@ -0,0 +1,127 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "Constants.h"
+#include "DiskFile.h"
+
+namespace tinydb {
+
+class BufferPool;
+class DatabaseFile;
+
+// RAII pin on one buffer frame; the page stays resident until release()
+class PageGuard {
+public:
+    PageGuard() = default;
+    PageGuard(BufferPool* pool, uint32_t frame, uint8_t* data);
+    PageGuard(PageGuard&& o) noexcept;
+    PageGuard& operator=(PageGuard&& o) noexcept;
+    PageGuard(const PageGuard&) = delete;
+    PageGuard& operator=(const PageGuard&) = delete;
+    ~PageGuard();
+
+    uint8_t* data() const { return ptr; }
+    static PageGuard borrowed(const uint8_t* data) { return PageGuard(nullptr, 0, const_cast<uint8_t*>(data)); }
+    explicit operator bool() const { return ptr != nullptr; }
+
+    void markDirty() { dirty = true; }
+    void release();
+
+private:
+    BufferPool* pool = nullptr;
+    uint32_t frame = 0;
+    uint8_t* ptr = nullptr;
+    bool dirty = false;
+};
+
+// fixed budget of page-sized frames shared by every page file of a database,
+// CLOCK (second chance) replacement, write-back of dirty frames on eviction
+class BufferPool {
+public:
+    // with a store, every page file is a segment of that single file and
+    // pages are sized by the store
+    explicit BufferPool(size_t frameCount = DEFAULT_POOL_FRAMES, uint32_t pageSize = DEFAULT_PAGE_SIZE,
+                        DatabaseFile* store = nullptr);
+    ~BufferPool();
+
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+
+    // opened once per path and kept until dropFile
+    DiskFile& openFile(const std::string& path);
+    // forgets the file's frames without writing them back and closes it,
+    // so the caller may delete it; no page of it may be pinned
+    void dropFile(const std::string& path);
+
+    // drops the file's pages from `pages` on, resident frames included;
+    // none of them may be pinned
+    void truncateFile(DiskFile& file, uint32_t pages);
+
+    // page files by path, whether plain files or segments of the store
+    bool fileExists(const std::string& path);
+    void removeFile(const std::string& path);
+    void renameFile(const std::string& from, const std::string& to); // replaces `to`
+
+    PageGuard fetch(DiskFile& file, uint32_t pageId);
+    // read-only access: for mmap-enabled files a page that is not resident
+    // is served straight from the mapping without taking a frame
+    PageGuard fetchRead(DiskFile& file, uint32_t pageId);
+    // appends a zeroed page to the file; the frame starts out dirty
+    PageGuard allocate(DiskFile& file, uint32_t& pageId);
+    bool resident(const DiskFile& file, uint32_t pageId);
+
+    void flushFile(DiskFile& file);
+    void flushAll();
+    void syncAll(); // fsync every open file
+
+    // runs before any dirty frame is written back; DBEngine uses it to make
+    // the WAL durable first (write-ahead rule)
+    void setWriteBarrier(std::function<void()> fn) { writeBarrier = std::move(fn); }
+
+    size_t frameCount() const { return frames.size(); }
+    uint32_t pageSize() const { return pageBytes; }
+
+private:
+    friend class PageGuard;
+
+    struct Frame {
+        DiskFile* file = nullptr;
+        uint32_t pageId = 0;
+        uint32_t pins = 0;
+        bool dirty = false;
+        bool ref = false;
+    };
+
+    struct PageKey {
+        const DiskFile* file;
+        uint32_t pageId;
+        bool operator==(const PageKey& o) const { return file==o.file && pageId==o.pageId; }
+    };
+    struct PageKeyHash {
+        size_t operator()(const PageKey& k) const {
+            return std::hash<const void*>()(k.file) ^ (std::hash<uint32_t>()(k.pageId) * 0x9e3779b97f4a7c15ULL);
+        }
+    };
+
+    std::mutex mu;
+    DatabaseFile* store;
+    uint32_t pageBytes;
+    std::vector<uint8_t> arena;
+    std::vector<Frame> frames;
+    std::unordered_map<PageKey, uint32_t, PageKeyHash> pageTable;
+    std::unordered_map<std::string, std::unique_ptr<DiskFile>> files;
+    uint32_t clockHand = 0;
+    std::function<void()> writeBarrier;
+
+    uint8_t* frameData(uint32_t f) { return &arena[(size_t)f * pageBytes]; }
+    uint32_t victim();
+    void writeBack(uint32_t f);
+    void unpin(uint32_t f, bool dirty);
+};
+
+}
@@ -8,17 +8,43 @@
 
 namespace tinydb {
 
+// borrowed byte range (C++17 stand-in for std::span<const uint8_t>)
+struct ByteSpan {
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+
+    ByteSpan() = default;
+    ByteSpan(const uint8_t* d, size_t n) : data(d), size(n) {}
+    ByteSpan(const std::vector<uint8_t>& v) : data(v.data()), size(v.size()) {}
+
+    bool empty() const { return size == 0; }
+    const uint8_t* begin() const { return data; }
+    const uint8_t* end() const { return data + size; }
+    std::vector<uint8_t> toVector() const { return std::vector<uint8_t>(data, data + size); }
+};
+
 inline void write_u16(uint8_t* buf, uint16_t v){ std::memcpy(buf, &v, 2); }
 inline void write_u32(uint8_t* buf, uint32_t v){ std::memcpy(buf, &v, 4); }
 
 inline uint16_t read_u16(const uint8_t* buf){ uint16_t v; std::memcpy(&v, buf, 2); return v; }
 inline uint32_t read_u32(const uint8_t* buf){ uint32_t v; std::memcpy(&v, buf, 4); return v; }
 
+inline uint32_t fnv1a(const uint8_t* p, size_t n){
+    uint32_t h = 2166136261u;
+    for(size_t i=0;i<n;i++){ h ^= p[i]; h *= 16777619u; }
+    return h;
+}
+
 inline void append_u32(std::vector<uint8_t>& b, uint32_t v){
     uint8_t tmp[4]; std::memcpy(tmp,&v,4);
     b.insert(b.end(), tmp, tmp+4);
 }
 
+inline void append_u16(std::vector<uint8_t>& b, uint16_t v){
+    uint8_t tmp[2]; std::memcpy(tmp,&v,2);
+    b.insert(b.end(), tmp, tmp+2);
+}
+
 inline void append_i32(std::vector<uint8_t>& b, int32_t v){
     uint8_t tmp[4]; std::memcpy(tmp,&v,4);
     b.insert(b.end(), tmp, tmp+4);
@@ -33,6 +59,19 @@ inline int32_t pop_i32(const std::vector<uint8_t>& b, size_t& pos){
     int32_t v; std::memcpy(&v, &b[pos], 4); pos+=4; return v;
 }
 
+inline uint16_t pop_u16(ByteSpan b, size_t& pos){
+    if(pos+2>b.size) throw std::runtime_error("pop_u16 overflow");
+    uint16_t v; std::memcpy(&v, b.data+pos, 2); pos+=2; return v;
+}
+inline uint32_t pop_u32(ByteSpan b, size_t& pos){
+    if(pos+4>b.size) throw std::runtime_error("pop_u32 overflow");
+    uint32_t v; std::memcpy(&v, b.data+pos, 4); pos+=4; return v;
+}
+inline int32_t pop_i32(ByteSpan b, size_t& pos){
+    if(pos+4>b.size) throw std::runtime_error("pop_i32 overflow");
+    int32_t v; std::memcpy(&v, b.data+pos, 4); pos+=4; return v;
+}
+
 inline std::string trim(const std::string& s){
     size_t a = s.find_first_not_of(" \t\n\r");
     size_t b = s.find_last_not_of(" \t\n\r");
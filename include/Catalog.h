@@ -1,22 +1,53 @@
 #pragma once
 #include <string>
+#include <unordered_map>
+#include <vector>
 #include "Schema.h"
 
 namespace tinydb {
 
+class DatabaseFile;
+
+// schemas and index definitions are read from disk once, by the
+// constructor; afterwards they are served from memory and DDL writes
+// through to both. With a store (single-file mode) they are kept in the
+// store's catalog text instead of .schema/.idx files.
 class Catalog {
 public:
-    explicit Catalog(const std::string& dbDir);
+    explicit Catalog(const std::string& dbDir, DatabaseFile* store = nullptr);
 
     bool createTable(const Schema& schema);
     bool hasTable(const std::string& tableName) const;
-    Schema loadSchema(const std::string& tableName) const;
+    const Schema& loadSchema(const std::string& tableName) const; // throws for unknown tables
+    std::vector<std::string> listTables() const; // sorted by name
+
+    // index definitions live in <table>.idx, one "name col kind" line each
+    bool createIndex(const IndexDef& def);
+    bool dropIndex(const std::string& indexName);
+    bool findIndex(const std::string& indexName, IndexDef& out) const;
+    const std::vector<IndexDef>& loadIndexes(const std::string& tableName) const;
 
     std::string tablePath(const std::string& tableName) const;
     std::string schemaPath(const std::string& tableName) const;
+    std::string fsmPath(const std::string& tableName) const;
+    // out-of-line TEXT chunks and their free space map
+    std::string toastPath(const std::string& tableName) const;
+    std::string toastFsmPath(const std::string& tableName) const;
+    std::string indexListPath(const std::string& tableName) const;
+    std::string btreePath(const std::string& tableName, const std::string& col) const;
+    std::string hashSnapshotPath(const std::string& tableName, const std::string& col) const;
 
 private:
     std::string dir;
+    DatabaseFile* store;
+    std::unordered_map<std::string, Schema> schemas;
+    std::unordered_map<std::string, std::vector<IndexDef>> indexDefs; // tables without any are absent
+
+    Schema readSchema(const std::string& tableName) const;
+    std::vector<IndexDef> readIndexes(const std::string& tableName) const;
+    bool writeIndexes(const std::string& tableName, const std::vector<IndexDef>& defs);
+    bool saveToStore() const;
+    static void indexColumns(Schema& schema);
 };
 
 }
@@ -0,0 +1,57 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "BPlusTree.h"
+#include "ByteUtil.h"
+#include "RowCodec.h"
+#include "Schema.h"
+#include "TableScanner.h"
+
+namespace tinydb {
+
+class ToastStore;
+
+static constexpr size_t BATCH_ROWS = 2048;
+
+// one decoded column of a batch; `ints` or `texts` by type
+struct ColumnVector {
+    ColType type = ColType::INT32;
+    std::vector<int32_t> ints;
+    std::vector<std::string> texts;
+};
+
+// up to BATCH_ROWS rows of one table, column by column: their ids and the
+// columns a statement reads. `sel` holds the positions of the rows still
+// selected, ascending.
+struct ColumnBatch {
+    size_t size = 0;
+    std::vector<RowId> rids;
+    std::vector<ColumnVector> columns; // in the order the scanner was given
+    std::vector<uint32_t> sel;
+    size_t selected = 0;
+};
+
+// the scan stage: cuts a cursor's rows into batches, decoding only `cols`
+class BatchScanner {
+public:
+    BatchScanner(ScanCursor& cursor, const Schema& schema, std::vector<int> cols, ToastStore* toast = nullptr);
+
+    // the next batch with every row selected; false once the cursor is exhausted
+    bool next(ColumnBatch& batch);
+
+private:
+    ScanCursor& cursor;
+    const Schema& schema;
+    std::vector<int> cols;
+    std::vector<size_t> offsets; // fixed byte offset per column, 0 if TEXT precedes it
+    std::vector<int> walked;     // the other columns, decoded in one pass per row
+    std::vector<size_t> walkedAt; // their positions in cols
+    ToastStore* toast;
+};
+
+// the filter stage: keeps the selected rows whose column `c` (a position
+// in batch.columns) lies within the bounds; either bound may be null
+void filterRange(ColumnBatch& batch, size_t c, const KeyBound* lo, const KeyBound* hi);
+
+}
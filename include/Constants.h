@@ -1,6 +1,18 @@
 #pragma once
 #include <cstdint>
+#include <cstddef>
 
 namespace tinydb {
-static constexpr uint32_t PAGE_SIZE = 4096;
+// page size is chosen per database when it is created, then recorded
+static constexpr uint32_t DEFAULT_PAGE_SIZE = 4096;
+static constexpr uint32_t MIN_PAGE_SIZE = 4096;
+static constexpr uint32_t MAX_PAGE_SIZE = 65536;
+inline bool validPageSize(uint32_t s){ return s >= MIN_PAGE_SIZE && s <= MAX_PAGE_SIZE && (s & (s - 1)) == 0; }
+
+static constexpr size_t DEFAULT_POOL_FRAMES = 4096; // 16 MB of 4 KB pages
+static constexpr const char* DB_FILE_NAME = "db.tinydb"; // single-file mode
+static constexpr const char* DB_HEADER_NAME = "db.header"; // page size of a directory database
+// layout of slotted pages in a directory database, recorded in DB_HEADER_NAME
+// next to the page size; a single file carries its own version
+static constexpr uint32_t PAGE_FORMAT = 1;
 }
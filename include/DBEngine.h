@@ -1,28 +1,123 @@
 #pragma once
+#include <atomic>
+#include <memory>
+#include <shared_mutex>
 #include <string>
+#include <thread>
+#include <utility>
+#include <vector>
 #include <unordered_map>
+#include <unordered_set>
+#include "BPlusTree.h"
+#include "BufferPool.h"
 #include "Catalog.h"
+#include "DatabaseFile.h"
+#include "FreeSpaceMap.h"
 #include "HashIndex.h"
+#include "Predicate.h"
+#include "TableFile.h"
+#include "ThreadPool.h"
+#include "ToastStore.h"
 #include "WAL.h"
 
 namespace tinydb {
 
+struct SelectWhereStmt;
+
+// when declared indexes that need a table scan are built
+enum class IndexBuild {
+    Lazy,       // on the table's first use
+    Eager,      // every table, before the constructor returns
+    Background, // every table, on a helper thread; queries scan until a table's are in
+};
+
+struct DBOptions {
+    size_t poolFrames = DEFAULT_POOL_FRAMES;
+    bool mmapReads = false; // serve clean table pages from a read-only file mapping
+    uint32_t readAheadPages = 32; // page reads a table scan keeps in flight; 0 = off
+    WALOptions wal;
+    uint64_t checkpointBytes = 16u << 20; // bounds the log replayed at startup
+    // keep every table, free space map, B+tree and the catalog in one
+    // DB_FILE_NAME file; the WAL and hash index snapshots stay separate.
+    // Opening a directory that holds per-file tables this way throws.
+    bool singleFile = false;
+    // bytes per page for a new database, a power of two from MIN_PAGE_SIZE to
+    // MAX_PAGE_SIZE; 0 = DEFAULT_PAGE_SIZE. An existing one keeps its own.
+    uint32_t pageSize = 0;
+    IndexBuild indexBuild = IndexBuild::Lazy;
+    // workers for index builds and parallel table scans; 0 = one per hardware thread
+    unsigned indexThreads = 0;
+};
+
 class DBEngine {
 public:
-    explicit DBEngine(const std::string& dbDir);
+    explicit DBEngine(const std::string& dbDir, const DBOptions& opts = DBOptions{});
+    ~DBEngine();
     std::string execute(const std::string& sql);
 
+    // makes every logged change durable in the table files and empties the log
+    void checkpoint();
+
 private:
+    DBOptions opts;
+    std::unique_ptr<DatabaseFile> store; // single-file mode only
     Catalog catalog;
     WAL wal;
+    BufferPool pool;
+
+    // declared indexes of one table, keyed by column
+    struct TableIndexes {
+        std::unordered_map<std::string, TypedHashIndex> hash;
+        std::unordered_map<std::string, std::unique_ptr<BPlusTree>> btree;
+    };
+    using KeyRun = std::vector<std::pair<Value, RowId>>;
+
+    // indexes of one table left for the background builder
+    struct IndexJob {
+        std::string table;
+        Schema schema;
+        std::vector<IndexDef> defs;
+        TableFile tf;
+        ToastStore toast;
+    };
+
+    std::unordered_map<std::string, TableIndexes> indexes; // loaded per table on first use
+    // rows redone at startup, with the LSN that touched them; hash index
+    // snapshots older than that LSN re-read those rows
+    std::unordered_map<std::string, std::vector<std::pair<uint64_t, RowId>>> replayedRows;
+    std::unordered_map<std::string, std::unique_ptr<FreeSpaceMap>> freeSpace;
 
-    std::unordered_map<std::string, std::unordered_map<std::string, HashIndex>> indexes;
+    ThreadPool workers;
+    // held exclusively by every statement; the background builder reads
+    // pages under it shared and installs its indexes under it exclusively
+    std::shared_mutex stmtMu;
+    std::thread indexBuilder;
+    std::atomic<bool> stopBuild{false};
+    std::unordered_set<std::string> building; // tables the builder has not installed yet
+    std::unordered_map<std::string, std::unordered_set<uint64_t>> changedRows; // touched meanwhile
 
-    void buildIndexIfMissing(const std::string& table, const Schema& schema);
-    void rebuildIndexes(const std::string& table, const Schema& schema);
-    int colIndex(const Schema& schema, const std::string& col) const;
+    TableFile openTable(const std::string& table);
+    ToastStore openToast(const std::string& table);
+    void recover();
+    void commitStatement();
+    TableIndexes& tableIndexes(const std::string& table, const Schema& schema);
+    std::vector<IndexDef> openIndexes(TableIndexes& ti, TableFile& tf, ToastStore& toast, const Schema& schema,
+                                      const std::vector<IndexDef>& defs, bool fresh);
+    void scanIndexes(TableIndexes& ti, TableFile& tf, ToastStore& toast, const Schema& schema,
+                     const std::vector<IndexDef>& defs, ThreadPool& threads, std::shared_mutex* writers,
+                     std::unordered_map<std::string, KeyRun>* seen);
+    std::unique_ptr<BPlusTree> writeBTree(const std::string& table, const std::string& col, ColType type, KeyRun entries);
+    void startIndexBuild();
+    void buildInBackground(std::vector<IndexJob> jobs);
+    void noteRowChange(const std::string& table, const RowId& rid);
+    bool indexLookup(const std::string& table, const Schema& schema, const Predicate& where,
+                     std::vector<RowId>& rids, std::string* keyOrder = nullptr);
+    std::vector<RowId> findRows(const std::string& table, const Schema& schema, const Predicate& where);
+    uint32_t vacuumToast(TableFile& tf, ToastStore& toast, const Schema& schema);
+    std::string selectRows(const SelectWhereStmt& stmt);
 
     std::string jsonEscape(const std::string& s) const;
+    void appendRowJson(std::string& out, const Schema& schema, const RowId& rid, const std::vector<Value>& vals) const;
 };
 
 }
@@ -0,0 +1,98 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "DiskFile.h"
+
+namespace tinydb {
+
+// one page file kept inside a DatabaseFile: its logical pages map onto
+// runs of physical pages, each run at least as long as the previous one
+struct FileSegment {
+    struct Extent {
+        uint32_t start; // physical page
+        uint32_t len;
+        uint32_t first; // logical page of `start`
+    };
+    std::vector<Extent> extents;
+    uint32_t pages = 0;    // logical pages in use
+    uint32_t capacity = 0; // logical pages covered by extents
+};
+
+// single-file storage: every page file of a database (tables, free space
+// maps, B+trees) is a named segment of one file, next to the catalog text.
+// Pages 0 and 1 hold two copies of the header, written alternately; the
+// newest valid one points at a run of metadata pages listing the catalog,
+// each segment's extents and the free extents. Metadata is written to
+// fresh pages and switched to by the header, so a crash leaves either
+// the old or the new version. Pages released by a change are reused only
+// after that change is durable.
+class DatabaseFile {
+public:
+    // an existing file keeps the page size it was created with
+    DatabaseFile(const std::string& path, uint32_t pageSize);
+
+    // page size recorded in the file's header, 0 if there is no valid one
+    static uint32_t recordedPageSize(const std::string& path);
+
+    DatabaseFile(const DatabaseFile&) = delete;
+    DatabaseFile& operator=(const DatabaseFile&) = delete;
+
+    // segments are named by the file name part of `path`
+    FileSegment* openSegment(const std::string& path); // created empty if missing
+    bool hasSegment(const std::string& path) const;
+    void removeSegment(const std::string& path);                 // durable on return
+    void renameSegment(const std::string& from, const std::string& to); // replaces `to`; durable on return
+
+    uint32_t pageSize() const { return file.pageSize(); }
+    uint32_t segmentPages(const FileSegment* seg) const;
+    void ensurePages(FileSegment* seg, uint32_t pages);
+    void truncateSegment(FileSegment* seg, uint32_t pages); // durable on return
+
+    // false (and zero-filled) for pages that were never written
+    bool readPage(const FileSegment* seg, uint32_t pageId, uint8_t* buf);
+    void writePage(const FileSegment* seg, uint32_t pageId, const uint8_t* buf);
+    bool locate(const FileSegment* seg, uint32_t pageId, int& fd, long long& offset);
+
+    void enableMmap() { file.enableMmap(); }
+    const uint8_t* mappedPage(const FileSegment* seg, uint32_t pageId);
+    void advise(AccessHint hint) { file.advise(hint); }
+
+    std::string catalog() const;
+    void setCatalog(const std::string& text); // durable on return
+
+    // writes the metadata if it changed and fsyncs
+    void sync();
+
+private:
+    using Extent = FileSegment::Extent;
+
+    DiskFile file;
+    mutable std::shared_mutex mu;
+    std::unordered_map<std::string, std::unique_ptr<FileSegment>> segments;
+    std::vector<Extent> freeRuns;  // sorted by start, coalesced; `first` unused
+    std::vector<Extent> released;  // free once the next metadata version is durable
+    std::string catalogText;
+    uint32_t totalPages = 2;       // physical pages handed out, headers included
+    uint32_t fileEnd = 0;          // physical pages present when opened
+    uint64_t generation = 0;
+    Extent metaRun{0, 0, 0};
+    bool metaDirty = false;
+    std::atomic<bool> unsynced{false};
+
+    static std::string segmentName(const std::string& path);
+    uint32_t physical(const FileSegment& seg, uint32_t pageId) const;
+    Extent allocateRun(uint32_t len);
+    void freeRun(Extent run);
+    void zeroPages(uint32_t start, uint32_t len);
+    std::vector<uint8_t> encodeMeta(const std::vector<Extent>& alsoFree) const;
+    void decodeMeta(const std::vector<uint8_t>& blob);
+    bool readHeader(uint32_t slot, uint64_t& gen, Extent& meta, uint32_t& metaBytes, uint32_t& sum, uint32_t& total);
+    void commit(); // mu held exclusively
+};
+
+}
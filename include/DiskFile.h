@@ -0,0 +1,77 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+#include "Constants.h"
+
+namespace tinydb {
+
+enum class AccessHint { Normal, Sequential, Random };
+
+class DatabaseFile;
+struct FileSegment;
+
+// one persistent handle per page file; reads/writes are positional so the
+// handle can be shared by every TableFile and scanner that touches the file.
+// In single-file mode the pages live in a segment of a DatabaseFile instead.
+class DiskFile {
+public:
+    explicit DiskFile(const std::string& path, uint32_t pageSize = DEFAULT_PAGE_SIZE);
+    DiskFile(DatabaseFile& store, const std::string& path); // pages sized by the store
+    ~DiskFile();
+
+    DiskFile(const DiskFile&) = delete;
+    DiskFile& operator=(const DiskFile&) = delete;
+
+    const std::string& filePath() const { return path; }
+    uint32_t pageSize() const { return pageBytes; }
+
+    uint32_t pageCount() const { return numPages.load(); }
+    uint32_t allocatePage();
+    void ensurePageCount(uint32_t n);
+    void truncate(uint32_t n); // drops pages [n, pageCount()); no frame may hold them
+
+    // returns false (and zero-fills) when the page lies past the physical end
+    bool readPage(uint32_t pageId, uint8_t* buf);
+    void writePage(uint32_t pageId, const uint8_t* buf);
+    void sync();
+
+    // descriptor and byte offset of a page, for callers issuing their own
+    // reads; false when the page has no place on disk yet
+    bool locate(uint32_t pageId, int& fd, long long& offset);
+
+    // optional read-only shared mapping of the file. Pages are only handed
+    // out once they exist on disk; the mapping is grown geometrically and
+    // superseded mappings stay valid until the file is closed.
+    void enableMmap();
+    bool mmapEnabled() const { return mmapOn; }
+    const uint8_t* mappedPage(uint32_t pageId);
+    void advise(AccessHint hint);
+
+private:
+    std::string path;
+    uint32_t pageBytes;
+    int fd = -1;
+    DatabaseFile* store = nullptr;
+    FileSegment* segment = nullptr;
+    std::atomic<uint32_t> numPages{0};
+    std::atomic<uint32_t> diskPages{0};
+
+    bool mmapOn = false;
+    std::mutex mapMu;
+    std::atomic<uint8_t*> mapBase{nullptr};
+    std::atomic<uint32_t> mapCapacity{0};
+    std::vector<std::pair<uint8_t*, size_t>> mappings;
+    AccessHint hint = AccessHint::Normal;
+
+    void remap(uint32_t minPages);
+    void applyAdvice(); // mapMu held
+#ifdef _WIN32
+    std::mutex ioMu;
+#endif
+};
+
+}
@@ -0,0 +1,48 @@
+#pragma once
+#include <cstdint>
+#include <set>
+#include <string>
+#include <vector>
+#include "BufferPool.h"
+
+namespace tinydb {
+
+// per-page free-space buckets of one table, persisted one byte per page in
+// a side file (0 = unknown, otherwise bucket+1). A bucket is 1/256 of a
+// page (16 bytes on 4 KB pages). Pages are also kept in per-bucket sets so
+// an insert finds a page with room without scanning.
+class FreeSpaceMap {
+public:
+    static constexpr uint32_t NO_PAGE = 0xFFFFFFFFu;
+
+    FreeSpaceMap(BufferPool& pool, const std::string& path);
+
+    // best fit: the lowest page in the smallest bucket that guarantees `need`
+    // free bytes, or NO_PAGE; only pages before `below` are considered
+    uint32_t findPage(uint32_t need, uint32_t below = NO_PAGE) const;
+    // the largest need findPage can answer with a used page; anything
+    // bigger always lands on a fresh one
+    static uint32_t largestReusable(uint32_t pageSize) { return (NUM_BUCKETS - 1) * (pageSize / 256); }
+    void update(uint32_t pageId, uint32_t freeBytes);
+    // forgets pages from `pages` on, after the table was cut short
+    void truncate(uint32_t pages);
+
+    // pages [0, coveredPages()) have a known bucket
+    uint32_t coveredPages() const { return covered; }
+
+private:
+    static constexpr uint32_t NUM_BUCKETS = 255;
+
+    BufferPool& pool;
+    DiskFile& file;
+    uint32_t pageBytes;
+    uint32_t bucketBytes;
+    std::vector<uint8_t> buckets;                  // stored form per page
+    std::vector<std::set<uint32_t>> pagesByBucket; // bucket 0 (full) is not tracked
+    uint32_t covered = 0;
+
+    uint8_t bucketFor(uint32_t freeBytes) const;
+    void persist(uint32_t pageId, uint8_t stored);
+};
+
+}
@@ -1,20 +1,100 @@
 #pragma once
-#include <unordered_map>
+#include <cstdint>
+#include <functional>
 #include <string>
+#include <unordered_map>
+#include <variant>
 #include <vector>
+#include "RowCodec.h"
+#include "Schema.h"
 #include "SlottedPage.h"
 
 namespace tinydb {
 
+// in-memory equality index from a column value to the rows holding it.
+// The primary template is node-based; a key with a single row keeps it
+// inline instead of allocating a posting list.
+template<typename Key>
 class HashIndex {
 public:
-    void add(const std::string& key, const RowId& rid);
-    void remove(const std::string& key, const RowId& rid);
-    std::vector<RowId> find(const std::string& key) const;
+    void add(const Key& key, const RowId& rid);
+    void remove(const Key& key, const RowId& rid);
+    std::vector<RowId> find(const Key& key) const;
     void clear();
+    void forEach(const std::function<void(const Key&, const RowId&)>& fn) const;
+    void reserve(size_t keys);
+
+private:
+    struct Postings {
+        RowId first;
+        std::vector<RowId> more;
+    };
+    std::unordered_map<Key, Postings> idx;
+};
+
+// INT32 keys: flat Robin Hood table of 12-byte slots, no per-key heap
+// allocation unless a key has more than one row
+template<>
+class HashIndex<int32_t> {
+public:
+    void add(int32_t key, const RowId& rid);
+    void remove(int32_t key, const RowId& rid);
+    std::vector<RowId> find(int32_t key) const;
+    void clear();
+    void forEach(const std::function<void(int32_t, const RowId&)>& fn) const;
+    void reserve(size_t keys);
+
+private:
+    static constexpr uint16_t MULTI = 0x8000; // page indexes `lists`
+    static constexpr uint16_t DIST_MASK = 0x7FFF;
+
+    struct Slot {
+        int32_t key;
+        uint32_t page;
+        uint16_t slot;
+        uint16_t meta; // 0 = empty, else probe distance + 1 | MULTI
+    };
+
+    std::vector<Slot> slots;
+    size_t used = 0;
+    uint32_t shift = 64;
+    std::vector<std::vector<RowId>> lists;
+    std::vector<uint32_t> freeLists;
+
+    size_t home(int32_t key) const;
+    long locate(int32_t key) const;
+    void place(Slot s);
+    void erase(size_t pos);
+    void grow();
+};
+
+// the index DBEngine keeps per column; the representation follows the
+// column type. It can be saved as a snapshot tagged with the WAL position
+// it reflects, so a restart does not have to rescan the table.
+class TypedHashIndex {
+public:
+    explicit TypedHashIndex(ColType type = ColType::TEXT);
+
+    void add(const Value& key, const RowId& rid);
+    void remove(const Value& key, const RowId& rid);
+    std::vector<RowId> find(const Value& key) const;
+    void clear();
+
+    // drops every entry whose row matches pred
+    void removeRows(const std::function<bool(const RowId&)>& pred);
+
+    // changed since it was last saved or loaded
+    bool dirty() const { return changed; }
+
+    // written to a temp file, synced and renamed into place
+    void save(const std::string& path, uint64_t lsn);
+    // false if the snapshot is missing, corrupt or of another key type
+    bool load(const std::string& path, uint64_t& lsn);
 
 private:
-    std::unordered_map<std::string, std::vector<RowId>> idx;
+    ColType type;
+    std::variant<HashIndex<int32_t>, HashIndex<std::string>> impl;
+    bool changed = false;
 };
 
 }
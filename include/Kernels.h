@@ -0,0 +1,25 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+namespace tinydb {
+
+// selection-vector kernels over INT32 column vectors. The widest of AVX2,
+// SSE2 and plain C++ that both the build and the CPU support is picked on
+// first use; every variant returns the same positions in the same order.
+class Kernels {
+public:
+    // kernels may write this many entries past the ones they return
+    static constexpr size_t SEL_SLACK = 8;
+
+    // writes the positions i < n with lo <= v[i] <= hi to `sel`, ascending;
+    // `sel` needs room for n + SEL_SLACK entries. Returns how many.
+    static size_t selectBetween(const int32_t* v, size_t n, int32_t lo, int32_t hi, uint32_t* sel);
+    // keeps those of the n positions in `sel` whose value lies in [lo, hi],
+    // in place and in order; returns how many
+    static size_t refineBetween(const int32_t* v, uint32_t* sel, size_t n, int32_t lo, int32_t hi);
+
+    static const char* level(); // "avx2", "sse2" or "scalar"
+};
+
+}
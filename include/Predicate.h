@@ -0,0 +1,71 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "BPlusTree.h"
+#include "ByteUtil.h"
+#include "RowCodec.h"
+#include "Schema.h"
+
+namespace tinydb {
+
+class ToastStore;
+
+enum class PredOp { EQ, NE, LT, LE, GT, GE, BETWEEN, IN, AND, OR, NOT };
+
+// a WHERE condition: one column compared with literals, or AND, OR or NOT
+// over sub-conditions
+struct Predicate {
+    PredOp op = PredOp::AND;
+    std::string col;             // comparisons only
+    std::vector<Value> values;   // one; two for BETWEEN; the list for IN
+    std::vector<Predicate> kids; // AND, OR: two or more; NOT: one
+
+    // the terms of a top-level AND, nested ones flattened; else just this
+    std::vector<const Predicate*> conjuncts() const;
+};
+
+// bounds on one column; either may be missing
+struct ColumnRange {
+    std::string col;
+    bool hasLo = false, hasHi = false;
+    KeyBound lo, hi;
+};
+
+// `p` as bounds on one column of `schema` when that is all it says: =, <,
+// <=, >, >=, BETWEEN, or an AND of those on the same column, with literals
+// of the column's type. Bounds already in `out` are narrowed.
+bool asRange(const Predicate& p, const Schema& schema, ColumnRange& out);
+
+// a predicate compiled against a schema, evaluated on encoded rows. INT
+// columns are read in place and inline TEXT is compared without a copy;
+// out-of-line TEXT is only fetched when its length cannot settle the test.
+// Comparing for order across types throws; a value of the other type is
+// simply never equal.
+class RowFilter {
+public:
+    RowFilter(const Schema& schema, const Predicate& where, ToastStore* toast = nullptr);
+
+    bool matches(ByteSpan row) const;
+
+private:
+    struct Node {
+        PredOp op = PredOp::AND;
+        int col = -1;
+        size_t offset = 0;        // fixed byte offset of col, 0 if it varies
+        bool typed = true;        // the literals have the column's type
+        std::vector<int32_t> ints; // sorted for IN
+        std::vector<std::string> texts;
+        std::vector<uint32_t> kids;
+    };
+    const Schema& schema;
+    ToastStore* toast;
+    std::vector<Node> nodes; // nodes[0] is the root
+
+    uint32_t compile(const Predicate& p);
+    bool eval(const Node& n, ByteSpan row) const;
+    bool test(const Node& n, int32_t v) const;
+    bool test(const Node& n, const char* s, size_t len) const;
+};
+
+}
@@ -0,0 +1,63 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <memory>
+#include <vector>
+#include "DiskFile.h"
+
+namespace tinydb {
+
+// keeps up to `depth` reads of the pages [first, end) of one file in flight
+// and hands the pages back in order. Reads go through io_uring where the
+// build and the kernel allow it, otherwise through a few pread threads.
+// Pages come straight from disk and bypass the buffer pool, so a large cold
+// scan does not push out the pool's working set; pages for which `cached`
+// holds when their read would be issued are left to the pool instead. The
+// caller must keep the file from being written meanwhile.
+class ReadAhead {
+public:
+    using CachedFn = std::function<bool(uint32_t pageId)>;
+
+    ReadAhead(DiskFile& file, uint32_t first, uint32_t end, uint32_t depth, CachedFn cached = nullptr);
+    ~ReadAhead(); // waits for the reads still in flight
+
+    ReadAhead(const ReadAhead&) = delete;
+    ReadAhead& operator=(const ReadAhead&) = delete;
+
+    // the page after the one returned last (`first` at the start), valid
+    // until the next call; nullptr for pages left to the pool
+    const uint8_t* next(uint32_t pageId);
+
+    bool usesIoUring() const { return ring != nullptr; }
+
+private:
+    struct Ring; // io_uring state, Linux only
+
+    struct Slot {
+        uint32_t pageId = 0;
+        bool issued = false;
+        bool done = false;
+        int result = 0;           // bytes read (io_uring)
+        std::future<void> read;   // pread fallback
+    };
+
+    DiskFile& file;
+    uint32_t end;
+    uint32_t depth;
+    uint32_t pageBytes;
+    CachedFn cached;
+    std::vector<uint8_t> buffers;
+    std::vector<Slot> slots;
+    std::unique_ptr<Ring> ring;
+    bool ringTried = false;
+    uint32_t nextIssue;   // first page not yet handed to a slot
+    uint32_t firstPage;
+    int lastSlot = -1;    // slot whose buffer the caller holds
+
+    uint8_t* buffer(size_t slot) { return &buffers[slot * pageBytes]; }
+    void issue(size_t slot);
+    void wait(size_t slot);
+};
+
+}
@@ -3,19 +3,62 @@
 #include <string>
 #include <vector>
 #include <variant>
+#include "ByteUtil.h"
 #include "Schema.h"
 
 namespace tinydb {
 
 using Value = std::variant<int32_t, std::string>;
 
+class ToastStore;
+
+// where an out-of-line TEXT value lives: its length and its first chunk
+struct ToastRef {
+    uint32_t length;
+    uint32_t pageId;
+    uint16_t slotId;
+};
+
+// A TEXT value is stored as u32 length + bytes, or, when kept out of line,
+// as u32 (TOAST_FLAG | length) + the page and slot of its first chunk.
 class RowCodec {
 public:
-    static std::vector<uint8_t> encode(const Schema& schema, const std::vector<Value>& values);
-    static std::vector<Value> decode(const Schema& schema, const std::vector<uint8_t>& bytes);
+    static constexpr uint32_t TOAST_FLAG = 0x80000000u;
+    static constexpr uint32_t TOAST_REF_SIZE = 4 + 4 + 2;
+
+    // with a store, TEXT values over its threshold go out of line, and more
+    // (largest first) while the row would not fit its limit
+    static std::vector<uint8_t> encode(const Schema& schema, const std::vector<Value>& values,
+                                       ToastStore* toast = nullptr);
+    // out-of-line values are fetched from `toast`
+    static std::vector<Value> decode(const Schema& schema, ByteSpan bytes, ToastStore* toast = nullptr);
+    // one column; out-of-line values of the others are never fetched
+    static Value decodeColumn(const Schema& schema, ByteSpan bytes, int col, ToastStore* toast = nullptr);
+    // the given columns, in that order, from one pass over the row; the
+    // others are skipped without a copy and their out-of-line values are
+    // never fetched
+    static std::vector<Value> decodeColumns(const Schema& schema, ByteSpan bytes, const std::vector<int>& cols,
+                                            ToastStore* toast = nullptr);
+    // valueToKey of one column, read straight from the row bytes
+    static std::string columnKey(const Schema& schema, ByteSpan bytes, int col, ToastStore* toast = nullptr);
+    // byte offset of column `col` in every row of the schema; 0 when a TEXT
+    // column precedes it and the offset differs from row to row
+    static size_t fixedOffset(const Schema& schema, int col);
+    // the row with one column replaced; the others keep their bytes, so
+    // their out-of-line values keep their chunks
+    static std::vector<uint8_t> replaceColumn(const Schema& schema, ByteSpan bytes, int col, const Value& v,
+                                              ToastStore* toast = nullptr);
+    // the out-of-line values a row refers to; only column `col` if >= 0
+    static std::vector<ToastRef> toastRefs(const Schema& schema, ByteSpan bytes, int col = -1);
+    // points the out-of-line value of column `col` at the chunks of `ref`,
+    // a copy of the same value; the row keeps its size
+    static void setToastRef(const Schema& schema, std::vector<uint8_t>& bytes, int col, const ToastRef& ref);
+
     static std::string toString(const Schema& schema, const std::vector<Value>& values);
 
     static std::string valueToKey(const Value& v);
+    // total order within one column type: <0, 0 or >0
+    static int compare(const Value& a, const Value& b);
 };
 
 }
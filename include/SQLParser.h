@@ -4,6 +4,8 @@
 #include <vector>
 #include "Schema.h"
 #include "RowCodec.h"
+#include "BPlusTree.h"
+#include "Predicate.h"
 
 namespace tinydb {
 
@@ -11,26 +13,52 @@ struct CreateTableStmt { Schema schema; };
 struct InsertStmt { std::string table; std::vector<Value> values; };
 struct SelectAllStmt { std::string table; };
 
-struct WhereEq {
-    std::string col;
-    Value value;
-};
-
+// SELECT * | col, ... FROM t [WHERE <predicate>] [ORDER BY col [ASC|DESC]]
 struct SelectWhereStmt {
     std::string table;
-    WhereEq where;
+    std::vector<std::string> cols; // the projection; empty for *
+    bool hasWhere = false;
+    Predicate where;
+    std::string orderCol; // empty when there is no ORDER BY
+    bool desc = false;
 };
 
 struct UpdateWhereStmt {
     std::string table;
     std::string setCol;
     Value setValue;
-    WhereEq where;
+    Predicate where;
 };
 
 struct DeleteWhereStmt {
     std::string table;
-    WhereEq where;
+    Predicate where;
+};
+
+enum class AggFunc { NONE, COUNT, SUM, MIN, MAX, AVG };
+
+// one output column of an aggregate SELECT: a function of a column, COUNT(*)
+// (empty col), or, with NONE, the GROUP BY column itself
+struct SelectItem {
+    AggFunc func;
+    std::string col;
+    std::string label; // as written, for the result header
+};
+
+// SELECT items FROM t [WHERE <predicate>] [GROUP BY col]
+struct SelectAggStmt {
+    std::string table;
+    std::vector<SelectItem> items;
+    bool hasWhere = false;
+    Predicate where;
+    std::string groupCol; // empty when there is no GROUP BY
+};
+
+struct CreateIndexStmt { IndexDef def; };
+struct DropIndexStmt { std::string name; };
+struct VacuumStmt {
+    std::string table;
+    bool full = false; // VACUUM FULL also collapses forwarded rows
 };
 
 struct JoinStmt {
@@ -43,20 +71,34 @@ struct JoinStmt {
 class SQLParser {
 public:
     static bool isCreateTable(const std::string& sql);
+    static bool isCreateIndex(const std::string& sql);
+    static bool isDropIndex(const std::string& sql);
+    static bool isVacuum(const std::string& sql);
     static bool isInsert(const std::string& sql);
     static bool isSelectAll(const std::string& sql);
-    static bool isSelectWhereEq(const std::string& sql);
-    static bool isUpdateWhereEq(const std::string& sql);
-    static bool isDeleteWhereEq(const std::string& sql);
+    static bool isSelectWhere(const std::string& sql); // WHERE and/or ORDER BY
+    static bool isUpdateWhere(const std::string& sql);
+    static bool isDeleteWhere(const std::string& sql);
     static bool isJoinEq(const std::string& sql);
+    static bool isSelectColumns(const std::string& sql); // plain columns, no GROUP BY
+    static bool isSelectAggregate(const std::string& sql);
 
     static CreateTableStmt parseCreateTable(const std::string& sql);
+    static CreateIndexStmt parseCreateIndex(const std::string& sql);
+    static DropIndexStmt parseDropIndex(const std::string& sql);
+    static VacuumStmt parseVacuum(const std::string& sql);
     static InsertStmt parseInsert(const std::string& sql);
     static SelectAllStmt parseSelectAll(const std::string& sql);
-    static SelectWhereStmt parseSelectWhereEq(const std::string& sql);
-    static UpdateWhereStmt parseUpdateWhereEq(const std::string& sql);
-    static DeleteWhereStmt parseDeleteWhereEq(const std::string& sql);
+    static SelectWhereStmt parseSelectWhere(const std::string& sql);
+    static UpdateWhereStmt parseUpdateWhere(const std::string& sql);
+    static DeleteWhereStmt parseDeleteWhere(const std::string& sql);
     static JoinStmt parseJoinEq(const std::string& sql);
+    static SelectWhereStmt parseSelectColumns(const std::string& sql);
+    static SelectAggStmt parseSelectAggregate(const std::string& sql);
+
+    // comparisons (=, != or <>, <, <=, >, >=, [NOT] BETWEEN, [NOT] IN) joined
+    // by AND, OR and NOT, with parentheses; AND binds tighter than OR
+    static Predicate parseWhere(const std::string& cond);
 };
 
 }
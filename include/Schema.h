@@ -1,6 +1,7 @@
 #pragma once
 #include <cstdint>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 namespace tinydb {
@@ -18,6 +19,33 @@ struct Column {
 struct Schema {
     std::string tableName;
     std::vector<Column> columns;
+    // column name -> position; filled in for the schemas Catalog hands out
+    std::unordered_map<std::string, int> positions;
+
+    // -1 for unknown columns
+    int colIndex(const std::string& name) const {
+        if (!positions.empty()) {
+            auto it = positions.find(name);
+            return it == positions.end() ? -1 : it->second;
+        }
+        for (size_t i = 0; i < columns.size(); i++) {
+            if (columns[i].name == name) return (int)i;
+        }
+        return -1;
+    }
+};
+
+enum class IndexKind {
+    HASH  = 1,
+    BTREE = 2
+};
+
+// secondary index declared with CREATE INDEX; names are unique per database
+struct IndexDef {
+    std::string name;
+    std::string table;
+    std::string col;
+    IndexKind kind = IndexKind::HASH;
 };
 
 }
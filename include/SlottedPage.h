@@ -1,41 +1,108 @@
 #pragma once
 #include <cstdint>
 #include <vector>
+#include "ByteUtil.h"
 #include "Constants.h"
 
 namespace tinydb {
 
 struct RowId { uint32_t pageId; uint16_t slotId; };
 
+// what a live slot holds. A row that outgrew its page lives on elsewhere as
+// a Moved record (its home RowId, then the row) and its home slot keeps a
+// Forward stub (the RowId of the moved record), so RowIds held by indexes
+// stay valid.
+enum class SlotKind : uint8_t { Row = 0, Forward = 1, Moved = 2 };
+
+// read-only view over a page image owned elsewhere (buffer frame, mapping);
+// spans returned by read() live as long as that memory stays pinned
+class PageView {
+public:
+    PageView(const uint8_t* page, uint32_t pageSize) : data(page), size(pageSize) {}
+
+    uint16_t slotCount() const;
+    uint64_t pageLSN() const;
+    // the row kept in the slot: empty for unknown or deleted slots and for
+    // forwarding stubs; a moved row comes without its home RowId
+    ByteSpan read(uint16_t slotId) const;
+    ByteSpan record(uint16_t slotId) const; // stored bytes of any kind
+    SlotKind kind(uint16_t slotId) const;
+    RowId link(uint16_t slotId) const;      // stub target or moved row's home
+    // rows a scan reports from this page (live rows and stubs of moved
+    // ones), counted from the slot directory alone
+    uint16_t liveRows() const;
+
+private:
+    const uint8_t* data;
+    uint32_t size;
+};
+
+// Pages up to 16 KB keep 16-bit header and slot fields; larger pages
+// switch to 32-bit fields.
 class SlottedPage {
 public:
-    SlottedPage();
+    explicit SlottedPage(uint32_t pageSize);   // owns a freshly formatted page
+    SlottedPage(uint8_t* frame, uint32_t pageSize); // edits a borrowed page image in place
+    SlottedPage(const SlottedPage& o);
+    SlottedPage& operator=(const SlottedPage& o);
+
+    static void format(uint8_t* page, uint32_t pageSize);
+    static uint32_t maxRowSize(uint32_t pageSize);
+
+    static constexpr uint16_t LINK_SIZE = 6;
+    // a stub (no row) or a moved record (with the row)
+    static std::vector<uint8_t> linkRecord(const RowId& rid, ByteSpan row = {});
+    static RowId linkOf(ByteSpan rec);
 
     void loadFromBytes(const std::vector<uint8_t>& bytes);
+    void loadFromBytes(const uint8_t* bytes);
     std::vector<uint8_t> toBytes() const;
+    void writeTo(uint8_t* out) const;
 
-    int insert(const std::vector<uint8_t>& row);
+    // records are rows unless `kind` says otherwise
+    int insert(const std::vector<uint8_t>& rec, SlotKind kind = SlotKind::Row); // reuses the lowest free slot
+    bool insertAt(uint16_t slotId, const std::vector<uint8_t>& rec, SlotKind kind = SlotKind::Row); // redo places rows at their logged slot
     std::vector<uint8_t> read(uint16_t slotId) const;
-    bool update(uint16_t slotId, const std::vector<uint8_t>& newRow);
+    ByteSpan view(uint16_t slotId) const;
+    // replaces the slot's record; a longer one is moved within the page,
+    // compacting it if the free gap alone is too small
+    bool update(uint16_t slotId, const std::vector<uint8_t>& rec, SlotKind kind = SlotKind::Row);
     bool remove(uint16_t slotId);
 
     uint16_t slotCount() const;
+    uint32_t freeSpace() const; // bytes available for one more row, compaction included
+    uint32_t deadBytes() const; // left behind by deletes and shrinking updates
+    bool formatted() const;     // false for an all-zero page
+
+    // slides the live rows to the end of the page so the holes between them
+    // join the free gap; slot ids do not change
+    void compact();
+
+    // LSN of the last logged change applied to this page
+    uint64_t pageLSN() const;
+    void setPageLSN(uint64_t lsn);
 
 private:
-    std::vector<uint8_t> data;
+    std::vector<uint8_t> owned;
+    uint8_t* data;
+    uint32_t size;
+
+    uint32_t field(uint32_t pos) const;
+    void setField(uint32_t pos, uint32_t v);
 
-    uint16_t getSlotCount() const;
-    uint16_t getFreeStart() const;
-    uint16_t getFreeEnd() const;
-    void setSlotCount(uint16_t v);
-    void setFreeStart(uint16_t v);
-    void setFreeEnd(uint16_t v);
+    uint32_t getSlotCount() const;
+    uint32_t getFreeStart() const;
+    uint32_t getFreeEnd() const;
+    void setSlotCount(uint32_t v);
+    void setFreeStart(uint32_t v);
+    void setFreeEnd(uint32_t v);
+    void setDeadBytes(uint32_t v);
 
     uint32_t slotEntryOffset(uint16_t slotId) const;
-    uint16_t getSlotOffset(uint16_t slotId) const;
-    uint16_t getSlotLength(uint16_t slotId) const;
-    void setSlotOffset(uint16_t slotId, uint16_t off);
-    void setSlotLength(uint16_t slotId, uint16_t len);
+    uint32_t getSlotOffset(uint16_t slotId) const;
+    uint32_t getSlotLength(uint16_t slotId) const;
+    void setSlotOffset(uint16_t slotId, uint32_t off);
+    void setSlotLength(uint16_t slotId, uint32_t len, SlotKind kind = SlotKind::Row);
 };
 
 }
@@ -1,27 +1,78 @@
 #pragma once
 #include <string>
 #include <cstdint>
+#include <functional>
+#include <memory>
 #include <vector>
+#include "BufferPool.h"
+#include "FreeSpaceMap.h"
+#include "ReadAhead.h"
 #include "SlottedPage.h"
+#include "WAL.h"
 
 namespace tinydb {
 
 class TableFile {
 public:
-    explicit TableFile(const std::string& path);
+    TableFile(BufferPool& pool, const std::string& path, FreeSpaceMap& fsm);
 
-    RowId insertRow(const std::vector<uint8_t>& row);
+    // rows are addressed by their home RowId; a row that outgrows its page
+    // is moved elsewhere and followed through the stub left behind
+    // with `below`, only onto a page before it; a NO_PAGE RowId when none
+    // of those has room
+    RowId insertRow(const std::vector<uint8_t>& row, uint32_t below = FreeSpaceMap::NO_PAGE);
     std::vector<uint8_t> readRow(const RowId& rid);
     bool updateRow(const RowId& rid, const std::vector<uint8_t>& newRow);
     bool deleteRow(const RowId& rid);
 
+    using MovedFn = std::function<void(const RowId& from, const RowId& to, const std::vector<uint8_t>& row)>;
+
+    // compacts every page, then moves rows off the tail of the table into
+    // free space further up, last page first, until a row no longer fits.
+    // With `collapse`, every forwarded row first goes back home or, when it
+    // still does not fit there, makes its new place its home. Rows whose
+    // RowId changes are reported through `moved`. Returns the page count the
+    // table can be cut down to.
+    uint32_t vacuum(const MovedFn& moved, bool collapse = false);
+    // compacts every page without moving a row off it; returns the page
+    // count past the last page that still holds one
+    uint32_t compact();
+    void truncate(uint32_t pages); // pages past the end must hold no rows
+
+    uint32_t pageSize() const;
     uint32_t pageCount() const;
     std::vector<uint8_t> readPageRaw(uint32_t pageId);
+    PageGuard pinPage(uint32_t pageId);
+    PageGuard readPage(uint32_t pageId); // read-only, may come from the mapping
+
+    void enableMmap();
+    void adviseAccess(AccessHint hint);
+    // page reads a scan keeps in flight; 0 = none
+    void setReadAhead(uint32_t pages) { readAheadPages = pages; }
+    // read-ahead over pages [first, end) for a scan nothing writes to
+    // meanwhile; null when it is off or the mapping serves the pages
+    std::unique_ptr<ReadAhead> readAhead(uint32_t first, uint32_t end);
+
+    // once attached, every change is logged and stamps the page LSN
+    void attachLog(WAL& wal, const std::string& table);
+    // re-applies a logged change unless the page already reflects it
+    bool redo(const LogRecord& rec);
 
 private:
-    std::string path;
-    void ensureExists() const;
-    void writePageRaw(uint32_t pageId, const std::vector<uint8_t>& bytes);
+    // logged page edits, each keeping the free-space map current
+    RowId place(const std::vector<uint8_t>& rec, SlotKind kind, uint32_t below = FreeSpaceMap::NO_PAGE);
+    bool rewrite(PageGuard& g, const RowId& rid, const std::vector<uint8_t>& rec, SlotKind kind);
+    void erase(PageGuard& g, const RowId& rid);
+    // a stub's row becomes a plain row where it lies; returns its new RowId
+    RowId settle(PageGuard& home, const RowId& rid);
+
+    BufferPool& pool;
+    DiskFile& file;
+    FreeSpaceMap& fsm;
+    uint32_t pageBytes;
+    uint32_t readAheadPages = 0;
+    WAL* wal = nullptr;
+    std::string logName;
 };
 
 }
@@ -1,23 +1,134 @@
 #pragma once
+#include <algorithm>
 #include <cstdint>
+#include <functional>
+#include <memory>
+#include <shared_mutex>
 #include <vector>
+#include "BufferPool.h"
+#include "ByteUtil.h"
+#include "ReadAhead.h"
 #include "TableFile.h"
+#include "ThreadPool.h"
 
 namespace tinydb {
 
+class RowFilter;
+
+// bytes point into the current page and are only valid until the cursor moves
 struct ScanRow {
     RowId rid;
-    std::vector<uint8_t> bytes;
+    ByteSpan bytes;
+};
+
+// pulls the live rows of pages [first, end) one at a time, holding a single
+// page (plus one read-ahead window) however large the table is:
+//
+//     for (const ScanRow& r : scanner.scan()) ...
+//
+// With `writers`, each page is copied out under a shared lock on it so rows
+// can change meanwhile under the exclusive lock. Moved rows are skipped where
+// they lie and reported through their stub.
+class ScanCursor {
+public:
+    ScanCursor(TableFile& table, uint32_t first, uint32_t end, std::shared_mutex* writers = nullptr,
+               bool sequential = false);
+    ~ScanCursor();
+
+    ScanCursor(const ScanCursor&) = delete;
+    ScanCursor& operator=(const ScanCursor&) = delete;
+
+    // rows failing `filter` are skipped on their page bytes, before any copy
+    // or decode; null passes every row
+    void setFilter(const RowFilter* f) { filter = f; }
+
+    // the next row, nullptr once the range is exhausted
+    const ScanRow* next();
+    // how many rows next() would still return; without a filter they are read
+    // off the slot directories of the remaining pages, never touching a row
+    uint64_t countRest();
+
+    class iterator {
+    public:
+        explicit iterator(ScanCursor* c = nullptr) : cur(c), row(c ? c->next() : nullptr) {}
+        const ScanRow& operator*() const { return *row; }
+        const ScanRow* operator->() const { return row; }
+        iterator& operator++() { row = cur->next(); return *this; }
+        bool operator!=(const iterator& o) const { return (row == nullptr) != (o.row == nullptr); }
+
+    private:
+        ScanCursor* cur;
+        const ScanRow* row;
+    };
+    iterator begin() { return iterator(this); }
+    iterator end() { return iterator(); }
+
+private:
+    TableFile& table;
+    uint32_t pageSize;
+    uint32_t pageId;
+    uint32_t endPage;
+    std::shared_mutex* writers;
+    bool sequential;
+    const RowFilter* filter = nullptr;
+    std::unique_ptr<ReadAhead> ahead;
+    PageGuard guard;
+    std::vector<uint8_t> copy;
+    std::vector<uint8_t> moved;
+    const uint8_t* page = nullptr;
+    uint16_t slotId = 0;
+    uint16_t slotCount = 0;
+    ScanRow row;
+
+    bool load(); // makes pageId the current page; false past the end
+};
+
+// pages [0, pages) cut into morsels of `size` consecutive pages each
+struct MorselPlan {
+    uint32_t pages;
+    uint32_t size;
+    size_t count() const { return (pages + size - 1) / size; }
 };
 
 class TableScanner {
 public:
+    static constexpr uint32_t MORSEL_PAGES = 128;
+
     explicit TableScanner(TableFile& table);
 
-    std::vector<ScanRow> scanAll();
+    // every page, with the file advised for sequential access meanwhile
+    ScanCursor scan();
+    // pages [first, end) only; cursors over disjoint ranges may run from
+    // several threads at once
+    ScanCursor scan(uint32_t first, uint32_t end, std::shared_mutex* writers = nullptr) const;
+
+    // the table as it is now, in morsels; callers size their per-morsel
+    // results by plan.count() before scanning
+    MorselPlan plan(uint32_t morselPages = MORSEL_PAGES) const;
+    // workers of `threads` pull morsels off a shared queue and run fn(m,
+    // cursor) over each; results kept per morsel merge in page order. A lone
+    // morsel runs on the calling thread. The first exception is rethrown
+    // once every worker has stopped; must not be called from a worker.
+    void scanParallel(ThreadPool& threads, const MorselPlan& plan,
+                      const std::function<void(size_t, ScanCursor&)>& fn, std::shared_mutex* writers = nullptr);
+    // as scanParallel, but fn(runner, cursor) is told which runner it is on
+    // rather than which morsel; results kept per runner need no lock and
+    // merge in any order
+    void scanPerRunner(ThreadPool& threads, const MorselPlan& plan,
+                       const std::function<void(size_t, ScanCursor&)>& fn);
+    static size_t runners(const ThreadPool& threads, const MorselPlan& plan) {
+        return std::max<size_t>(1, std::min(plan.count(), threads.size()));
+    }
+
+    // live rows of the whole table, from slot directories only; with a
+    // filter, those passing it, tested on their page bytes
+    uint64_t countRows(ThreadPool& threads, const RowFilter* filter = nullptr);
 
 private:
     TableFile& table;
+
+    void scanMorsels(ThreadPool& threads, const MorselPlan& plan,
+                     const std::function<void(size_t, size_t, ScanCursor&)>& fn, std::shared_mutex* writers);
 };
 
 }
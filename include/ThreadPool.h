@@ -0,0 +1,45 @@
+#pragma once
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+namespace tinydb {
+
+// fixed set of worker threads fed from one FIFO queue
+class ThreadPool {
+public:
+    // 0 = one worker per hardware thread
+    explicit ThreadPool(size_t threads = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    size_t size() const { return workers.size(); }
+
+    std::future<void> submit(std::function<void()> task);
+
+    // runs fn(0..n-1) on the workers and waits for all of them; the first
+    // exception is rethrown. Must not be called from a worker.
+    void parallelFor(size_t n, const std::function<void(size_t)>& fn);
+    // as parallelFor, but fn(i, runner) also learns which of the
+    // min(n, size()) runners pulled i; a runner's calls never overlap, so
+    // scratch state kept per runner needs no lock
+    void parallelForRunners(size_t n, const std::function<void(size_t, size_t)>& fn);
+
+private:
+    std::vector<std::thread> workers;
+    std::queue<std::function<void()>> tasks;
+    std::mutex mu;
+    std::condition_variable wake;
+    bool stopping = false;
+
+    void workerLoop();
+};
+
+}
@@ -0,0 +1,71 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include "RowCodec.h"
+#include "TableFile.h"
+
+namespace tinydb {
+
+// out-of-line storage for the long TEXT values of one table. A value is cut
+// into chunks kept as rows of a side table, each led by the RowId of the
+// next, so every chunk but the last fills a page of its own and scans of the
+// table proper never read them. Chunks are logged like any row. The side
+// table is only opened, and so created, by the first value stored or
+// fetched; tables without long values never get one.
+class ToastStore {
+public:
+    using Opener = std::function<TableFile()>;
+
+    // `writers`, when given, is held shared while chunks are read, for
+    // readers that race statements
+    ToastStore(uint32_t pageSize, Opener open, std::shared_mutex* writers = nullptr);
+    // the same side table, read under `writers`
+    ToastStore(const ToastStore& other, std::shared_mutex* writers);
+
+    uint32_t threshold() const; // longer values go out of line
+    uint32_t rowLimit() const;  // rows over it move more values out
+
+    // the last chunk is written first, so a crash never leaves a chain
+    // pointing at chunks that are not there
+    ToastRef store(const std::string& value);
+    std::string fetch(const ToastRef& ref);
+    void free(const ToastRef& ref);
+
+    // for VACUUM: the last page holding a chunk of `ref`, and the value
+    // stored again with every chunk on a page before `below`. The copy is a
+    // NO_PAGE ref when those pages lack room; the old chunks stay either way.
+    uint32_t lastPage(const ToastRef& ref);
+    ToastRef copyBelow(const ToastRef& ref, uint32_t below);
+
+    TableFile& file() { return table(); }
+
+    // the name a table's chunks are logged under; no table name holds a
+    // newline (the catalog is line based), so these never clash
+    static std::string logName(const std::string& table);
+    // the table whose chunks `log` names, empty for any other name
+    static std::string tableOf(const std::string& log);
+
+private:
+    static constexpr uint32_t NEXT_SIZE = 4 + 2;
+
+    // shared by copies, so workers of one scan open the table once
+    struct Lazy {
+        Opener open;
+        std::once_flag once;
+        std::optional<TableFile> chunks;
+    };
+    uint32_t pageBytes;
+    std::shared_ptr<Lazy> lazy;
+    std::shared_mutex* writers;
+
+    TableFile& table();
+    ToastRef put(const std::string& value, uint32_t below);
+    uint32_t chunkBytes() const;
+};
+
+}
@@ -1,21 +1,102 @@
 #pragma once
+#include <condition_variable>
 #include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
 
 namespace tinydb {
 
-// basic WAL: logs INSERT/UPDATE/DELETE operations (redo-only demo)
+enum class SyncPolicy {
+    EveryCommit, // commit() returns once its records are on disk
+    Interval,    // a background flusher syncs every intervalMs
+    Bytes        // commit() syncs once syncBytes of log are pending
+};
+
+struct WALOptions {
+    SyncPolicy policy = SyncPolicy::EveryCommit;
+    uint32_t intervalMs = 10;
+    size_t syncBytes = 1 << 20;
+};
+
+enum OpType : uint32_t { OP_INSERT=1, OP_DELETE=2, OP_UPDATE=3 };
+
+// physical redo record; lsn is the log position just past the record
+struct LogRecord {
+    OpType op;
+    uint64_t lsn;
+    std::string table;
+    uint32_t page;
+    uint16_t slot;
+    std::vector<uint8_t> bytes; // row image for INSERT/UPDATE
+    uint8_t kind = 0;           // SlotKind of that image
+};
+
+// redo-only WAL for INSERT/UPDATE/DELETE. Records are appended to an
+// in-memory buffer and written through one persistent fd; concurrent or
+// back-to-back commits share one fdatasync. The file starts with a header
+// holding the LSN of its first byte, so LSNs keep growing across
+// checkpoints even though each checkpoint starts a fresh, empty log.
 class WAL {
 public:
-    explicit WAL(const std::string& walPath);
+    explicit WAL(const std::string& walPath, const WALOptions& opts = WALOptions{});
+    ~WAL();
+
+    WAL(const WAL&) = delete;
+    WAL& operator=(const WAL&) = delete;
 
-    void logInsert(const std::string& table, const std::vector<uint8_t>& rowBytes);
-    void logDelete(const std::string& table, uint32_t page, uint16_t slot);
-    void logUpdate(const std::string& table, uint32_t page, uint16_t slot, const std::vector<uint8_t>& newBytes);
+    // each returns the LSN of the appended record
+    uint64_t logInsert(const std::string& table, uint32_t page, uint16_t slot, const std::vector<uint8_t>& rowBytes,
+                       uint8_t kind = 0);
+    uint64_t logDelete(const std::string& table, uint32_t page, uint16_t slot);
+    uint64_t logUpdate(const std::string& table, uint32_t page, uint16_t slot, const std::vector<uint8_t>& newBytes,
+                       uint8_t kind = 0);
+
+    uint64_t currentLSN();
+    uint64_t bytesSinceCheckpoint();
+
+    // make everything up to `lsn` durable according to the sync policy. Like
+    // flush(), rethrows a sync failure the background flusher hit meanwhile.
+    void commit(uint64_t lsn);
+    // write and sync everything appended so far, regardless of policy
+    void flush();
+
+    // feeds every intact record since the last checkpoint to fn, in order;
+    // stops at the first torn or corrupt record. Returns the record count.
+    size_t replay(const std::function<void(const LogRecord&)>& fn);
+
+    // caller guarantees every logged change is already on disk
+    void truncate();
 
 private:
     std::string path;
+    WALOptions opts;
+    int fd = -1;
+
+    std::mutex mu;
+    std::condition_variable synced;
+    std::vector<uint8_t> buffer; // appended but not yet written
+    uint64_t baseLSN = 0;        // LSN of the first record byte in the file
+    uint64_t appendedPos = 0;    // end of the log including the buffer
+    uint64_t durablePos = 0;     // everything before this is on disk
+    bool syncing = false;
+
+    std::thread flusher;
+    std::condition_variable flusherWake;
+    bool stopping = false;
+    std::exception_ptr flushError; // last failed sync of the flusher
+
+    uint64_t append(OpType op, const std::string& table, uint32_t page, uint16_t slot,
+                    const std::vector<uint8_t>* row, uint8_t kind = 0);
+    void syncUpTo(std::unique_lock<std::mutex>& lk, uint64_t pos);
+    void startFresh(uint64_t base);
+    void openForAppend();
+    void closeFd();
+    void flusherLoop();
+    void rethrowFlushError();
 };
 
 }
@@ -1,12 +1,48 @@
 #include <iostream>
 #include <cstdlib>
+#include <string>
 #include "DBEngine.h"
 #include "HttpServer.h"
 
 using namespace tinydb;
 
 int main() {
-    DBEngine db("data");
+    DBOptions opts;
+    const char* bp = std::getenv("TINYDB_POOL_PAGES");
+    if (bp) opts.poolFrames = (size_t)std::strtoull(bp, nullptr, 10);
+    const char* mm = std::getenv("TINYDB_MMAP");
+    if (mm) opts.mmapReads = std::atoi(mm) != 0;
+    const char* ra = std::getenv("TINYDB_READ_AHEAD");
+    if (ra) opts.readAheadPages = (uint32_t)std::strtoul(ra, nullptr, 10);
+    const char* sf = std::getenv("TINYDB_SINGLE_FILE");
+    if (sf) opts.singleFile = std::atoi(sf) != 0;
+    const char* ps = std::getenv("TINYDB_PAGE_SIZE");
+    if (ps) opts.pageSize = (uint32_t)std::strtoul(ps, nullptr, 10);
+
+    // TINYDB_WAL_SYNC=commit | ms:<interval> | bytes:<threshold>
+    const char* ws = std::getenv("TINYDB_WAL_SYNC");
+    if (ws) {
+        std::string w = ws;
+        if (w.rfind("ms:", 0) == 0) {
+            opts.wal.policy = SyncPolicy::Interval;
+            opts.wal.intervalMs = (uint32_t)std::atoi(w.c_str() + 3);
+        } else if (w.rfind("bytes:", 0) == 0) {
+            opts.wal.policy = SyncPolicy::Bytes;
+            opts.wal.syncBytes = (size_t)std::strtoull(w.c_str() + 6, nullptr, 10);
+        }
+    }
+
+    // TINYDB_INDEX_BUILD=lazy | eager | background
+    const char* ib = std::getenv("TINYDB_INDEX_BUILD");
+    if (ib) {
+        std::string b = ib;
+        if (b == "eager") opts.indexBuild = IndexBuild::Eager;
+        else if (b == "background") opts.indexBuild = IndexBuild::Background;
+    }
+    const char* it = std::getenv("TINYDB_INDEX_THREADS");
+    if (it) opts.indexThreads = (unsigned)std::atoi(it);
+
+    DBEngine db("data", opts);
 
     int port = 8080;
     const char* p = std::getenv("PORT");
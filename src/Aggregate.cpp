@@ -0,0 +1,195 @@
+#include "Aggregate.h"
+#include <algorithm>
+#include <stdexcept>
+
+namespace tinydb {
+
+static const char* funcName(AggFunc f) {
+    switch (f) {
+    case AggFunc::SUM: return "SUM";
+    case AggFunc::AVG: return "AVG";
+    default: return "";
+    }
+}
+
+int Aggregation::slotOf(int col) {
+    auto it = std::find(cols.begin(), cols.end(), col);
+    if (it != cols.end()) return (int)(it - cols.begin());
+    cols.push_back(col);
+    return (int)cols.size() - 1;
+}
+
+Aggregation::Aggregation(const Schema& schema, const SelectAggStmt& stmt) : items(stmt.items) {
+    if (items.empty()) throw std::runtime_error("SELECT needs at least one item");
+    if (stmt.hasWhere && asRange(stmt.where, schema, rng)) {
+        ranged = true;
+        slotOf(schema.colIndex(rng.col));
+    }
+    if (!stmt.groupCol.empty()) {
+        int gi = schema.colIndex(stmt.groupCol);
+        if (gi < 0) throw std::runtime_error("column not found: " + stmt.groupCol);
+        groupSlot = slotOf(gi);
+    }
+    for (auto& item : items) {
+        if (item.col.empty()) {
+            itemSlot.push_back(-1);
+            itemTypes.push_back(ColType::INT32);
+            continue;
+        }
+        int ci = schema.colIndex(item.col);
+        if (ci < 0) throw std::runtime_error("column not found: " + item.col);
+        ColType type = schema.columns[ci].type;
+        if (item.func == AggFunc::NONE && item.col != stmt.groupCol)
+            throw std::runtime_error("column " + item.col + " must be aggregated or appear in GROUP BY");
+        if ((item.func == AggFunc::SUM || item.func == AggFunc::AVG) && type != ColType::INT32)
+            throw std::runtime_error(std::string(funcName(item.func)) + " needs an INT column");
+        // COUNT(col) counts rows; columns hold no NULLs, so the values are never needed
+        itemSlot.push_back(item.func == AggFunc::COUNT ? -1 : slotOf(ci));
+        itemTypes.push_back(type);
+    }
+}
+
+bool Aggregation::countOnly() const {
+    if (groupSlot >= 0) return false;
+    for (auto& item : items) {
+        if (item.func != AggFunc::COUNT) return false;
+    }
+    return true;
+}
+
+std::vector<Aggregation::State>& Aggregation::group(Groups& groups, const ColumnBatch& batch, uint32_t row) const {
+    Value key = int32_t(0);
+    if (groupSlot >= 0) {
+        const ColumnVector& g = batch.columns[groupSlot];
+        if (g.type == ColType::INT32) key = g.ints[row];
+        else key = g.texts[row];
+    }
+    auto it = groups.find(key);
+    if (it == groups.end()) it = groups.emplace(std::move(key), std::vector<State>(items.size())).first;
+    return it->second;
+}
+
+void Aggregation::fold(State& st, const SelectItem& item, const ColumnVector* v, uint32_t row) const {
+    st.count++;
+    if (!v || item.func == AggFunc::NONE) return;
+    if (v->type == ColType::INT32) {
+        int32_t x = v->ints[row];
+        st.sum += x;
+        if (!st.any || x < st.minInt) st.minInt = x;
+        if (!st.any || x > st.maxInt) st.maxInt = x;
+    } else if (item.func == AggFunc::MIN || item.func == AggFunc::MAX) {
+        const std::string& x = v->texts[row];
+        if (!st.any || x < st.minText) st.minText = x;
+        if (!st.any || x > st.maxText) st.maxText = x;
+    }
+    st.any = true;
+}
+
+void Aggregation::add(Groups& groups, const ColumnBatch& batch) const {
+    if (batch.selected == 0) return;
+    if (groupSlot < 0) {
+        // one group: item by item over the whole selection
+        auto& states = group(groups, batch, 0);
+        for (size_t k = 0; k < items.size(); k++) {
+            const ColumnVector* v = itemSlot[k] >= 0 ? &batch.columns[itemSlot[k]] : nullptr;
+            State& st = states[k];
+            if (!v || items[k].func == AggFunc::NONE) {
+                st.count += (int64_t)batch.selected;
+                continue;
+            }
+            for (size_t j = 0; j < batch.selected; j++) fold(st, items[k], v, batch.sel[j]);
+        }
+        return;
+    }
+    for (size_t j = 0; j < batch.selected; j++) {
+        uint32_t row = batch.sel[j];
+        auto& states = group(groups, batch, row);
+        for (size_t k = 0; k < items.size(); k++) {
+            fold(states[k], items[k], itemSlot[k] >= 0 ? &batch.columns[itemSlot[k]] : nullptr, row);
+        }
+    }
+}
+
+void Aggregation::addCount(Groups& groups, uint64_t rows) const {
+    if (rows == 0) return;
+    auto& states = groups.emplace(int32_t(0), std::vector<State>(items.size())).first->second;
+    for (auto& st : states) st.count += (int64_t)rows;
+}
+
+void Aggregation::merge(Groups& into, Groups& from) const {
+    for (auto& kv : from) {
+        auto it = into.find(kv.first);
+        if (it == into.end()) {
+            into.emplace(kv.first, std::move(kv.second));
+            continue;
+        }
+        for (size_t k = 0; k < items.size(); k++) {
+            State& a = it->second[k];
+            State& b = kv.second[k];
+            a.count += b.count;
+            a.sum += b.sum;
+            if (!b.any) continue;
+            if (!a.any || b.minInt < a.minInt) a.minInt = b.minInt;
+            if (!a.any || b.maxInt > a.maxInt) a.maxInt = b.maxInt;
+            if (!a.any || b.minText < a.minText) a.minText = std::move(b.minText);
+            if (!a.any || b.maxText > a.maxText) a.maxText = std::move(b.maxText);
+            a.any = true;
+        }
+    }
+    from.clear();
+}
+
+std::vector<std::string> Aggregation::header() const {
+    std::vector<std::string> out;
+    for (auto& item : items) out.push_back(item.label);
+    return out;
+}
+
+std::vector<std::vector<AggValue>> Aggregation::rows(const Groups& groups) const {
+    std::vector<const Groups::value_type*> order;
+    for (auto& kv : groups) order.push_back(&kv);
+    std::sort(order.begin(), order.end(), [](const Groups::value_type* a, const Groups::value_type* b) {
+        return RowCodec::compare(a->first, b->first) < 0;
+    });
+    std::vector<State> none(items.size());
+    Groups::value_type empty{int32_t(0), none};
+    if (order.empty() && groupSlot < 0) order.push_back(&empty);
+
+    std::vector<std::vector<AggValue>> out;
+    for (auto* g : order) {
+        std::vector<AggValue> row;
+        for (size_t k = 0; k < items.size(); k++) {
+            const State& st = g->second[k];
+            bool text = itemTypes[k] == ColType::TEXT;
+            switch (items[k].func) {
+            case AggFunc::NONE:
+                if (std::holds_alternative<int32_t>(g->first)) row.emplace_back((int64_t)std::get<int32_t>(g->first));
+                else row.emplace_back(std::get<std::string>(g->first));
+                break;
+            case AggFunc::COUNT: row.emplace_back(st.count); break;
+            case AggFunc::SUM:
+                if (st.any) row.emplace_back(st.sum);
+                else row.emplace_back(std::monostate{});
+                break;
+            case AggFunc::AVG:
+                if (st.any) row.emplace_back((double)st.sum / (double)st.count);
+                else row.emplace_back(std::monostate{});
+                break;
+            case AggFunc::MIN:
+                if (!st.any) row.emplace_back(std::monostate{});
+                else if (text) row.emplace_back(st.minText);
+                else row.emplace_back((int64_t)st.minInt);
+                break;
+            case AggFunc::MAX:
+                if (!st.any) row.emplace_back(std::monostate{});
+                else if (text) row.emplace_back(st.maxText);
+                else row.emplace_back((int64_t)st.maxInt);
+                break;
+            }
+        }
+        out.push_back(std::move(row));
+    }
+    return out;
+}
+
+}
@@ -0,0 +1,416 @@
+#include "BPlusTree.h"
+#include "ByteUtil.h"
+#include "Constants.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace tinydb {
+
+static constexpr uint32_t BPT_MAGIC = 0x31545042; // "BPT1"
+static constexpr uint32_t NODE_HEADER = 16;      // leaf u8 | pad u8 | count u16 | link u32 | reserved
+
+static int compareRid(const RowId& a, const RowId& b){
+    if(a.pageId != b.pageId) return a.pageId < b.pageId ? -1 : 1;
+    if(a.slotId != b.slotId) return a.slotId < b.slotId ? -1 : 1;
+    return 0;
+}
+
+BPlusTree::BPlusTree(BufferPool& bp, const std::string& path, ColType kt)
+    : pool(bp), file(bp.openFile(path)), keyType(kt), pageSize(bp.pageSize()) {
+    if(file.pageCount() == 0){
+        uint32_t meta;
+        auto g = pool.allocate(file, meta);
+        write_u32(g.data(), BPT_MAGIC);
+        g.data()[4] = (uint8_t)keyType;
+        write_u32(g.data() + 8, 0);
+        return;
+    }
+    auto g = pool.fetch(file, 0);
+    if(read_u32(g.data()) != BPT_MAGIC || g.data()[4] != (uint8_t)keyType)
+        throw std::runtime_error("Bad B+tree index file: " + path);
+}
+
+uint32_t BPlusTree::root(){
+    auto g = pool.fetch(file, 0);
+    return read_u32(g.data() + 8);
+}
+
+void BPlusTree::setRoot(uint32_t pageId){
+    auto g = pool.fetch(file, 0);
+    write_u32(g.data() + 8, pageId);
+    g.markDirty();
+}
+
+bool BPlusTree::empty(){ return root() == 0; }
+
+Value BPlusTree::normalize(const Value& key) const {
+    if(keyType == ColType::INT32){
+        if(!std::holds_alternative<int32_t>(key)) throw std::runtime_error("B+tree expects INT32 key");
+        return key;
+    }
+    if(!std::holds_alternative<std::string>(key)) throw std::runtime_error("B+tree expects TEXT key");
+    const auto& s = std::get<std::string>(key);
+    if(s.size() <= MAX_KEY_BYTES) return key;
+    return s.substr(0, MAX_KEY_BYTES);
+}
+
+int BPlusTree::compareAt(const uint8_t* page, uint16_t i, const Value& key, const RowId& rid) const {
+    const uint8_t* e = page + read_u16(page + NODE_HEADER + 2*i);
+    int c;
+    if(keyType == ColType::INT32){
+        int32_t k; std::memcpy(&k, e, 4); e += 4;
+        int32_t v = std::get<int32_t>(key);
+        c = k < v ? -1 : (k > v ? 1 : 0);
+    } else {
+        uint16_t len = read_u16(e); e += 2;
+        const auto& v = std::get<std::string>(key);
+        size_t m = std::min<size_t>(len, v.size());
+        int r = std::memcmp(e, v.data(), m);
+        c = r != 0 ? (r < 0 ? -1 : 1) : (len < v.size() ? -1 : (len > v.size() ? 1 : 0));
+        e += len;
+    }
+    if(c) return c;
+    return compareRid(RowId{read_u32(e), read_u16(e + 4)}, rid);
+}
+
+uint16_t BPlusTree::lowerBound(const uint8_t* page, const Value& key, const RowId& rid) const {
+    uint16_t lo = 0, hi = read_u16(page + 2);
+    while(lo < hi){
+        uint16_t mid = (uint16_t)((lo + hi) / 2);
+        if(compareAt(page, mid, key, rid) < 0) lo = (uint16_t)(mid + 1);
+        else hi = mid;
+    }
+    return lo;
+}
+
+uint32_t BPlusTree::childFor(const uint8_t* page, const Value& key, const RowId& rid) const {
+    // last separator <= (key, rid), or the leftmost child when there is none
+    uint16_t count = read_u16(page + 2);
+    uint16_t lo = 0, hi = count;
+    while(lo < hi){
+        uint16_t mid = (uint16_t)((lo + hi) / 2);
+        if(compareAt(page, mid, key, rid) <= 0) lo = (uint16_t)(mid + 1);
+        else hi = mid;
+    }
+    if(lo == 0) return read_u32(page + 4);
+    return entryAt(page, (uint16_t)(lo - 1)).child;
+}
+
+BPlusTree::Entry BPlusTree::entryAt(const uint8_t* page, uint16_t i) const {
+    const uint8_t* e = page + read_u16(page + NODE_HEADER + 2*i);
+    Entry out;
+    if(keyType == ColType::INT32){
+        int32_t k; std::memcpy(&k, e, 4); e += 4;
+        out.key = k;
+    } else {
+        uint16_t len = read_u16(e); e += 2;
+        out.key = std::string((const char*)e, len);
+        e += len;
+    }
+    out.rid = RowId{read_u32(e), read_u16(e + 4)};
+    e += 6;
+    if(!page[0]) out.child = read_u32(e);
+    return out;
+}
+
+BPlusTree::Node BPlusTree::decode(const uint8_t* page) const {
+    Node n;
+    n.leaf = page[0] != 0;
+    n.link = read_u32(page + 4);
+    uint16_t count = read_u16(page + 2);
+    n.entries.reserve(count + 1);
+    for(uint16_t i = 0; i < count; i++) n.entries.push_back(entryAt(page, i));
+    return n;
+}
+
+size_t BPlusTree::entrySize(const Entry& e, bool leaf) const {
+    size_t keyBytes = keyType == ColType::INT32 ? 4 : 2 + std::get<std::string>(e.key).size();
+    return 2 + keyBytes + 6 + (leaf ? 0 : 4); // offset slot + key + rid (+ child)
+}
+
+size_t BPlusTree::encodedSize(const Node& n) const {
+    size_t total = NODE_HEADER;
+    for(auto& e : n.entries) total += entrySize(e, n.leaf);
+    return total;
+}
+
+void BPlusTree::encode(const Node& n, uint8_t* page) const {
+    std::memset(page, 0, pageSize);
+    page[0] = n.leaf ? 1 : 0;
+    write_u16(page + 2, (uint16_t)n.entries.size());
+    write_u32(page + 4, n.link);
+
+    uint32_t end = pageSize;
+    for(size_t i = 0; i < n.entries.size(); i++){
+        const Entry& e = n.entries[i];
+        end -= (uint32_t)entrySize(e, n.leaf) - 2;
+        uint8_t* p = page + end;
+        if(keyType == ColType::INT32){
+            int32_t k = std::get<int32_t>(e.key);
+            std::memcpy(p, &k, 4); p += 4;
+        } else {
+            const auto& s = std::get<std::string>(e.key);
+            write_u16(p, (uint16_t)s.size()); p += 2;
+            std::memcpy(p, s.data(), s.size()); p += s.size();
+        }
+        write_u32(p, e.rid.pageId);
+        write_u16(p + 4, e.rid.slotId);
+        if(!n.leaf) write_u32(p + 6, e.child);
+        write_u16(page + NODE_HEADER + 2*i, (uint16_t)end);
+    }
+}
+
+uint32_t BPlusTree::newNode(const Node& n){
+    uint32_t pid;
+    auto g = pool.allocate(file, pid);
+    encode(n, g.data());
+    return pid;
+}
+
+void BPlusTree::writeNode(uint32_t pageId, const Node& n){
+    auto g = pool.fetch(file, pageId);
+    encode(n, g.data());
+    g.markDirty();
+}
+
+std::vector<uint32_t> BPlusTree::descend(const Value& key, const RowId& rid){
+    std::vector<uint32_t> path;
+    uint32_t pid = root();
+    while(pid){
+        path.push_back(pid);
+        auto g = pool.fetch(file, pid);
+        if(g.data()[0]) break;
+        pid = childFor(g.data(), key, rid);
+    }
+    return path;
+}
+
+static int compareEntryKeys(const Value& ak, const RowId& ar, const Value& bk, const RowId& br){
+    int c = RowCodec::compare(ak, bk);
+    return c ? c : compareRid(ar, br);
+}
+
+void BPlusTree::insert(const Value& key, const RowId& rid){
+    Value k = normalize(key);
+    uint32_t r = root();
+    if(r == 0){
+        Node n;
+        n.entries.push_back(Entry{k, rid, 0});
+        setRoot(newNode(n));
+        return;
+    }
+
+    auto path = descend(k, rid);
+    Node n;
+    {
+        auto g = pool.fetch(file, path.back());
+        uint16_t pos = lowerBound(g.data(), k, rid);
+        if(pos < read_u16(g.data() + 2) && compareAt(g.data(), pos, k, rid) == 0) return;
+        n = decode(g.data());
+        n.entries.insert(n.entries.begin() + pos, Entry{k, rid, 0});
+        if(encodedSize(n) <= pageSize){
+            encode(n, g.data());
+            g.markDirty();
+            return;
+        }
+    }
+    splitNode(path, n);
+}
+
+// n (already too big to fit) belongs at path.back(); split it by bytes so
+// both halves fit even with long TEXT keys, then push a separator upwards
+void BPlusTree::splitNode(std::vector<uint32_t>& path, Node& n){
+    size_t total = 0;
+    for(auto& e : n.entries) total += entrySize(e, n.leaf);
+    size_t acc = 0, mid = 1;
+    for(size_t i = 0; i < n.entries.size(); i++){
+        acc += entrySize(n.entries[i], n.leaf);
+        if(acc >= total / 2){ mid = i + 1; break; }
+    }
+    mid = std::max<size_t>(1, std::min(mid, n.entries.size() - 1));
+
+    uint32_t leftId = path.back();
+    path.pop_back();
+
+    Node right;
+    right.leaf = n.leaf;
+    Entry sep;
+    if(n.leaf){
+        right.entries.assign(n.entries.begin() + mid, n.entries.end());
+        right.link = n.link;
+        n.entries.resize(mid);
+        uint32_t rightId = newNode(right);
+        n.link = rightId;
+        sep = Entry{right.entries.front().key, right.entries.front().rid, rightId};
+    } else {
+        Entry pushed = n.entries[mid];
+        right.link = pushed.child;
+        right.entries.assign(n.entries.begin() + mid + 1, n.entries.end());
+        n.entries.resize(mid);
+        uint32_t rightId = newNode(right);
+        sep = Entry{pushed.key, pushed.rid, rightId};
+    }
+    writeNode(leftId, n);
+    insertIntoParent(path, leftId, sep);
+}
+
+void BPlusTree::insertIntoParent(std::vector<uint32_t>& path, uint32_t leftId, const Entry& sep){
+    if(path.empty()){
+        Node r;
+        r.leaf = false;
+        r.link = leftId;
+        r.entries.push_back(sep);
+        setRoot(newNode(r));
+        return;
+    }
+
+    Node p;
+    {
+        auto g = pool.fetch(file, path.back());
+        p = decode(g.data());
+    }
+    auto it = std::upper_bound(p.entries.begin(), p.entries.end(), sep, [](const Entry& a, const Entry& b){
+        return compareEntryKeys(a.key, a.rid, b.key, b.rid) < 0;
+    });
+    p.entries.insert(it, sep);
+    if(encodedSize(p) <= pageSize){
+        writeNode(path.back(), p);
+        return;
+    }
+    splitNode(path, p);
+}
+
+bool BPlusTree::remove(const Value& key, const RowId& rid){
+    Value k = normalize(key);
+    auto path = descend(k, rid);
+    if(path.empty()) return false;
+
+    auto g = pool.fetch(file, path.back());
+    uint16_t pos = lowerBound(g.data(), k, rid);
+    if(pos >= read_u16(g.data() + 2) || compareAt(g.data(), pos, k, rid) != 0) return false;
+    Node n = decode(g.data());
+    n.entries.erase(n.entries.begin() + pos);
+    encode(n, g.data());
+    g.markDirty();
+    return true;
+}
+
+std::vector<RowId> BPlusTree::find(const Value& key){
+    std::vector<RowId> out;
+    KeyBound b{key, true};
+    scan(&b, &b, [&](const Value&, const RowId& rid){ out.push_back(rid); return true; });
+    return out;
+}
+
+void BPlusTree::scan(const KeyBound* lo, const KeyBound* hi,
+                     const std::function<bool(const Value&, const RowId&)>& fn){
+    uint32_t pid = root();
+    if(pid == 0) return;
+
+    Value loKey, hiKey;
+    if(lo) loKey = normalize(lo->key);
+    if(hi) hiKey = normalize(hi->key);
+    // truncated TEXT bounds must not exclude longer keys sharing the prefix
+    bool loExact = !(lo && keyType == ColType::TEXT && std::get<std::string>(lo->key).size() >= MAX_KEY_BYTES);
+    bool hiExact = !(hi && keyType == ColType::TEXT && std::get<std::string>(hi->key).size() >= MAX_KEY_BYTES);
+
+    uint16_t pos = 0;
+    if(lo){
+        RowId probe = (lo->inclusive || !loExact) ? RowId{0, 0} : RowId{0xFFFFFFFFu, 0xFFFF};
+        auto path = descend(loKey, probe);
+        pid = path.back();
+        auto g = pool.fetch(file, pid);
+        pos = lowerBound(g.data(), loKey, probe);
+    } else {
+        for(;;){
+            auto g = pool.fetch(file, pid);
+            if(g.data()[0]) break;
+            pid = read_u32(g.data() + 4);
+        }
+    }
+
+    while(pid){
+        auto g = pool.fetch(file, pid);
+        uint16_t count = read_u16(g.data() + 2);
+        for(uint16_t i = pos; i < count; i++){
+            Entry e = entryAt(g.data(), i);
+            if(hi){
+                int c = RowCodec::compare(e.key, hiKey);
+                if(c > 0 || (c == 0 && !hi->inclusive && hiExact)) return;
+            }
+            if(!fn(e.key, e.rid)) return;
+        }
+        pid = read_u32(g.data() + 4);
+        pos = 0;
+    }
+}
+
+void BPlusTree::bulkLoad(std::vector<std::pair<Value, RowId>> entries){
+    if(!empty()) throw std::runtime_error("bulkLoad needs an empty B+tree");
+    for(auto& e : entries) e.first = normalize(e.first);
+    auto less = [](const std::pair<Value, RowId>& a, const std::pair<Value, RowId>& b){
+        return compareEntryKeys(a.first, a.second, b.first, b.second) < 0;
+    };
+    // parallel index builds hand over runs that are already merged
+    if(!std::is_sorted(entries.begin(), entries.end(), less)) std::sort(entries.begin(), entries.end(), less);
+    if(entries.empty()) return;
+    size_t bulkFill = (size_t)pageSize * 9 / 10;
+
+    // leaves, left to right; each page is allocated before its left neighbour
+    // is written so the sibling link is known
+    std::vector<std::pair<Entry, uint32_t>> level; // (first entry, page)
+    Node cur;
+    uint32_t curId;
+    pool.allocate(file, curId);
+    size_t bytes = NODE_HEADER;
+    for(size_t i = 0; i < entries.size(); i++){
+        if(i > 0 && compareEntryKeys(entries[i].first, entries[i].second, entries[i-1].first, entries[i-1].second) == 0) continue;
+        Entry e{entries[i].first, entries[i].second, 0};
+        size_t sz = entrySize(e, true);
+        if(!cur.entries.empty() && bytes + sz > bulkFill){
+            uint32_t nextId;
+            pool.allocate(file, nextId);
+            cur.link = nextId;
+            writeNode(curId, cur);
+            level.push_back({cur.entries.front(), curId});
+            cur = Node{};
+            curId = nextId;
+            bytes = NODE_HEADER;
+        }
+        cur.entries.push_back(e);
+        bytes += sz;
+    }
+    cur.link = 0;
+    writeNode(curId, cur);
+    level.push_back({cur.entries.front(), curId});
+
+    while(level.size() > 1){
+        std::vector<std::pair<Entry, uint32_t>> parents;
+        Node node;
+        node.leaf = false;
+        node.link = level[0].second;
+        Entry first = level[0].first;
+        bytes = NODE_HEADER;
+        for(size_t i = 1; i < level.size(); i++){
+            Entry sep{level[i].first.key, level[i].first.rid, level[i].second};
+            size_t sz = entrySize(sep, false);
+            if(bytes + sz > bulkFill){
+                parents.push_back({first, newNode(node)});
+                node = Node{};
+                node.leaf = false;
+                node.link = level[i].second;
+                first = level[i].first;
+                bytes = NODE_HEADER;
+                continue;
+            }
+            node.entries.push_back(sep);
+            bytes += sz;
+        }
+        parents.push_back({first, newNode(node)});
+        level.swap(parents);
+    }
+    setRoot(level[0].second);
+}
+
+}
@@ -0,0 +1,199 @@
+#include "BufferPool.h"
+#include "DatabaseFile.h"
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+
+namespace tinydb {
+
+PageGuard::PageGuard(BufferPool* p, uint32_t f, uint8_t* d) : pool(p), frame(f), ptr(d) {}
+
+PageGuard::PageGuard(PageGuard&& o) noexcept
+    : pool(o.pool), frame(o.frame), ptr(o.ptr), dirty(o.dirty) {
+    o.pool = nullptr; o.ptr = nullptr; o.dirty = false;
+}
+
+PageGuard& PageGuard::operator=(PageGuard&& o) noexcept {
+    if(this != &o){
+        release();
+        pool = o.pool; frame = o.frame; ptr = o.ptr; dirty = o.dirty;
+        o.pool = nullptr; o.ptr = nullptr; o.dirty = false;
+    }
+    return *this;
+}
+
+PageGuard::~PageGuard() { release(); }
+
+void PageGuard::release() {
+    if(pool) pool->unpin(frame, dirty);
+    pool = nullptr; ptr = nullptr; dirty = false;
+}
+
+BufferPool::BufferPool(size_t frameCount, uint32_t pageSize, DatabaseFile* s)
+    : store(s), pageBytes(s ? s->pageSize() : pageSize) {
+    if(frameCount == 0) throw std::runtime_error("Buffer pool needs at least one frame");
+    if(!validPageSize(pageBytes)) throw std::runtime_error("Unsupported page size");
+    arena.assign(frameCount * pageBytes, 0);
+    frames.resize(frameCount);
+}
+
+BufferPool::~BufferPool() {
+    try { flushAll(); } catch(...) {}
+}
+
+DiskFile& BufferPool::openFile(const std::string& path) {
+    std::lock_guard<std::mutex> lk(mu);
+    auto it = files.find(path);
+    if(it != files.end()) return *it->second;
+    auto f = store ? std::make_unique<DiskFile>(*store, path) : std::make_unique<DiskFile>(path, pageBytes);
+    DiskFile& ref = *f;
+    files.emplace(path, std::move(f));
+    return ref;
+}
+
+void BufferPool::dropFile(const std::string& path) {
+    std::lock_guard<std::mutex> lk(mu);
+    auto it = files.find(path);
+    if(it == files.end()) return;
+    DiskFile* file = it->second.get();
+    for(uint32_t f = 0; f < frames.size(); f++){
+        Frame& fr = frames[f];
+        if(fr.file != file) continue;
+        if(fr.pins > 0) throw std::runtime_error("Cannot drop " + path + ": page pinned");
+        pageTable.erase(PageKey{fr.file, fr.pageId});
+        fr.file = nullptr;
+        fr.dirty = false;
+        fr.ref = false;
+    }
+    files.erase(it);
+}
+
+void BufferPool::truncateFile(DiskFile& file, uint32_t pages) {
+    std::lock_guard<std::mutex> lk(mu);
+    for(uint32_t f = 0; f < frames.size(); f++){
+        Frame& fr = frames[f];
+        if(fr.file != &file || fr.pageId < pages) continue;
+        if(fr.pins > 0) throw std::runtime_error("Cannot truncate " + file.filePath() + ": page pinned");
+        pageTable.erase(PageKey{fr.file, fr.pageId});
+        fr.file = nullptr;
+        fr.dirty = false;
+        fr.ref = false;
+    }
+    file.truncate(pages);
+}
+
+bool BufferPool::fileExists(const std::string& path) {
+    return store ? store->hasSegment(path) : std::filesystem::exists(path);
+}
+
+void BufferPool::removeFile(const std::string& path) {
+    dropFile(path);
+    if(store) store->removeSegment(path);
+    else std::filesystem::remove(path);
+}
+
+void BufferPool::renameFile(const std::string& from, const std::string& to) {
+    dropFile(from);
+    dropFile(to);
+    if(store) store->renameSegment(from, to);
+    else std::filesystem::rename(from, to);
+}
+
+void BufferPool::writeBack(uint32_t f) {
+    Frame& fr = frames[f];
+    if(fr.file && fr.dirty){
+        if(writeBarrier) writeBarrier();
+        fr.file->writePage(fr.pageId, frameData(f));
+        fr.dirty = false;
+    }
+}
+
+uint32_t BufferPool::victim() {
+    uint32_t n = (uint32_t)frames.size();
+    for(uint32_t step = 0; step < 2 * n; step++){
+        uint32_t f = clockHand;
+        clockHand = (clockHand + 1) % n;
+        Frame& fr = frames[f];
+        if(fr.pins > 0) continue;
+        if(fr.ref){ fr.ref = false; continue; }
+
+        if(fr.file){
+            writeBack(f);
+            pageTable.erase(PageKey{fr.file, fr.pageId});
+            fr.file = nullptr;
+        }
+        return f;
+    }
+    throw std::runtime_error("Buffer pool exhausted: all frames pinned");
+}
+
+PageGuard BufferPool::fetch(DiskFile& file, uint32_t pageId) {
+    std::lock_guard<std::mutex> lk(mu);
+    auto it = pageTable.find(PageKey{&file, pageId});
+    if(it != pageTable.end()){
+        Frame& fr = frames[it->second];
+        fr.pins++;
+        fr.ref = true;
+        return PageGuard(this, it->second, frameData(it->second));
+    }
+
+    uint32_t f = victim();
+    file.readPage(pageId, frameData(f));
+    Frame& fr = frames[f];
+    fr.file = &file; fr.pageId = pageId; fr.pins = 1; fr.dirty = false; fr.ref = true;
+    pageTable[PageKey{&file, pageId}] = f;
+    return PageGuard(this, f, frameData(f));
+}
+
+PageGuard BufferPool::fetchRead(DiskFile& file, uint32_t pageId) {
+    if(file.mmapEnabled()){
+        std::unique_lock<std::mutex> lk(mu);
+        if(pageTable.find(PageKey{&file, pageId}) == pageTable.end()){
+            const uint8_t* p = file.mappedPage(pageId);
+            if(p) return PageGuard::borrowed(p);
+        }
+    }
+    return fetch(file, pageId);
+}
+
+PageGuard BufferPool::allocate(DiskFile& file, uint32_t& pageId) {
+    std::lock_guard<std::mutex> lk(mu);
+    uint32_t f = victim();
+    pageId = file.allocatePage();
+    std::memset(frameData(f), 0, pageBytes);
+    Frame& fr = frames[f];
+    fr.file = &file; fr.pageId = pageId; fr.pins = 1; fr.dirty = true; fr.ref = true;
+    pageTable[PageKey{&file, pageId}] = f;
+    return PageGuard(this, f, frameData(f));
+}
+
+bool BufferPool::resident(const DiskFile& file, uint32_t pageId) {
+    std::lock_guard<std::mutex> lk(mu);
+    return pageTable.count(PageKey{&file, pageId}) > 0;
+}
+
+void BufferPool::unpin(uint32_t f, bool dirty) {
+    std::lock_guard<std::mutex> lk(mu);
+    Frame& fr = frames[f];
+    if(fr.pins > 0) fr.pins--;
+    if(dirty) fr.dirty = true;
+}
+
+void BufferPool::flushFile(DiskFile& file) {
+    std::lock_guard<std::mutex> lk(mu);
+    for(uint32_t f = 0; f < frames.size(); f++){
+        if(frames[f].file == &file) writeBack(f);
+    }
+}
+
+void BufferPool::flushAll() {
+    std::lock_guard<std::mutex> lk(mu);
+    for(uint32_t f = 0; f < frames.size(); f++) writeBack(f);
+}
+
+void BufferPool::syncAll() {
+    std::lock_guard<std::mutex> lk(mu);
+    for(auto& kv : files) kv.second->sync();
+}
+
+}
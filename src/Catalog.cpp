@@ -1,14 +1,98 @@
 #include "Catalog.h"
+#include "DatabaseFile.h"
+#include <algorithm>
 #include <filesystem>
 #include <fstream>
+#include <sstream>
 #include <stdexcept>
 
 namespace tinydb {
 
-Catalog::Catalog(const std::string& dbDir) : dir(dbDir) {
+// the .schema file format: table name, column count, "name type" lines
+static Schema parseSchema(std::istream& in) {
+    Schema s;
+    std::getline(in, s.tableName);
+
+    size_t n = 0;
+    in >> n;
+    in.ignore();
+
+    for (size_t i = 0; i < n; i++) {
+        Column col;
+        int t;
+        in >> col.name >> t;
+        in.ignore();
+        col.type = (ColType)t;
+        s.columns.push_back(col);
+    }
+    if (!in) throw std::runtime_error("Malformed schema for " + s.tableName);
+    return s;
+}
+
+static void printSchema(std::ostream& out, const Schema& schema) {
+    out << schema.tableName << "\n";
+    out << schema.columns.size() << "\n";
+    for (auto& c : schema.columns) {
+        out << c.name << " " << (int)c.type << "\n";
+    }
+}
+
+static bool parseIndex(std::istream& in, const std::string& tableName, IndexDef& d) {
+    int kind;
+    if (!(in >> d.name >> d.col >> kind)) return false;
+    d.table = tableName;
+    d.kind = (IndexKind)kind;
+    return true;
+}
+
+static void printIndex(std::ostream& out, const IndexDef& d) {
+    out << d.name << " " << d.col << " " << (int)d.kind << "\n";
+}
+
+Catalog::Catalog(const std::string& dbDir, DatabaseFile* s) : dir(dbDir), store(s) {
     if (!std::filesystem::exists(dir)) {
         std::filesystem::create_directories(dir);
     }
+
+    if (store) {
+        // table count, then per table its schema, index count and index lines
+        std::istringstream in(store->catalog());
+        size_t tables = 0;
+        in >> tables;
+        in.ignore();
+        for (size_t t = 0; t < tables; t++) {
+            in >> std::ws;
+            Schema schema = parseSchema(in);
+            indexColumns(schema);
+            size_t n = 0;
+            in >> n;
+            in.ignore();
+            std::vector<IndexDef> defs(n);
+            for (auto& d : defs) {
+                if (!parseIndex(in, schema.tableName, d)) throw std::runtime_error("Malformed catalog");
+            }
+            if (!defs.empty()) indexDefs.emplace(schema.tableName, std::move(defs));
+            std::string name = schema.tableName;
+            schemas.emplace(std::move(name), std::move(schema));
+        }
+        return;
+    }
+
+    for (auto& entry : std::filesystem::directory_iterator(dir)) {
+        if (entry.path().extension() != ".schema") continue;
+        std::string name = entry.path().stem().string();
+        if (!std::filesystem::exists(tablePath(name))) continue;
+        schemas.emplace(name, readSchema(name));
+        auto defs = readIndexes(name);
+        if (!defs.empty()) indexDefs.emplace(name, std::move(defs));
+    }
+}
+
+void Catalog::indexColumns(Schema& schema) {
+    schema.positions.clear();
+    for (size_t i = 0; i < schema.columns.size(); i++) {
+        schema.positions.emplace(schema.columns[i].name, (int)i);
+    }
 }
 
 std::string Catalog::tablePath(const std::string& tableName) const {
@@ -19,9 +103,39 @@ std::string Catalog::schemaPath(const std::string& tableName) const {
     return dir + "/" + tableName + ".schema";
 }
 
+std::string Catalog::fsmPath(const std::string& tableName) const {
+    return dir + "/" + tableName + ".fsm";
+}
+
+std::string Catalog::toastPath(const std::string& tableName) const {
+    return dir + "/" + tableName + ".toast";
+}
+
+std::string Catalog::toastFsmPath(const std::string& tableName) const {
+    return dir + "/" + tableName + ".tfsm";
+}
+
+std::string Catalog::btreePath(const std::string& tableName, const std::string& col) const {
+    return dir + "/" + tableName + "." + col + ".bpt";
+}
+
+std::string Catalog::hashSnapshotPath(const std::string& tableName, const std::string& col) const {
+    return dir + "/" + tableName + "." + col + ".hix";
+}
+
+std::string Catalog::indexListPath(const std::string& tableName) const {
+    return dir + "/" + tableName + ".idx";
+}
+
 bool Catalog::hasTable(const std::string& tableName) const {
-    return std::filesystem::exists(schemaPath(tableName)) &&
-           std::filesystem::exists(tablePath(tableName));
+    return schemas.count(tableName) > 0;
+}
+
+std::vector<std::string> Catalog::listTables() const {
+    std::vector<std::string> names;
+    for (auto& kv : schemas) names.push_back(kv.first);
+    std::sort(names.begin(), names.end());
+    return names;
 }
 
 bool Catalog::createTable(const Schema& schema) {
@@ -29,41 +143,120 @@ bool Catalog::createTable(const Schema& schema) {
     if (schema.columns.empty()) return false;
     if (hasTable(schema.tableName)) return false;
 
-    std::ofstream out(schemaPath(schema.tableName), std::ios::binary);
-    if (!out.is_open()) return false;
+    Schema cached = schema;
+    indexColumns(cached);
 
-    out << schema.tableName << "\n";
-    out << schema.columns.size() << "\n";
-    for (auto& c : schema.columns) {
-        out << c.name << " " << (int)c.type << "\n";
+    if (store) {
+        schemas.emplace(schema.tableName, std::move(cached));
+        if (saveToStore()) return true;
+        schemas.erase(schema.tableName);
+        return false;
     }
+
+    std::ofstream out(schemaPath(schema.tableName), std::ios::binary);
+    if (!out.is_open()) return false;
+    printSchema(out, schema);
     out.close();
 
     std::ofstream tfile(tablePath(schema.tableName), std::ios::binary);
     tfile.close();
+
+    schemas.emplace(schema.tableName, std::move(cached));
     return true;
 }
 
-Schema Catalog::loadSchema(const std::string& tableName) const {
+bool Catalog::saveToStore() const {
+    std::vector<std::string> names = listTables();
+    std::ostringstream out;
+    out << names.size() << "\n";
+    for (auto& name : names) {
+        printSchema(out, schemas.at(name));
+        const auto& defs = loadIndexes(name);
+        out << defs.size() << "\n";
+        for (auto& d : defs) printIndex(out, d);
+    }
+    try {
+        store->setCatalog(out.str());
+    } catch (const std::exception&) {
+        return false;
+    }
+    return true;
+}
+
+const Schema& Catalog::loadSchema(const std::string& tableName) const {
+    auto it = schemas.find(tableName);
+    if (it == schemas.end()) throw std::runtime_error("Schema not found: " + tableName);
+    return it->second;
+}
+
+Schema Catalog::readSchema(const std::string& tableName) const {
     std::ifstream in(schemaPath(tableName), std::ios::binary);
     if (!in.is_open()) throw std::runtime_error("Schema not found: " + tableName);
 
-    Schema s;
-    std::getline(in, s.tableName);
+    Schema s = parseSchema(in);
+    indexColumns(s);
+    return s;
+}
 
-    size_t n = 0;
-    in >> n;
-    in.ignore();
+const std::vector<IndexDef>& Catalog::loadIndexes(const std::string& tableName) const {
+    static const std::vector<IndexDef> none;
+    auto it = indexDefs.find(tableName);
+    return it == indexDefs.end() ? none : it->second;
+}
 
-    for (size_t i = 0; i < n; i++) {
-        Column col;
-        int t;
-        in >> col.name >> t;
-        in.ignore();
-        col.type = (ColType)t;
-        s.columns.push_back(col);
+std::vector<IndexDef> Catalog::readIndexes(const std::string& tableName) const {
+    std::vector<IndexDef> defs;
+    std::ifstream in(indexListPath(tableName), std::ios::binary);
+    if (!in.is_open()) return defs;
+
+    IndexDef d;
+    while (parseIndex(in, tableName, d)) defs.push_back(d);
+    return defs;
+}
+
+bool Catalog::writeIndexes(const std::string& tableName, const std::vector<IndexDef>& defs) {
+    if (store) {
+        auto old = indexDefs;
+        if (defs.empty()) indexDefs.erase(tableName);
+        else indexDefs[tableName] = defs;
+        if (saveToStore()) return true;
+        indexDefs = std::move(old);
+        return false;
     }
-    return s;
+
+    std::ofstream out(indexListPath(tableName), std::ios::binary | std::ios::trunc);
+    if (!out.is_open()) return false;
+    for (auto& d : defs) printIndex(out, d);
+    return (bool)out;
+}
+
+bool Catalog::findIndex(const std::string& indexName, IndexDef& out) const {
+    for (auto& kv : indexDefs) {
+        for (auto& d : kv.second) {
+            if (d.name == indexName) { out = d; return true; }
+        }
+    }
+    return false;
+}
+
+bool Catalog::createIndex(const IndexDef& def) {
+    if (def.name.empty() || !hasTable(def.table)) return false;
+    auto defs = loadIndexes(def.table);
+    defs.push_back(def);
+    if (!writeIndexes(def.table, defs)) return false;
+    indexDefs[def.table] = std::move(defs);
+    return true;
+}
+
+bool Catalog::dropIndex(const std::string& indexName) {
+    IndexDef def;
+    if (!findIndex(indexName, def)) return false;
+    auto defs = loadIndexes(def.table);
+    defs.erase(std::remove_if(defs.begin(), defs.end(), [&](const IndexDef& d){ return d.name == indexName; }), defs.end());
+    if (!writeIndexes(def.table, defs)) return false;
+    if (defs.empty()) indexDefs.erase(def.table);
+    else indexDefs[def.table] = std::move(defs);
+    return true;
 }
 
 }
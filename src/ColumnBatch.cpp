@@ -0,0 +1,120 @@
+#include "ColumnBatch.h"
+#include "Kernels.h"
+#include <limits>
+#include <stdexcept>
+
+namespace tinydb {
+
+BatchScanner::BatchScanner(ScanCursor& c, const Schema& s, std::vector<int> cs, ToastStore* t)
+    : cursor(c), schema(s), cols(std::move(cs)), toast(t) {
+    for (size_t c = 0; c < cols.size(); c++) {
+        offsets.push_back(RowCodec::fixedOffset(schema, cols[c]));
+        if (schema.columns[cols[c]].type == ColType::INT32 && offsets[c]) continue;
+        walked.push_back(cols[c]);
+        walkedAt.push_back(c);
+    }
+}
+
+bool BatchScanner::next(ColumnBatch& batch) {
+    batch.size = 0;
+    batch.rids.clear();
+    batch.columns.resize(cols.size());
+    for (size_t c = 0; c < cols.size(); c++) {
+        batch.columns[c].type = schema.columns[cols[c]].type;
+        batch.columns[c].ints.clear();
+        batch.columns[c].texts.clear();
+    }
+
+    while (batch.size < BATCH_ROWS) {
+        const ScanRow* r = cursor.next();
+        if (!r) break;
+        batch.rids.push_back(r->rid);
+        for (size_t c = 0; c < cols.size(); c++) {
+            ColumnVector& v = batch.columns[c];
+            if (v.type == ColType::INT32 && offsets[c]) {
+                if (offsets[c] + 4 > r->bytes.size) throw std::runtime_error("pop_i32 overflow");
+                v.ints.push_back((int32_t)read_u32(r->bytes.data + offsets[c]));
+            }
+        }
+        if (!walked.empty()) {
+            auto vals = RowCodec::decodeColumns(schema, r->bytes, walked, toast);
+            for (size_t k = 0; k < walked.size(); k++) {
+                ColumnVector& v = batch.columns[walkedAt[k]];
+                if (v.type == ColType::INT32) v.ints.push_back(std::get<int32_t>(vals[k]));
+                else v.texts.push_back(std::move(std::get<std::string>(vals[k])));
+            }
+        }
+        batch.size++;
+    }
+
+    batch.sel.resize(batch.size + Kernels::SEL_SLACK);
+    for (size_t i = 0; i < batch.size; i++) batch.sel[i] = (uint32_t)i;
+    batch.selected = batch.size;
+    return batch.size > 0;
+}
+
+static int32_t intBound(const KeyBound& b) {
+    if (!std::holds_alternative<int32_t>(b.key)) throw std::runtime_error("cannot compare INT32 with TEXT");
+    return std::get<int32_t>(b.key);
+}
+
+static const std::string& textBound(const KeyBound& b) {
+    if (!std::holds_alternative<std::string>(b.key)) throw std::runtime_error("cannot compare INT32 with TEXT");
+    return std::get<std::string>(b.key);
+}
+
+// the bounds as one closed interval; false when it is empty
+static bool closedRange(const KeyBound* lo, const KeyBound* hi, int32_t& a, int32_t& b) {
+    a = std::numeric_limits<int32_t>::min();
+    b = std::numeric_limits<int32_t>::max();
+    if (lo) {
+        a = intBound(*lo);
+        if (!lo->inclusive) {
+            if (a == std::numeric_limits<int32_t>::max()) return false;
+            a++;
+        }
+    }
+    if (hi) {
+        b = intBound(*hi);
+        if (!hi->inclusive) {
+            if (b == std::numeric_limits<int32_t>::min()) return false;
+            b--;
+        }
+    }
+    return a <= b;
+}
+
+void filterRange(ColumnBatch& batch, size_t c, const KeyBound* lo, const KeyBound* hi) {
+    if (!lo && !hi) return;
+    const ColumnVector& v = batch.columns[c];
+
+    if (v.type == ColType::INT32) {
+        int32_t a, b;
+        if (!closedRange(lo, hi, a, b)) batch.selected = 0;
+        else if (batch.selected == batch.size)
+            batch.selected = Kernels::selectBetween(v.ints.data(), batch.size, a, b, batch.sel.data());
+        else
+            batch.selected = Kernels::refineBetween(v.ints.data(), batch.sel.data(), batch.selected, a, b);
+        return;
+    }
+
+    const std::string* loKey = lo ? &textBound(*lo) : nullptr;
+    const std::string* hiKey = hi ? &textBound(*hi) : nullptr;
+    size_t k = 0;
+    for (size_t j = 0; j < batch.selected; j++) {
+        uint32_t i = batch.sel[j];
+        const std::string& key = v.texts[i];
+        if (loKey) {
+            int cmp = key.compare(*loKey);
+            if (cmp < 0 || (cmp == 0 && !lo->inclusive)) continue;
+        }
+        if (hiKey) {
+            int cmp = key.compare(*hiKey);
+            if (cmp > 0 || (cmp == 0 && !hi->inclusive)) continue;
+        }
+        batch.sel[k++] = i;
+    }
+    batch.selected = k;
+}
+
+}
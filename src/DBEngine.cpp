@@ -2,15 +2,161 @@
 #include "SQLParser.h"
 #include "TableFile.h"
 #include "TableScanner.h"
+#include "ColumnBatch.h"
+#include "Aggregate.h"
+#include "Predicate.h"
 #include "RowCodec.h"
 
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <queue>
 #include <sstream>
+#include <stdexcept>
 #include <unordered_map>
+#include <unordered_set>
 
 namespace tinydb {
 
-DBEngine::DBEngine(const std::string& dbDir)
-    : catalog(dbDir), wal(dbDir + "/db.wal") {}
+// a directory that already holds a database file stays in single-file mode;
+// one that holds per-file tables is never switched to it, which would hide
+// them. Per-file tables without DB_HEADER_NAME were written before it
+// existed, possibly in an older page layout, so such a directory is refused
+// rather than guessed at. This runs before anything else opens a file in
+// the directory.
+static std::unique_ptr<DatabaseFile> openStore(const std::string& dbDir, const DBOptions& o){
+    std::string path = dbDir + "/" + DB_FILE_NAME;
+    bool single = std::filesystem::exists(path);
+    if(!single && std::filesystem::is_directory(dbDir)){
+        for(auto& entry : std::filesystem::directory_iterator(dbDir)){
+            if(entry.path().extension() != ".schema") continue;
+            if(o.singleFile)
+                throw std::runtime_error("Cannot open " + dbDir + " as a single file: it holds per-file tables");
+            if(!std::filesystem::exists(dbDir + "/" + DB_HEADER_NAME))
+                throw std::runtime_error("Cannot open " + dbDir + ": its tables predate " + DB_HEADER_NAME);
+            break;
+        }
+    }
+    if(!o.singleFile && !single) return nullptr;
+    std::filesystem::create_directories(dbDir);
+    // an existing file keeps the page size it was created with
+    return std::make_unique<DatabaseFile>(path, o.pageSize ? o.pageSize : DEFAULT_PAGE_SIZE);
+}
+
+// the page size of a directory database, fixed by DB_HEADER_NAME when the
+// first engine opens it; openStore has refused directories with tables but
+// no header. A header naming another page format is refused too; headers
+// from before the format line was added all describe PAGE_FORMAT pages.
+static uint32_t directoryPageSize(const std::string& dbDir, const DBOptions& o){
+    std::string path = dbDir + "/" + DB_HEADER_NAME;
+    std::ifstream in(path);
+    std::string key;
+    uint32_t size = 0, format = PAGE_FORMAT;
+    if(in.is_open()){
+        if(!(in >> key >> size) || key != "page_size") throw std::runtime_error("Malformed " + path);
+        if(in >> key && (key != "format" || !(in >> format))) throw std::runtime_error("Malformed " + path);
+        if(format != PAGE_FORMAT)
+            throw std::runtime_error("Unsupported page format " + std::to_string(format) + " in " + path);
+        return size;
+    }
+
+    size = o.pageSize ? o.pageSize : DEFAULT_PAGE_SIZE;
+    if(!validPageSize(size)) throw std::runtime_error("Unsupported page size");
+    std::string tmp = path + ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::trunc);
+        out << "page_size " << size << "\n" << "format " << PAGE_FORMAT << "\n";
+        if(!out) throw std::runtime_error("Cannot write " + path);
+    }
+    std::filesystem::rename(tmp, path);
+    return size;
+}
+
+DBEngine::DBEngine(const std::string& dbDir, const DBOptions& o)
+    : opts(o), store(openStore(dbDir, o)), catalog(dbDir, store.get()), wal(dbDir + "/db.wal", o.wal),
+      pool(o.poolFrames, store ? store->pageSize() : directoryPageSize(dbDir, o), store.get()), workers(o.indexThreads) {
+    pool.setWriteBarrier([this]{ wal.flush(); });
+    recover();
+    startIndexBuild();
+}
+
+DBEngine::~DBEngine(){
+    stopBuild = true;
+    if(indexBuilder.joinable()) indexBuilder.join();
+    try { checkpoint(); } catch(...) {}
+}
+
+static uint64_t ridKey(const RowId& rid){
+    return ((uint64_t)rid.pageId << 16) | rid.slotId;
+}
+
+static RowId ridFromKey(uint64_t key){
+    return RowId{(uint32_t)(key >> 16), (uint16_t)(key & 0xFFFF)};
+}
+
+// drops the given rows from h and adds them back as they are now
+static void refreshRows(TypedHashIndex& h, TableFile& tf, ToastStore& toast, const Schema& schema, int ci,
+                        const std::unordered_set<uint64_t>& rows){
+    if(rows.empty()) return;
+    h.removeRows([&](const RowId& rid){ return rows.count(ridKey(rid)) > 0; });
+    for(uint64_t key : rows){
+        RowId rid = ridFromKey(key);
+        auto bytes = tf.readRow(rid);
+        if(!bytes.empty()) h.add(RowCodec::decodeColumn(schema, bytes, ci, &toast), rid);
+    }
+}
+
+// redo everything logged since the last checkpoint; records the page
+// already reflects (page LSN >= record LSN) are skipped. B+tree pages are
+// not logged, so trees of replayed tables are dropped and rebuilt; hash
+// index snapshots are brought up to date from the redone rows.
+void DBEngine::recover(){
+    wal.replay([&](const LogRecord& rec){
+        // chunks of out-of-line values hold no index keys of their own
+        std::string owner = ToastStore::tableOf(rec.table);
+        if(!owner.empty()){
+            if(catalog.hasTable(owner)) openToast(owner).file().redo(rec);
+            return;
+        }
+        if(!catalog.hasTable(rec.table)) return;
+        openTable(rec.table).redo(rec);
+        // a moved row belongs to its home slot, which is what indexes hold
+        RowId rid{rec.page, rec.slot};
+        if((SlotKind)rec.kind==SlotKind::Moved) rid = SlottedPage::linkOf(rec.bytes);
+        replayedRows[rec.table].emplace_back(rec.lsn, rid);
+    });
+    for(auto& kv : replayedRows){
+        for(auto& def : catalog.loadIndexes(kv.first)){
+            if(def.kind==IndexKind::BTREE) pool.removeFile(catalog.btreePath(kv.first, def.col));
+        }
+        tableIndexes(kv.first, catalog.loadSchema(kv.first));
+    }
+    replayedRows.clear();
+    checkpoint();
+}
+
+// once the table files hold every logged change, dirty hash indexes are
+// snapshotted at the current LSN before the log is emptied
+void DBEngine::checkpoint(){
+    wal.flush();
+    pool.flushAll();
+    pool.syncAll();
+    uint64_t lsn = wal.currentLSN();
+    for(auto& t : indexes){
+        for(auto& kv : t.second.hash){
+            if(kv.second.dirty()) kv.second.save(catalog.hashSnapshotPath(t.first, kv.first), lsn);
+        }
+    }
+    wal.truncate();
+}
+
+void DBEngine::commitStatement(){
+    wal.commit(wal.currentLSN());
+    if(wal.bytesSinceCheckpoint() >= opts.checkpointBytes) checkpoint();
+}
 
 std::string DBEngine::jsonEscape(const std::string& s) const {
     std::string out;
@@ -23,37 +169,594 @@ std::string DBEngine::jsonEscape(const std::string& s) const {
     return out;
 }
 
-int DBEngine::colIndex(const Schema& schema, const std::string& col) const{
-    for(size_t i=0;i<schema.columns.size();i++){
-        if(schema.columns[i].name==col) return (int)i;
+// one element of a "rows" array, after a comma unless it is the first
+void DBEngine::appendRowJson(std::string& out, const Schema& schema, const RowId& rid,
+                             const std::vector<Value>& vals) const {
+    if(!out.empty()) out += ",";
+    out += R"({"rid":{"page":)" + std::to_string(rid.pageId) + R"(,"slot":)" + std::to_string(rid.slotId) +
+           R"(},"data":")" + jsonEscape(RowCodec::toString(schema, vals)) + R"("})";
+}
+
+// the per-morsel pieces of a JSON array, in page order
+static void joinParts(std::ostringstream& oss, const std::vector<std::string>& parts){
+    bool first = true;
+    for(auto& p : parts){
+        if(p.empty()) continue;
+        if(!first) oss << ",";
+        first = false;
+        oss << p;
+    }
+}
+
+TableFile DBEngine::openTable(const std::string& table){
+    auto& fsm = freeSpace[table];
+    if(!fsm) fsm = std::make_unique<FreeSpaceMap>(pool, catalog.fsmPath(table));
+    TableFile tf(pool, catalog.tablePath(table), *fsm);
+    tf.attachLog(wal, table);
+    tf.setReadAhead(opts.readAheadPages);
+    if(opts.mmapReads) tf.enableMmap();
+    return tf;
+}
+
+// the side table and its free space map are only created once a value
+// goes out of line
+ToastStore DBEngine::openToast(const std::string& table){
+    return ToastStore(pool.pageSize(), [this, table]{
+        std::string log = ToastStore::logName(table);
+        auto& fsm = freeSpace[log];
+        if(!fsm) fsm = std::make_unique<FreeSpaceMap>(pool, catalog.toastFsmPath(table));
+        TableFile tf(pool, catalog.toastPath(table), *fsm);
+        tf.attachLog(wal, log);
+        if(opts.mmapReads) tf.enableMmap();
+        return tf;
+    });
+}
+
+DBEngine::TableIndexes& DBEngine::tableIndexes(const std::string& table, const Schema& schema){
+    auto it = indexes.find(table);
+    if(it!=indexes.end()) return it->second;
+    auto& ti = indexes[table];
+    TableFile tf = openTable(table);
+    ToastStore toast = openToast(table);
+    auto rest = openIndexes(ti, tf, toast, schema, catalog.loadIndexes(table), false);
+    scanIndexes(ti, tf, toast, schema, rest, workers, nullptr, nullptr);
+    return ti;
+}
+
+// hash indexes come from their snapshot and B+trees from their file when
+// those exist; returns the definitions that still need a table scan.
+// `fresh` discards whatever is on disk.
+std::vector<IndexDef> DBEngine::openIndexes(TableIndexes& ti, TableFile& tf, ToastStore& toast, const Schema& schema,
+                                            const std::vector<IndexDef>& defs, bool fresh){
+    std::vector<IndexDef> rest;
+    for(auto& def : defs){
+        int ci = schema.colIndex(def.col);
+        if(ci<0) throw std::runtime_error("Index " + def.name + " on unknown column " + def.col);
+
+        if(def.kind==IndexKind::HASH){
+            TypedHashIndex& h = ti.hash.emplace(def.col, TypedHashIndex(schema.columns[ci].type)).first->second;
+            std::string snap = catalog.hashSnapshotPath(def.table, def.col);
+            uint64_t snapLSN;
+            if(fresh){
+                std::filesystem::remove(snap);
+            } else if(h.load(snap, snapLSN)){
+                auto redone = replayedRows.find(def.table);
+                if(redone==replayedRows.end()) continue;
+                std::unordered_set<uint64_t> stale;
+                for(auto& r : redone->second){
+                    if(r.first > snapLSN) stale.insert(ridKey(r.second));
+                }
+                refreshRows(h, tf, toast, schema, ci, stale);
+                continue;
+            }
+            ti.hash.erase(def.col);
+            rest.push_back(def);
+            continue;
+        }
+
+        std::string path = catalog.btreePath(def.table, def.col);
+        if(fresh){
+            ti.btree.erase(def.col);
+            pool.removeFile(path);
+        } else if(pool.fileExists(path)){
+            ti.btree[def.col] = std::make_unique<BPlusTree>(pool, path, schema.columns[ci].type);
+            continue;
+        }
+        rest.push_back(def);
+    }
+    return rest;
+}
+
+using KeyRun = std::vector<std::pair<Value, RowId>>;
+
+static bool entryLess(const std::pair<Value, RowId>& a, const std::pair<Value, RowId>& b){
+    int c = RowCodec::compare(a.first, b.first);
+    if(c!=0) return c<0;
+    return ridKey(a.second) < ridKey(b.second);
+}
+
+// keys of the given columns for every live row, in page order. The pages
+// are cut into ranges that the pool decodes in parallel, each into its own
+// runs; runs of `sorted` columns are sorted by their worker and merged.
+static std::vector<KeyRun> collectKeys(ThreadPool& threads, TableFile& tf, ToastStore& toast, const Schema& schema,
+                                                 const std::vector<int>& cols, const std::vector<bool>& sorted,
+                                                 std::shared_mutex* writers, const std::atomic<bool>* cancel){
+    static constexpr uint32_t RANGE_PAGES = 256;
+    TableScanner sc(tf);
+    MorselPlan plan = sc.plan(RANGE_PAGES);
+
+    std::vector<std::vector<KeyRun>> parts(plan.count(), std::vector<KeyRun>(cols.size()));
+    ToastStore chunks(toast, writers);
+    sc.scanParallel(threads, plan, [&](size_t r, ScanCursor& cursor){
+        if(cancel && *cancel) throw std::runtime_error("index build cancelled");
+        auto& out = parts[r];
+        for(const ScanRow& row : cursor){
+            auto vals = RowCodec::decodeColumns(schema, row.bytes, cols, &chunks);
+            for(size_t i = 0; i < cols.size(); i++) out[i].emplace_back(std::move(vals[i]), row.rid);
+        }
+        for(size_t i = 0; i < cols.size(); i++){
+            if(sorted[i]) std::sort(out[i].begin(), out[i].end(), entryLess);
+        }
+    }, writers);
+
+    std::vector<KeyRun> keys(cols.size());
+    for(size_t i = 0; i < cols.size(); i++){
+        size_t total = 0;
+        for(auto& p : parts) total += p[i].size();
+        keys[i].reserve(total);
+        for(auto& p : parts){
+            size_t mid = keys[i].size();
+            keys[i].insert(keys[i].end(), std::make_move_iterator(p[i].begin()), std::make_move_iterator(p[i].end()));
+            KeyRun().swap(p[i]);
+            if(sorted[i]) std::inplace_merge(keys[i].begin(), keys[i].begin() + mid, keys[i].end(), entryLess);
+        }
+    }
+    return keys;
+}
+
+// builds the given indexes from one parallel pass over the table. With
+// `writers` the table may change meanwhile; `seen` then receives the B+tree
+// keys the pass found, so the caller can repair rows that changed.
+void DBEngine::scanIndexes(TableIndexes& ti, TableFile& tf, ToastStore& toast, const Schema& schema,
+                           const std::vector<IndexDef>& defs, ThreadPool& threads, std::shared_mutex* writers,
+                           std::unordered_map<std::string, KeyRun>* seen){
+    if(defs.empty()) return;
+    std::vector<int> cols;
+    std::vector<bool> sorted;
+    for(auto& def : defs){
+        cols.push_back(schema.colIndex(def.col));
+        sorted.push_back(def.kind==IndexKind::BTREE);
+    }
+    auto keys = collectKeys(threads, tf, toast, schema, cols, sorted, writers, writers ? &stopBuild : nullptr);
+
+    for(size_t i = 0; i < defs.size(); i++){
+        ColType type = schema.columns[cols[i]].type;
+        if(defs[i].kind==IndexKind::HASH){
+            TypedHashIndex h(type);
+            for(auto& e : keys[i]) h.add(e.first, e.second);
+            ti.hash.insert_or_assign(defs[i].col, std::move(h));
+        } else {
+            if(seen) (*seen)[defs[i].col] = keys[i];
+            ti.btree[defs[i].col] = writeBTree(defs[i].table, defs[i].col, type, std::move(keys[i]));
+        }
+        KeyRun().swap(keys[i]);
+    }
+}
+
+// the tree is built under a temporary name, synced and renamed into place,
+// so a crash never leaves a partial tree behind the real name
+std::unique_ptr<BPlusTree> DBEngine::writeBTree(const std::string& table, const std::string& col, ColType type, KeyRun entries){
+    std::string path = catalog.btreePath(table, col);
+    std::string tmp = path + ".tmp";
+    pool.removeFile(tmp);
+    {
+        BPlusTree bt(pool, tmp, type);
+        bt.bulkLoad(std::move(entries));
+    }
+    DiskFile& f = pool.openFile(tmp);
+    pool.flushFile(f);
+    f.sync();
+    pool.renameFile(tmp, path);
+    return std::make_unique<BPlusTree>(pool, path, type);
+}
+
+// tables already in use (recovery) keep their indexes. Snapshots and tree
+// files are opened here either way; only the scans move to the background.
+void DBEngine::startIndexBuild(){
+    if(opts.indexBuild==IndexBuild::Lazy) return;
+
+    std::vector<IndexJob> jobs;
+    for(auto& table : catalog.listTables()){
+        if(indexes.count(table)) continue;
+        const auto& defs = catalog.loadIndexes(table);
+        if(defs.empty()) continue;
+        const Schema& schema = catalog.loadSchema(table);
+        TableFile tf = openTable(table);
+        ToastStore toast = openToast(table);
+        auto rest = openIndexes(indexes[table], tf, toast, schema, defs, false);
+        if(opts.indexBuild==IndexBuild::Eager) scanIndexes(indexes[table], tf, toast, schema, rest, workers, nullptr, nullptr);
+        else if(!rest.empty()) jobs.push_back(IndexJob{table, schema, std::move(rest), tf, toast});
+    }
+    if(jobs.empty()) return;
+
+    for(auto& j : jobs) building.insert(j.table);
+    indexBuilder = std::thread([this, jobs = std::move(jobs)]() mutable { buildInBackground(std::move(jobs)); });
+}
+
+// builds outside the statement lock, then installs each table's indexes
+// under it after re-reading the rows statements changed in the meantime
+void DBEngine::buildInBackground(std::vector<IndexJob> jobs){
+    // a pool of its own: a statement may wait on `workers` while holding the
+    // lock these tasks need to read pages
+    ThreadPool threads(opts.indexThreads);
+
+    for(auto& j : jobs){
+        TableIndexes built;
+        std::unordered_map<std::string, KeyRun> seen;
+        bool ok = false;
+        try {
+            scanIndexes(built, j.tf, j.toast, j.schema, j.defs, threads, &stmtMu, &seen);
+            ok = true;
+        } catch(const std::exception& e){
+            if(!stopBuild) std::cerr << "index build for " << j.table << " failed: " << e.what() << "\n";
+        }
+
+        std::unique_lock<std::shared_mutex> lk(stmtMu);
+        building.erase(j.table);
+        std::unordered_set<uint64_t> changed = std::move(changedRows[j.table]);
+        changedRows.erase(j.table);
+        TableIndexes& ti = indexes[j.table];
+
+        if(!ok){
+            // the rows moved on without these trees; rebuilt on the next start
+            for(auto& kv : built.btree){
+                std::string path = catalog.btreePath(j.table, kv.first);
+                kv.second.reset();
+                pool.removeFile(path);
+            }
+            continue;
+        }
+
+        for(auto& kv : built.hash){
+            refreshRows(kv.second, j.tf, j.toast, j.schema, j.schema.colIndex(kv.first), changed);
+            ti.hash.insert_or_assign(kv.first, std::move(kv.second));
+        }
+        for(auto& kv : built.btree){
+            int ci = j.schema.colIndex(kv.first);
+            if(!changed.empty()){
+                for(auto& e : seen[kv.first]){
+                    if(changed.count(ridKey(e.second))) kv.second->remove(e.first, e.second);
+                }
+                for(uint64_t key : changed){
+                    RowId rid = ridFromKey(key);
+                    auto bytes = j.tf.readRow(rid);
+                    if(!bytes.empty()) kv.second->insert(RowCodec::decodeColumn(j.schema, bytes, ci, &j.toast), rid);
+                }
+            }
+            ti.btree[kv.first] = std::move(kv.second);
+        }
+    }
+}
+
+// a table whose indexes are still being built keeps a note for the install
+void DBEngine::noteRowChange(const std::string& table, const RowId& rid){
+    if(building.count(table)) changedRows[table].insert(ridKey(rid));
+}
+
+// scan -> filter over batches, morsel by morsel on `threads`: out(m, batch)
+// gets every batch of morsel m that still has rows whose column `col` lies
+// within the bounds, with those rows selected. A morsel's batches arrive in
+// page order on one worker.
+static void scanFiltered(ThreadPool& threads, TableScanner& sc, const MorselPlan& plan, ToastStore& toast,
+                         const Schema& schema, int col, const KeyBound* lo, const KeyBound* hi,
+                         const std::function<void(size_t, const ColumnBatch&)>& out){
+    sc.scanParallel(threads, plan, [&](size_t m, ScanCursor& cursor){
+        BatchScanner batches(cursor, schema, {col}, &toast);
+        ColumnBatch batch;
+        while(batches.next(batch)){
+            filterRange(batch, 0, lo, hi);
+            if(batch.selected) out(m, batch);
+        }
+    });
+}
+
+// scan -> filter over the rows matching `where` (every row when null):
+// out(m, rid, bytes) for each, in page order within morsel m. Rows are
+// tested on their page bytes before the cursor hands them out. Without
+// `keepRows` the bytes may be empty, and a plain range on one column goes
+// through the batch kernels instead; a batch would have to copy every row
+// to keep them, which costs more than the kernels save.
+static void scanWhere(ThreadPool& threads, TableScanner& sc, const MorselPlan& plan, ToastStore& toast,
+                      const Schema& schema, const Predicate* where, bool keepRows,
+                      const std::function<void(size_t, const RowId&, ByteSpan)>& out){
+    ColumnRange range;
+    if(where && !keepRows && asRange(*where, schema, range)){
+        scanFiltered(threads, sc, plan, toast, schema, schema.colIndex(range.col), range.hasLo ? &range.lo : nullptr,
+                     range.hasHi ? &range.hi : nullptr, [&](size_t m, const ColumnBatch& b){
+            for(size_t j = 0; j < b.selected; j++) out(m, b.rids[b.sel[j]], ByteSpan());
+        });
+        return;
+    }
+    std::unique_ptr<RowFilter> filter;
+    if(where) filter = std::make_unique<RowFilter>(schema, *where, &toast);
+    sc.scanParallel(threads, plan, [&](size_t m, ScanCursor& cursor){
+        cursor.setFilter(filter.get());
+        for(const ScanRow& r : cursor) out(m, r.rid, r.bytes);
+    });
+}
+
+// the candidates still there that pass `filter`, as batches of columns
+// `cols` with every row selected, for stages written against the scan
+static void batchRows(TableFile& tf, ToastStore& toast, const Schema& schema, const std::vector<int>& cols,
+                      const std::vector<RowId>& rids, const RowFilter& filter,
+                      const std::function<void(const ColumnBatch&)>& out){
+    ColumnBatch batch;
+    batch.columns.resize(cols.size());
+    for(size_t k = 0; k < cols.size(); k++) batch.columns[k].type = schema.columns[cols[k]].type;
+    auto flush = [&]{
+        if(!batch.size) return;
+        batch.sel.resize(batch.size);
+        for(size_t i = 0; i < batch.size; i++) batch.sel[i] = (uint32_t)i;
+        batch.selected = batch.size;
+        out(batch);
+        batch.size = 0;
+        batch.rids.clear();
+        for(auto& c : batch.columns){ c.ints.clear(); c.texts.clear(); }
+    };
+    for(auto& rid : rids){
+        auto bytes = tf.readRow(rid);
+        if(bytes.empty() || !filter.matches(ByteSpan(bytes))) continue;
+        batch.rids.push_back(rid);
+        auto vals = RowCodec::decodeColumns(schema, bytes, cols, &toast);
+        for(size_t k = 0; k < cols.size(); k++){
+            if(batch.columns[k].type==ColType::INT32) batch.columns[k].ints.push_back(std::get<int32_t>(vals[k]));
+            else batch.columns[k].texts.push_back(std::move(std::get<std::string>(vals[k])));
+        }
+        if(++batch.size==BATCH_ROWS) flush();
     }
-    return -1;
+    flush();
 }
 
-void DBEngine::buildIndexIfMissing(const std::string& table, const Schema& schema){
-    if(indexes.find(table)!=indexes.end()) return;
-    rebuildIndexes(table, schema);
+// every column the predicate names is in the schema
+static bool knownColumns(const Schema& schema, const Predicate& p){
+    if(p.op==PredOp::AND || p.op==PredOp::OR || p.op==PredOp::NOT){
+        for(auto& k : p.kids){
+            if(!knownColumns(schema, k)) return false;
+        }
+        return true;
+    }
+    return schema.colIndex(p.col) >= 0;
 }
 
-void DBEngine::rebuildIndexes(const std::string& table, const Schema& schema){
-    indexes[table] = {};
-    for(auto& c: schema.columns){
-        indexes[table][c.name] = HashIndex{};
+// the planner: every conjunct of `where` is ranked by the index it could
+// use - hash equality, B+tree equality, IN through either, then a B+tree
+// range narrowed by all the range conjuncts on its column - and the best
+// supplies the candidates; a conjunct no row can meet supplies none. False
+// when no conjunct can use an index and the table has to be scanned.
+// Callers re-check each candidate against the whole predicate. `keyOrder`
+// gets the INT column whose key order the candidates follow, if any.
+bool DBEngine::indexLookup(const std::string& table, const Schema& schema, const Predicate& where,
+                           std::vector<RowId>& rids, std::string* keyOrder){
+    TableIndexes& ti = tableIndexes(table, schema);
+    auto typed = [&](const Predicate& c, const Value& v){
+        return (schema.columns[schema.colIndex(c.col)].type==ColType::INT32) == std::holds_alternative<int32_t>(v);
+    };
+
+    enum { NONE_MATCH, HASH_EQ, TREE_EQ, IN_LIST, TREE_RANGE, SCAN };
+    int best = SCAN;
+    const Predicate* pick = nullptr;
+    std::unordered_map<std::string, ColumnRange> ranges;
+    for(const Predicate* c : where.conjuncts()){
+        if(c->op==PredOp::AND || c->op==PredOp::OR || c->op==PredOp::NOT || schema.colIndex(c->col)<0) continue;
+        bool hash = ti.hash.count(c->col), tree = ti.btree.count(c->col);
+        int rank = SCAN;
+        if(c->op==PredOp::EQ){
+            rank = !typed(*c, c->values[0]) ? NONE_MATCH : hash ? HASH_EQ : tree ? TREE_EQ : SCAN;
+        } else if(c->op==PredOp::IN){
+            bool any = false;
+            for(auto& v : c->values) any = any || typed(*c, v);
+            rank = !any ? NONE_MATCH : (hash || tree) ? IN_LIST : SCAN;
+        }
+        if(tree) asRange(*c, schema, ranges[c->col]);
+        if(rank < best){ best = rank; pick = c; }
     }
+    const ColumnRange* range = nullptr;
+    if(best > TREE_RANGE){
+        for(auto& kv : ranges){
+            if(kv.second.hasLo || kv.second.hasHi){ range = &kv.second; best = TREE_RANGE; break; }
+        }
+    }
+    if(best==SCAN) return false;
+
+    rids.clear();
+    if(best==NONE_MATCH) return true;
+    const std::string& col = range ? range->col : pick->col;
+    if(keyOrder && schema.columns[schema.colIndex(col)].type==ColType::INT32) *keyOrder = col;
 
-    TableFile tf(catalog.tablePath(table));
+    auto lookup = [&](const Value& key){
+        auto h = ti.hash.find(col);
+        auto found = h!=ti.hash.end() ? h->second.find(key) : ti.btree.at(col)->find(key);
+        rids.insert(rids.end(), found.begin(), found.end());
+    };
+    if(best==TREE_RANGE){
+        ti.btree.at(col)->scan(range->hasLo ? &range->lo : nullptr, range->hasHi ? &range->hi : nullptr,
+                               [&](const Value&, const RowId& rid){ rids.push_back(rid); return true; });
+    } else if(best==IN_LIST){
+        // keys in order, each once, so the candidates come in key order too
+        std::vector<Value> keys;
+        for(auto& v : pick->values){
+            if(typed(*pick, v)) keys.push_back(v);
+        }
+        std::sort(keys.begin(), keys.end(), [](const Value& a, const Value& b){ return RowCodec::compare(a, b) < 0; });
+        keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+        for(auto& k : keys) lookup(k);
+    } else {
+        lookup(pick->values[0]);
+    }
+    return true;
+}
+
+// SELECT * or a projection, with an optional WHERE and ORDER BY
+std::string DBEngine::selectRows(const SelectWhereStmt& stmt){
+    if(!catalog.hasTable(stmt.table)) return R"({"ok":false,"msg":"table not found"})";
+    const Schema& schema = catalog.loadSchema(stmt.table);
+    int oi = stmt.orderCol.empty() ? -1 : schema.colIndex(stmt.orderCol);
+    if((!stmt.orderCol.empty() && oi<0) || (stmt.hasWhere && !knownColumns(schema, stmt.where)))
+        return R"({"ok":false,"msg":"col not found"})";
+
+    // a projection decodes only its columns, plus the ORDER BY column
+    // after them when it is not shown; the rest of each row is skipped
+    Schema shown = schema;
+    std::vector<int> decoded;
+    int sortAt = oi;
+    if(!stmt.cols.empty()){
+        shown.columns.clear();
+        shown.positions.clear();
+        for(auto& col : stmt.cols){
+            int ci = schema.colIndex(col);
+            if(ci<0) return R"({"ok":false,"msg":"col not found"})";
+            decoded.push_back(ci);
+            shown.columns.push_back(schema.columns[ci]);
+        }
+        if(oi>=0){
+            sortAt = (int)(std::find(decoded.begin(), decoded.end(), oi) - decoded.begin());
+            if(sortAt==(int)decoded.size()) decoded.push_back(oi);
+        }
+    }
+
+    TableIndexes& ti = tableIndexes(stmt.table, schema);
+    TableFile tf = openTable(stmt.table);
+    ToastStore toast = openToast(stmt.table);
+    const Predicate* where = stmt.hasWhere ? &stmt.where : nullptr;
+    std::unique_ptr<RowFilter> filter;
+    if(where) filter = std::make_unique<RowFilter>(schema, *where, &toast);
+    auto decode = [&](ByteSpan bytes){
+        return decoded.empty() ? RowCodec::decode(schema, bytes, &toast)
+                               : RowCodec::decodeColumns(schema, bytes, decoded, &toast);
+    };
+
+    // the planner picks an index for the WHERE if a conjunct can use
+    // one; without a WHERE a B+tree on the ORDER BY column is walked.
+    // Otherwise the table is scanned, filtered on the row bytes.
+    std::vector<RowId> rids;
+    std::string keyOrder;
+    bool viaIndex = where && indexLookup(stmt.table, schema, *where, rids, &keyOrder);
+    auto bt = ti.btree.find(stmt.orderCol);
+    if(!where && bt!=ti.btree.end()){
+        viaIndex = true;
+        bt->second->scan(nullptr, nullptr, [&](const Value&, const RowId& rid){ rids.push_back(rid); return true; });
+        // truncated TEXT keys may come back slightly out of order
+        if(schema.columns[oi].type==ColType::INT32) keyOrder = stmt.orderCol;
+    }
+
+    using Rows = std::vector<std::pair<RowId, std::vector<Value>>>;
+    Rows rows;
+    if(viaIndex){
+        for(auto& rid : rids){
+            auto bytes = tf.readRow(rid);
+            if(bytes.empty() || (filter && !filter->matches(ByteSpan(bytes)))) continue;
+            rows.emplace_back(rid, decode(ByteSpan(bytes)));
+        }
+    } else {
+        TableScanner sc(tf);
+        MorselPlan plan = sc.plan();
+        if(stmt.orderCol.empty()){
+            // nothing to sort: each morsel serialises its rows as it goes
+            std::vector<std::string> parts(plan.count());
+            scanWhere(workers, sc, plan, toast, schema, where, true, [&](size_t m, const RowId& rid, ByteSpan bytes){
+                appendRowJson(parts[m], shown, rid, decode(bytes));
+            });
+            std::ostringstream oss;
+            oss << R"({"ok":true,"rows":[)";
+            joinParts(oss, parts);
+            oss << "]}";
+            return oss.str();
+        }
+        std::vector<Rows> parts(plan.count());
+        scanWhere(workers, sc, plan, toast, schema, where, true, [&](size_t m, const RowId& rid, ByteSpan bytes){
+            parts[m].emplace_back(rid, decode(bytes));
+        });
+        for(auto& p : parts) rows.insert(rows.end(), std::make_move_iterator(p.begin()), std::make_move_iterator(p.end()));
+    }
+
+    auto byOrder = [&](const Rows::value_type& a, const Rows::value_type& b){
+        return RowCodec::compare(a.second[sortAt], b.second[sortAt]) < 0;
+    };
+    if(oi>=0 && keyOrder!=stmt.orderCol) std::stable_sort(rows.begin(), rows.end(), byOrder);
+    if(stmt.desc) std::reverse(rows.begin(), rows.end());
+
+    std::string out;
+    for(auto& row : rows) appendRowJson(out, shown, row.first, row.second);
+    return R"({"ok":true,"rows":[)" + out + "]}";
+}
+
+// candidate rows for `where`: through an index when the planner finds one,
+// otherwise by a filtered scan. Callers re-check the row.
+std::vector<RowId> DBEngine::findRows(const std::string& table, const Schema& schema, const Predicate& where){
+    std::vector<RowId> rids;
+    if(indexLookup(table, schema, where, rids)) return rids;
+
+    TableFile tf = openTable(table);
+    ToastStore toast = openToast(table);
+    TableScanner sc(tf);
+    MorselPlan plan = sc.plan();
+    std::vector<std::vector<RowId>> parts(plan.count());
+    scanWhere(workers, sc, plan, toast, schema, &where, false, [&](size_t m, const RowId& rid, ByteSpan){
+        parts[m].push_back(rid);
+    });
+    for(auto& p : parts) rids.insert(rids.end(), p.begin(), p.end());
+    return rids;
+}
+
+// compacts the side table, then stores the values with chunks on its last
+// page again further up and points their rows at the copies, last page
+// first, until one no longer fits or the page also holds chunks no row
+// refers to. Returns the page count the side table can be cut down to.
+uint32_t DBEngine::vacuumToast(TableFile& tf, ToastStore& toast, const Schema& schema){
+    TableFile& chunks = toast.file();
+    uint32_t end = chunks.compact();
+    if(end == 0) return 0;
+
+    struct Stored { RowId rid; int col; ToastRef ref; };
     TableScanner sc(tf);
-    auto rows = sc.scanAll();
+    MorselPlan plan = sc.plan();
+    std::vector<std::vector<Stored>> parts(plan.count());
+    scanWhere(workers, sc, plan, toast, schema, nullptr, true, [&](size_t m, const RowId& rid, ByteSpan bytes){
+        for(int c = 0; c < (int)schema.columns.size(); c++){
+            for(auto& ref : RowCodec::toastRefs(schema, bytes, c)) parts[m].push_back({rid, c, ref});
+        }
+    });
+    std::vector<Stored> values;
+    for(auto& p : parts) values.insert(values.end(), p.begin(), p.end());
 
-    for(auto& r: rows){
-        auto vals = RowCodec::decode(schema, r.bytes);
-        for(size_t i=0;i<schema.columns.size();i++){
-            indexes[table][schema.columns[i].name].add(RowCodec::valueToKey(vals[i]), r.rid);
+    std::priority_queue<std::pair<uint32_t, size_t>> byLast;
+    for(size_t i = 0; i < values.size(); i++) byLast.push({toast.lastPage(values[i].ref), i});
+
+    auto empty = [&](uint32_t pid){ return PageView(chunks.readPage(pid).data(), chunks.pageSize()).slotCount() == 0; };
+    while(end > 0 && !byLast.empty() && byLast.top().first == end - 1){
+        size_t i = byLast.top().second;
+        Stored& v = values[i];
+        byLast.pop();
+        ToastRef copy = toast.copyBelow(v.ref, end - 1);
+        if(copy.pageId == FreeSpaceMap::NO_PAGE) break;
+        // the row moves to the copy before the old chunks go, so a crash
+        // at worst leaves chunks nothing refers to
+        auto bytes = tf.readRow(v.rid);
+        RowCodec::setToastRef(schema, bytes, v.col, copy);
+        if(!tf.updateRow(v.rid, bytes)){
+            toast.free(copy);
+            break;
         }
+        toast.free(v.ref);
+        v.ref = copy;
+        byLast.push({toast.lastPage(copy), i});
+        while(end > 0 && empty(end - 1)) end--;
     }
+    return end;
 }
 
 std::string DBEngine::execute(const std::string& sql){
+    std::unique_lock<std::shared_mutex> lk(stmtMu);
     try{
         if(SQLParser::isCreateTable(sql)){
             auto stmt = SQLParser::parseCreateTable(sql);
@@ -61,22 +764,114 @@ std::string DBEngine::execute(const std::string& sql){
             return ok ? R"({"ok":true,"msg":"table created"})" : R"({"ok":false,"msg":"create failed"})";
         }
 
+        if(SQLParser::isCreateIndex(sql)){
+            auto stmt = SQLParser::parseCreateIndex(sql);
+            const IndexDef& def = stmt.def;
+            if(!catalog.hasTable(def.table)) return R"({"ok":false,"msg":"table not found"})";
+            const Schema& schema = catalog.loadSchema(def.table);
+            if(schema.colIndex(def.col)<0) return R"({"ok":false,"msg":"column not found"})";
+
+            IndexDef existing;
+            if(catalog.findIndex(def.name, existing)) return R"({"ok":false,"msg":"index already exists"})";
+            for(auto& d : catalog.loadIndexes(def.table)){
+                if(d.col==def.col && d.kind==def.kind) return R"({"ok":false,"msg":"column already has such an index"})";
+            }
+
+            // build first so a crash never leaves a declared index without its file
+            TableIndexes& ti = tableIndexes(def.table, schema);
+            TableFile tf = openTable(def.table);
+            ToastStore toast = openToast(def.table);
+            auto rest = openIndexes(ti, tf, toast, schema, {def}, true);
+            scanIndexes(ti, tf, toast, schema, rest, workers, nullptr, nullptr);
+            if(!catalog.createIndex(def)) return R"({"ok":false,"msg":"create index failed"})";
+            return R"({"ok":true,"msg":"index created"})";
+        }
+
+        if(SQLParser::isDropIndex(sql)){
+            auto stmt = SQLParser::parseDropIndex(sql);
+            IndexDef def;
+            if(!catalog.findIndex(stmt.name, def)) return R"({"ok":false,"msg":"index not found"})";
+            if(building.count(def.table)) return R"({"ok":false,"msg":"indexes of this table are still being built"})";
+            if(!catalog.dropIndex(stmt.name)) return R"({"ok":false,"msg":"drop index failed"})";
+
+            auto it = indexes.find(def.table);
+            if(def.kind==IndexKind::HASH){
+                if(it!=indexes.end()) it->second.hash.erase(def.col);
+                std::filesystem::remove(catalog.hashSnapshotPath(def.table, def.col));
+            } else {
+                if(it!=indexes.end()) it->second.btree.erase(def.col);
+                std::string path = catalog.btreePath(def.table, def.col);
+                pool.removeFile(path);
+            }
+            return R"({"ok":true,"msg":"index dropped"})";
+        }
+
+        if(SQLParser::isVacuum(sql)){
+            auto stmt = SQLParser::parseVacuum(sql);
+            if(!catalog.hasTable(stmt.table)) return R"({"ok":false,"msg":"table not found"})";
+            if(building.count(stmt.table)) return R"({"ok":false,"msg":"indexes of this table are still being built"})";
+            const Schema& schema = catalog.loadSchema(stmt.table);
+
+            TableIndexes& ti = tableIndexes(stmt.table, schema);
+            TableFile tf = openTable(stmt.table);
+            ToastStore toast = openToast(stmt.table);
+            uint32_t before = tf.pageCount();
+            int moved = 0;
+            uint32_t keep = tf.vacuum([&](const RowId& from, const RowId& to, const std::vector<uint8_t>& row){
+                moved++;
+                for(auto& kv : ti.hash){
+                    Value key = RowCodec::decodeColumn(schema, row, schema.colIndex(kv.first), &toast);
+                    kv.second.remove(key, from);
+                    kv.second.add(key, to);
+                }
+                for(auto& kv : ti.btree){
+                    Value key = RowCodec::decodeColumn(schema, row, schema.colIndex(kv.first), &toast);
+                    kv.second->remove(key, from);
+                    kv.second->insert(key, to);
+                }
+            }, stmt.full);
+
+            // a table that never stored a long value has no side table to open
+            bool chunked = pool.fileExists(catalog.toastPath(stmt.table));
+            uint32_t chunkPages = chunked ? toast.file().pageCount() : 0;
+            uint32_t chunkKeep = chunked ? vacuumToast(tf, toast, schema) : 0;
+            commitStatement();
+
+            // the moves must be on disk, and out of the log, before the tail goes
+            if(keep < before || chunkKeep < chunkPages){
+                checkpoint();
+                if(keep < before) tf.truncate(keep);
+                if(chunkKeep < chunkPages) toast.file().truncate(chunkKeep);
+                checkpoint();
+            }
+
+            std::ostringstream oss;
+            oss << R"({"ok":true,"moved":)" << moved << R"(,"pages":)" << keep << "}";
+            return oss.str();
+        }
+
         if(SQLParser::isInsert(sql)){
             auto stmt = SQLParser::parseInsert(sql);
             if(!catalog.hasTable(stmt.table)) return R"({"ok":false,"msg":"table not found"})";
-            Schema schema = catalog.loadSchema(stmt.table);
-
-            auto rowBytes = RowCodec::encode(schema, stmt.values);
-            wal.logInsert(stmt.table, rowBytes);
+            const Schema& schema = catalog.loadSchema(stmt.table);
 
-            TableFile tf(catalog.tablePath(stmt.table));
+            ToastStore toast = openToast(stmt.table);
+            auto rowBytes = RowCodec::encode(schema, stmt.values, &toast);
+            // load before inserting, or a first build would already include the new row
+            TableIndexes& ti = tableIndexes(stmt.table, schema);
+            TableFile tf = openTable(stmt.table);
             RowId rid = tf.insertRow(rowBytes);
+            noteRowChange(stmt.table, rid);
 
-            buildIndexIfMissing(stmt.table, schema);
-            auto vals = RowCodec::decode(schema, rowBytes);
-            for(size_t i=0;i<schema.columns.size();i++){
-                indexes[stmt.table][schema.columns[i].name].add(RowCodec::valueToKey(vals[i]), rid);
+            for(auto& kv : ti.hash){
+                kv.second.add(stmt.values[schema.colIndex(kv.first)], rid);
+            }
+            for(auto& kv : ti.btree){
+                kv.second->insert(stmt.values[schema.colIndex(kv.first)], rid);
             }
+            // after the indexes: a checkpoint here snapshots the hash indexes and
+            // flushes the tree pages, then drops the log
+            commitStatement();
 
             std::ostringstream oss;
             oss << R"({"ok":true,"msg":"inserted","page":)" << rid.pageId << R"(,"slot":)" << rid.slotId << "}";
@@ -88,162 +883,233 @@ std::string DBEngine::execute(const std::string& sql){
             if(!catalog.hasTable(stmt.leftTable) || !catalog.hasTable(stmt.rightTable))
                 return R"({"ok":false,"msg":"join table not found"})";
 
-            Schema leftSchema = catalog.loadSchema(stmt.leftTable);
-            Schema rightSchema = catalog.loadSchema(stmt.rightTable);
+            const Schema& leftSchema = catalog.loadSchema(stmt.leftTable);
+            const Schema& rightSchema = catalog.loadSchema(stmt.rightTable);
 
-            int lci = colIndex(leftSchema, stmt.leftCol);
-            int rci = colIndex(rightSchema, stmt.rightCol);
+            int lci = leftSchema.colIndex(stmt.leftCol);
+            int rci = rightSchema.colIndex(stmt.rightCol);
             if(lci<0 || rci<0) return R"({"ok":false,"msg":"join columns not found"})";
 
-            TableFile ltf(catalog.tablePath(stmt.leftTable));
-            TableFile rtf(catalog.tablePath(stmt.rightTable));
+            TableFile ltf = openTable(stmt.leftTable);
+            TableFile rtf = openTable(stmt.rightTable);
+            ToastStore ltoast = openToast(stmt.leftTable);
+            ToastStore rtoast = openToast(stmt.rightTable);
             TableScanner lsc(ltf), rsc(rtf);
 
-            auto lrows = lsc.scanAll();
-            auto rrows = rsc.scanAll();
-
-            std::unordered_map<std::string, std::vector<std::string>> mapR;
-            for(auto& rr: rrows){
-                auto rv = RowCodec::decode(rightSchema, rr.bytes);
-                std::string key = RowCodec::valueToKey(rv[rci]);
-                mapR[key].push_back(RowCodec::toString(rightSchema, rv));
+            // both sides run per morsel; the build side's maps are merged in
+            // page order so every key lists its rows as a serial scan would
+            using BuildMap = std::unordered_map<std::string, std::vector<std::string>>;
+            MorselPlan rplan = rsc.plan();
+            std::vector<BuildMap> built(rplan.count());
+            rsc.scanParallel(workers, rplan, [&](size_t m, ScanCursor& cursor){
+                for(const ScanRow& rr : cursor){
+                    auto rv = RowCodec::decode(rightSchema, rr.bytes, &rtoast);
+                    std::string key = RowCodec::valueToKey(rv[rci]);
+                    built[m][key].push_back(RowCodec::toString(rightSchema, rv));
+                }
+            });
+            BuildMap mapR;
+            for(auto& part : built){
+                for(auto& kv : part){
+                    auto& rowsR = mapR[kv.first];
+                    rowsR.insert(rowsR.end(), std::make_move_iterator(kv.second.begin()),
+                                 std::make_move_iterator(kv.second.end()));
+                }
+                BuildMap().swap(part);
             }
 
-            std::ostringstream oss;
-            oss << R"({"ok":true,"rows":[)";
-            bool first=true;
-
-            for(auto& lr: lrows){
-                auto lv = RowCodec::decode(leftSchema, lr.bytes);
-                std::string key = RowCodec::valueToKey(lv[lci]);
+            MorselPlan lplan = lsc.plan();
+            std::vector<std::string> parts(lplan.count());
+            lsc.scanParallel(workers, lplan, [&](size_t m, ScanCursor& cursor){
+                std::string& out = parts[m];
+                for(const ScanRow& lr : cursor){
+                    std::string key = RowCodec::columnKey(leftSchema, lr.bytes, lci, &ltoast);
 
-                auto it = mapR.find(key);
-                if(it==mapR.end()) continue;
+                    auto it = mapR.find(key);
+                    if(it==mapR.end()) continue;
 
-                std::string leftStr = RowCodec::toString(leftSchema, lv);
-                for(auto& rightStr : it->second){
-                    if(!first) oss << ",";
-                    first=false;
-                    oss << R"({"left":")" << jsonEscape(leftStr) << R"(","right":")" << jsonEscape(rightStr) << R"("})";
+                    std::string leftStr = jsonEscape(RowCodec::toString(leftSchema, RowCodec::decode(leftSchema, lr.bytes, &ltoast)));
+                    for(auto& rightStr : it->second){
+                        if(!out.empty()) out += ",";
+                        out += R"({"left":")" + leftStr + R"(","right":")" + jsonEscape(rightStr) + R"("})";
+                    }
                 }
-            }
+            });
+
+            std::ostringstream oss;
+            oss << R"({"ok":true,"rows":[)";
+            joinParts(oss, parts);
             oss << "]}";
             return oss.str();
         }
 
-        if(SQLParser::isSelectWhereEq(sql)){
-            auto stmt = SQLParser::parseSelectWhereEq(sql);
-            if(!catalog.hasTable(stmt.table)) return R"({"ok":false,"msg":"table not found"})";
-            Schema schema = catalog.loadSchema(stmt.table);
-            buildIndexIfMissing(stmt.table, schema);
-
-            std::string key = RowCodec::valueToKey(stmt.where.value);
+        if(SQLParser::isSelectWhere(sql)) return selectRows(SQLParser::parseSelectWhere(sql));
 
-            auto it = indexes[stmt.table].find(stmt.where.col);
-            if(it==indexes[stmt.table].end()) return R"({"ok":false,"msg":"col not found"})";
+        if(SQLParser::isSelectAll(sql)){
+            auto stmt = SQLParser::parseSelectAll(sql);
+            if(!catalog.hasTable(stmt.table)) return R"({"ok":false,"msg":"table not found"})";
+            const Schema& schema = catalog.loadSchema(stmt.table);
+            TableFile tf = openTable(stmt.table);
+            ToastStore toast = openToast(stmt.table);
+            TableScanner sc(tf);
 
-            auto rids = it->second.find(key);
-            TableFile tf(catalog.tablePath(stmt.table));
+            MorselPlan plan = sc.plan();
+            std::vector<std::string> parts(plan.count());
+            sc.scanParallel(workers, plan, [&](size_t m, ScanCursor& cursor){
+                for(const ScanRow& r : cursor) appendRowJson(parts[m], schema, r.rid, RowCodec::decode(schema, r.bytes, &toast));
+            });
 
             std::ostringstream oss;
             oss << R"({"ok":true,"rows":[)";
-            bool first=true;
-            for(auto& rid: rids){
-                auto bytes=tf.readRow(rid);
-                if(bytes.empty()) continue;
-                auto vals=RowCodec::decode(schema, bytes);
-                if(!first) oss << ",";
-                first=false;
-                oss << R"({"rid":{"page":)"<<rid.pageId<<R"(,"slot":)"<<rid.slotId<<R"(},"data":")"
-                    << jsonEscape(RowCodec::toString(schema, vals)) << R"("})";
-            }
+            joinParts(oss, parts);
             oss << "]}";
             return oss.str();
         }
 
-        if(SQLParser::isSelectAll(sql)){
-            auto stmt = SQLParser::parseSelectAll(sql);
+        if(SQLParser::isSelectColumns(sql)) return selectRows(SQLParser::parseSelectColumns(sql));
+
+        if(SQLParser::isSelectAggregate(sql)){
+            auto stmt = SQLParser::parseSelectAggregate(sql);
             if(!catalog.hasTable(stmt.table)) return R"({"ok":false,"msg":"table not found"})";
-            Schema schema = catalog.loadSchema(stmt.table);
-            TableFile tf(catalog.tablePath(stmt.table));
+            const Schema& schema = catalog.loadSchema(stmt.table);
+            Aggregation agg(schema, stmt);
+            TableFile tf = openTable(stmt.table);
+            ToastStore toast = openToast(stmt.table);
             TableScanner sc(tf);
-            auto rows=sc.scanAll();
+
+            std::unique_ptr<RowFilter> filter;
+            if(stmt.hasWhere) filter = std::make_unique<RowFilter>(schema, stmt.where, &toast);
+
+            Aggregation::Groups groups;
+            std::vector<RowId> rids;
+            if(stmt.hasWhere && indexLookup(stmt.table, schema, stmt.where, rids)){
+                batchRows(tf, toast, schema, agg.columns(), rids, *filter, [&](const ColumnBatch& b){ agg.add(groups, b); });
+            } else if(agg.countOnly()){
+                agg.addCount(groups, sc.countRows(workers, filter.get()));
+            } else {
+                // each runner folds its morsels into a group table of its own;
+                // the tables are merged once the scan is done
+                MorselPlan plan = sc.plan();
+                std::vector<Aggregation::Groups> partial(TableScanner::runners(workers, plan));
+                const ColumnRange* range = agg.range();
+                sc.scanPerRunner(workers, plan, [&](size_t r, ScanCursor& cursor){
+                    if(!range) cursor.setFilter(filter.get());
+                    BatchScanner batches(cursor, schema, agg.columns(), &toast);
+                    ColumnBatch batch;
+                    while(batches.next(batch)){
+                        if(range) filterRange(batch, 0, range->hasLo ? &range->lo : nullptr, range->hasHi ? &range->hi : nullptr);
+                        agg.add(partial[r], batch);
+                    }
+                });
+                groups = std::move(partial[0]);
+                for(size_t r = 1; r < partial.size(); r++) agg.merge(groups, partial[r]);
+            }
 
             std::ostringstream oss;
-            oss << R"({"ok":true,"rows":[)";
-            bool first=true;
-            for(auto& r: rows){
-                auto vals=RowCodec::decode(schema, r.bytes);
-                if(!first) oss << ",";
-                first=false;
-                oss << R"({"rid":{"page":)"<<r.rid.pageId<<R"(,"slot":)"<<r.rid.slotId<<R"(},"data":")"
-                    << jsonEscape(RowCodec::toString(schema, vals)) << R"("})";
+            oss << R"({"ok":true,"columns":[)";
+            auto header = agg.header();
+            for(size_t k = 0; k < header.size(); k++) oss << (k ? "," : "") << '"' << jsonEscape(header[k]) << '"';
+            oss << R"(],"rows":[)";
+            oss << std::setprecision(15);
+            auto rows = agg.rows(groups);
+            for(size_t i = 0; i < rows.size(); i++){
+                oss << (i ? ",[" : "[");
+                for(size_t k = 0; k < rows[i].size(); k++){
+                    if(k) oss << ",";
+                    const AggValue& v = rows[i][k];
+                    if(std::holds_alternative<int64_t>(v)) oss << std::get<int64_t>(v);
+                    else if(std::holds_alternative<double>(v)) oss << std::get<double>(v);
+                    else if(std::holds_alternative<std::string>(v)) oss << '"' << jsonEscape(std::get<std::string>(v)) << '"';
+                    else oss << "null";
+                }
+                oss << "]";
             }
             oss << "]}";
             return oss.str();
         }
 
-        if(SQLParser::isUpdateWhereEq(sql)){
-            auto stmt = SQLParser::parseUpdateWhereEq(sql);
+        if(SQLParser::isUpdateWhere(sql)){
+            auto stmt = SQLParser::parseUpdateWhere(sql);
             if(!catalog.hasTable(stmt.table)) return R"({"ok":false,"msg":"table not found"})";
-            Schema schema = catalog.loadSchema(stmt.table);
-            buildIndexIfMissing(stmt.table, schema);
+            const Schema& schema = catalog.loadSchema(stmt.table);
 
-            int setIdx = colIndex(schema, stmt.setCol);
-            int whereIdx = colIndex(schema, stmt.where.col);
-            if(setIdx<0 || whereIdx<0) return R"({"ok":false,"msg":"column not found"})";
+            int setIdx = schema.colIndex(stmt.setCol);
+            if(setIdx<0 || !knownColumns(schema, stmt.where)) return R"({"ok":false,"msg":"column not found"})";
 
-            TableFile tf(catalog.tablePath(stmt.table));
-
-            auto rids = indexes[stmt.table][stmt.where.col].find(RowCodec::valueToKey(stmt.where.value));
+            TableIndexes& ti = tableIndexes(stmt.table, schema);
+            TableFile tf = openTable(stmt.table);
+            ToastStore toast = openToast(stmt.table);
+            RowFilter filter(schema, stmt.where, &toast);
+            auto rids = findRows(stmt.table, schema, stmt.where);
+            // the old value is only fetched when an index needs it
+            bool indexed = ti.hash.count(stmt.setCol) || ti.btree.count(stmt.setCol);
 
             int updated=0;
             for(auto& rid: rids){
                 auto bytes = tf.readRow(rid);
-                if(bytes.empty()) continue;
+                if(bytes.empty() || !filter.matches(ByteSpan(bytes))) continue;
 
-                auto vals = RowCodec::decode(schema, bytes);
-                if(RowCodec::valueToKey(vals[whereIdx]) != RowCodec::valueToKey(stmt.where.value)) continue;
+                Value oldValue = indexed ? RowCodec::decodeColumn(schema, bytes, setIdx, &toast) : Value{};
+                // the other columns keep their bytes, out-of-line values included
+                auto newBytes = RowCodec::replaceColumn(schema, bytes, setIdx, stmt.setValue, &toast);
 
-                vals[setIdx] = stmt.setValue;
-                auto newBytes = RowCodec::encode(schema, vals);
+                if(!tf.updateRow(rid, newBytes)){
+                    for(auto& ref : RowCodec::toastRefs(schema, newBytes, setIdx)) toast.free(ref);
+                    continue;
+                }
+                for(auto& ref : RowCodec::toastRefs(schema, bytes, setIdx)) toast.free(ref);
+                updated++;
+                noteRowChange(stmt.table, rid);
 
-                bool ok = tf.updateRow(rid, newBytes);
-                if(ok){
-                    wal.logUpdate(stmt.table, rid.pageId, rid.slotId, newBytes);
-                    updated++;
+                // only the SET column's key changes
+                if(!indexed || RowCodec::compare(oldValue, stmt.setValue)==0) continue;
+                auto h = ti.hash.find(stmt.setCol);
+                if(h!=ti.hash.end()){
+                    h->second.remove(oldValue, rid);
+                    h->second.add(stmt.setValue, rid);
+                }
+                auto bt = ti.btree.find(stmt.setCol);
+                if(bt!=ti.btree.end()){
+                    bt->second->remove(oldValue, rid);
+                    bt->second->insert(stmt.setValue, rid);
                 }
             }
 
-            rebuildIndexes(stmt.table, schema);
+            commitStatement();
 
             std::ostringstream oss;
             oss << R"({"ok":true,"updated":)" << updated << "}";
             return oss.str();
         }
 
-        if(SQLParser::isDeleteWhereEq(sql)){
-            auto stmt = SQLParser::parseDeleteWhereEq(sql);
+        if(SQLParser::isDeleteWhere(sql)){
+            auto stmt = SQLParser::parseDeleteWhere(sql);
             if(!catalog.hasTable(stmt.table)) return R"({"ok":false,"msg":"table not found"})";
-            Schema schema = catalog.loadSchema(stmt.table);
-            buildIndexIfMissing(stmt.table, schema);
+            const Schema& schema = catalog.loadSchema(stmt.table);
+            if(!knownColumns(schema, stmt.where)) return R"({"ok":false,"msg":"column not found"})";
 
-            TableFile tf(catalog.tablePath(stmt.table));
-
-            auto rids = indexes[stmt.table][stmt.where.col].find(RowCodec::valueToKey(stmt.where.value));
+            TableIndexes& ti = tableIndexes(stmt.table, schema);
+            TableFile tf = openTable(stmt.table);
+            ToastStore toast = openToast(stmt.table);
+            RowFilter filter(schema, stmt.where, &toast);
+            auto rids = findRows(stmt.table, schema, stmt.where);
 
             int deleted=0;
             for(auto& rid: rids){
                 auto bytes=tf.readRow(rid);
-                if(bytes.empty()) continue;
-                bool ok=tf.deleteRow(rid);
-                if(ok){
-                    wal.logDelete(stmt.table, rid.pageId, rid.slotId);
-                    deleted++;
-                }
+                if(bytes.empty() || !filter.matches(ByteSpan(bytes))) continue;
+                if(!tf.deleteRow(rid)) continue;
+                deleted++;
+                noteRowChange(stmt.table, rid);
+
+                auto key = [&](const std::string& col){ return RowCodec::decodeColumn(schema, bytes, schema.colIndex(col), &toast); };
+                for(auto& kv : ti.hash) kv.second.remove(key(kv.first), rid);
+                for(auto& kv : ti.btree) kv.second->remove(key(kv.first), rid);
+                // the row goes first: a crash in between leaks chunks, never loses them
+                for(auto& ref : RowCodec::toastRefs(schema, bytes)) toast.free(ref);
             }
 
-            rebuildIndexes(stmt.table, schema);
+            commitStatement();
 
             std::ostringstream oss;
             oss << R"({"ok":true,"deleted":)" << deleted << "}";
@@ -0,0 +1,414 @@
+#include "DatabaseFile.h"
+#include "ByteUtil.h"
+#include "Constants.h"
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <stdexcept>
+
+namespace tinydb {
+
+static constexpr uint32_t DB_MAGIC = 0x46424454; // "TDBF"
+static constexpr uint32_t DB_VERSION = 1;
+static constexpr uint32_t HEADER_BYTES = 40;     // checksummed part of a header page
+static constexpr uint32_t MAX_EXTENT = 1024;     // pages a segment grows by at most
+
+// header copy 0 sits at offset 0 and copy 1 one page further, so a file
+// whose first copy is torn is probed at every possible page size
+uint32_t DatabaseFile::recordedPageSize(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    if(!in.is_open()) return 0;
+    for(uint32_t at = 0; at <= MAX_PAGE_SIZE; at = at ? at * 2 : MIN_PAGE_SIZE){
+        uint8_t h[HEADER_BYTES + 4];
+        in.clear();
+        in.seekg(at);
+        if(!in.read((char*)h, sizeof(h))) continue;
+        if(read_u32(h) != DB_MAGIC || read_u32(h + 4) != DB_VERSION) continue;
+        if(read_u32(h + HEADER_BYTES) != fnv1a(h, HEADER_BYTES)) continue;
+        uint32_t size = read_u32(h + 8);
+        if(validPageSize(size) && (at == 0 || at == size)) return size;
+    }
+    return 0;
+}
+
+static uint32_t openPageSize(const std::string& path, uint32_t requested) {
+    uint32_t recorded = DatabaseFile::recordedPageSize(path);
+    return recorded ? recorded : requested;
+}
+
+DatabaseFile::DatabaseFile(const std::string& path, uint32_t requested) : file(path, openPageSize(path, requested)) {
+    if(!validPageSize(file.pageSize())) throw std::runtime_error("Unsupported page size for " + path);
+    fileEnd = file.pageCount();
+    if(fileEnd == 0){
+        std::unique_lock<std::shared_mutex> lk(mu);
+        commit();
+        return;
+    }
+
+    // newest header whose metadata is intact
+    struct Candidate { uint64_t gen; Extent meta; uint32_t bytes, sum, total; };
+    std::vector<Candidate> found;
+    for(uint32_t slot = 0; slot < 2; slot++){
+        Candidate c{};
+        if(readHeader(slot, c.gen, c.meta, c.bytes, c.sum, c.total)) found.push_back(c);
+    }
+    std::sort(found.begin(), found.end(), [](const Candidate& a, const Candidate& b){ return a.gen > b.gen; });
+
+    std::vector<uint8_t> page(pageSize());
+    for(auto& c : found){
+        if((uint64_t)c.meta.len * pageSize() < c.bytes) continue;
+        std::vector<uint8_t> blob;
+        blob.reserve((size_t)c.meta.len * pageSize());
+        bool ok = true;
+        for(uint32_t i = 0; i < c.meta.len && ok; i++){
+            ok = file.readPage(c.meta.start + i, page.data());
+            blob.insert(blob.end(), page.begin(), page.end());
+        }
+        if(!ok) continue;
+        blob.resize(c.bytes);
+        if(fnv1a(blob.data(), blob.size()) != c.sum) continue;
+
+        decodeMeta(blob);
+        generation = c.gen;
+        metaRun = c.meta;
+        totalPages = c.total;
+        return;
+    }
+    throw std::runtime_error("Not a valid database file: " + path);
+}
+
+std::string DatabaseFile::segmentName(const std::string& path) {
+    return std::filesystem::path(path).filename().string();
+}
+
+bool DatabaseFile::readHeader(uint32_t slot, uint64_t& gen, Extent& meta, uint32_t& metaBytes, uint32_t& sum, uint32_t& total) {
+    std::vector<uint8_t> buf(pageSize());
+    if(!file.readPage(slot, buf.data())) return false;
+    const uint8_t* h = buf.data();
+    if(read_u32(h) != DB_MAGIC || read_u32(h + 4) != DB_VERSION || read_u32(h + 8) != pageSize()) return false;
+    if(read_u32(h + HEADER_BYTES) != fnv1a(h, HEADER_BYTES)) return false;
+    total = read_u32(h + 12);
+    std::memcpy(&gen, h + 16, 8);
+    meta = Extent{read_u32(h + 24), read_u32(h + 28), 0};
+    metaBytes = read_u32(h + 32);
+    sum = read_u32(h + 36);
+    return true;
+}
+
+FileSegment* DatabaseFile::openSegment(const std::string& path) {
+    std::unique_lock<std::shared_mutex> lk(mu);
+    auto& seg = segments[segmentName(path)];
+    if(!seg){
+        seg = std::make_unique<FileSegment>();
+        metaDirty = true;
+    }
+    return seg.get();
+}
+
+bool DatabaseFile::hasSegment(const std::string& path) const {
+    std::shared_lock<std::shared_mutex> lk(mu);
+    return segments.count(segmentName(path)) > 0;
+}
+
+void DatabaseFile::removeSegment(const std::string& path) {
+    std::unique_lock<std::shared_mutex> lk(mu);
+    auto it = segments.find(segmentName(path));
+    if(it == segments.end()) return;
+    for(auto& e : it->second->extents) released.push_back(e);
+    segments.erase(it);
+    metaDirty = true;
+    commit();
+}
+
+void DatabaseFile::renameSegment(const std::string& from, const std::string& to) {
+    std::unique_lock<std::shared_mutex> lk(mu);
+    auto it = segments.find(segmentName(from));
+    if(it == segments.end()) throw std::runtime_error("No segment " + segmentName(from));
+    std::unique_ptr<FileSegment> seg = std::move(it->second);
+    segments.erase(it);
+
+    auto& dst = segments[segmentName(to)];
+    if(dst){
+        for(auto& e : dst->extents) released.push_back(e);
+    }
+    dst = std::move(seg);
+    metaDirty = true;
+    commit();
+}
+
+uint32_t DatabaseFile::segmentPages(const FileSegment* seg) const {
+    std::shared_lock<std::shared_mutex> lk(mu);
+    return seg->pages;
+}
+
+void DatabaseFile::ensurePages(FileSegment* seg, uint32_t pages) {
+    std::unique_lock<std::shared_mutex> lk(mu);
+    if(pages <= seg->pages) return;
+
+    while(seg->capacity < pages){
+        uint32_t step = std::min(std::max(seg->capacity, 1u), MAX_EXTENT);
+        uint32_t want = std::max(pages - seg->capacity, step);
+
+        // a run that ends the file simply grows, keeping the segment contiguous
+        if(!seg->extents.empty()){
+            Extent& last = seg->extents.back();
+            if(last.start + last.len == totalPages){
+                if(totalPages < fileEnd) zeroPages(totalPages, std::min(want, fileEnd - totalPages));
+                totalPages += want;
+                last.len += want;
+                seg->capacity += want;
+                continue;
+            }
+        }
+        Extent run = allocateRun(want);
+        run.first = seg->capacity;
+        seg->extents.push_back(run);
+        seg->capacity += want;
+    }
+    seg->pages = pages;
+    metaDirty = true;
+}
+
+void DatabaseFile::truncateSegment(FileSegment* seg, uint32_t pages) {
+    std::unique_lock<std::shared_mutex> lk(mu);
+    if(pages >= seg->pages) return;
+
+    // everything past the new end is given back, splitting the run it falls in
+    while(!seg->extents.empty() && seg->extents.back().first >= pages){
+        released.push_back(seg->extents.back());
+        seg->extents.pop_back();
+    }
+    if(!seg->extents.empty()){
+        Extent& last = seg->extents.back();
+        uint32_t keep = pages - last.first;
+        if(keep < last.len){
+            released.push_back(Extent{last.start + keep, last.len - keep, 0});
+            last.len = keep;
+        }
+    }
+    seg->pages = pages;
+    seg->capacity = pages;
+    metaDirty = true;
+    commit();
+}
+
+uint32_t DatabaseFile::physical(const FileSegment& seg, uint32_t pageId) const {
+    auto it = std::upper_bound(seg.extents.begin(), seg.extents.end(), pageId,
+                               [](uint32_t p, const Extent& e){ return p < e.first; });
+    --it;
+    return it->start + (pageId - it->first);
+}
+
+bool DatabaseFile::readPage(const FileSegment* seg, uint32_t pageId, uint8_t* buf) {
+    std::shared_lock<std::shared_mutex> lk(mu);
+    if(pageId >= seg->pages){
+        std::memset(buf, 0, pageSize());
+        return false;
+    }
+    return file.readPage(physical(*seg, pageId), buf);
+}
+
+bool DatabaseFile::locate(const FileSegment* seg, uint32_t pageId, int& fd, long long& offset) {
+    std::shared_lock<std::shared_mutex> lk(mu);
+    if(pageId >= seg->pages) return false;
+    return file.locate(physical(*seg, pageId), fd, offset);
+}
+
+void DatabaseFile::writePage(const FileSegment* seg, uint32_t pageId, const uint8_t* buf) {
+    std::shared_lock<std::shared_mutex> lk(mu);
+    if(pageId >= seg->capacity) throw std::runtime_error("Write past the end of a segment");
+    file.writePage(physical(*seg, pageId), buf);
+    unsynced = true;
+}
+
+const uint8_t* DatabaseFile::mappedPage(const FileSegment* seg, uint32_t pageId) {
+    std::shared_lock<std::shared_mutex> lk(mu);
+    if(pageId >= seg->pages) return nullptr;
+    return file.mappedPage(physical(*seg, pageId));
+}
+
+std::string DatabaseFile::catalog() const {
+    std::shared_lock<std::shared_mutex> lk(mu);
+    return catalogText;
+}
+
+void DatabaseFile::setCatalog(const std::string& text) {
+    std::unique_lock<std::shared_mutex> lk(mu);
+    catalogText = text;
+    metaDirty = true;
+    commit();
+}
+
+void DatabaseFile::sync() {
+    std::unique_lock<std::shared_mutex> lk(mu);
+    if(metaDirty){
+        commit();
+    } else if(unsynced){
+        file.sync();
+        unsynced = false;
+    }
+}
+
+// first fit from the free runs, else from the end of the file. Reused
+// pages are zeroed so a segment never reads another's old data.
+DatabaseFile::Extent DatabaseFile::allocateRun(uint32_t len) {
+    for(size_t i = 0; i < freeRuns.size(); i++){
+        Extent& f = freeRuns[i];
+        if(f.len < len) continue;
+        Extent run{f.start, len, 0};
+        f.start += len;
+        f.len -= len;
+        if(f.len == 0) freeRuns.erase(freeRuns.begin() + (long)i);
+        zeroPages(run.start, len);
+        return run;
+    }
+    Extent run{totalPages, len, 0};
+    totalPages += len;
+    // pages past the last header were written but never committed
+    if(run.start < fileEnd) zeroPages(run.start, std::min(len, fileEnd - run.start));
+    return run;
+}
+
+void DatabaseFile::freeRun(Extent run) {
+    run.first = 0;
+    auto it = std::lower_bound(freeRuns.begin(), freeRuns.end(), run.start,
+                               [](const Extent& e, uint32_t s){ return e.start < s; });
+    it = freeRuns.insert(it, run);
+    auto next = it + 1;
+    if(next != freeRuns.end() && it->start + it->len == next->start){
+        it->len += next->len;
+        freeRuns.erase(next);
+    }
+    if(it != freeRuns.begin()){
+        auto prev = it - 1;
+        if(prev->start + prev->len == it->start){
+            prev->len += it->len;
+            freeRuns.erase(it);
+        }
+    }
+}
+
+void DatabaseFile::zeroPages(uint32_t start, uint32_t len) {
+    const std::vector<uint8_t> zeros(pageSize(), 0);
+    for(uint32_t i = 0; i < len; i++) file.writePage(start + i, zeros.data());
+}
+
+std::vector<uint8_t> DatabaseFile::encodeMeta(const std::vector<Extent>& alsoFree) const {
+    std::vector<uint8_t> b;
+    append_u32(b, (uint32_t)catalogText.size());
+    b.insert(b.end(), catalogText.begin(), catalogText.end());
+
+    append_u32(b, (uint32_t)segments.size());
+    for(auto& kv : segments){
+        append_u32(b, (uint32_t)kv.first.size());
+        b.insert(b.end(), kv.first.begin(), kv.first.end());
+        append_u32(b, kv.second->pages);
+        append_u32(b, (uint32_t)kv.second->extents.size());
+        for(auto& e : kv.second->extents){
+            append_u32(b, e.start);
+            append_u32(b, e.len);
+        }
+    }
+
+    append_u32(b, (uint32_t)(freeRuns.size() + alsoFree.size()));
+    for(auto* runs : {&freeRuns, &alsoFree}){
+        for(auto& e : *runs){
+            append_u32(b, e.start);
+            append_u32(b, e.len);
+        }
+    }
+    return b;
+}
+
+void DatabaseFile::decodeMeta(const std::vector<uint8_t>& b) {
+    size_t pos = 0;
+    auto bytes = [&](uint32_t n){
+        if(pos + n > b.size()) throw std::runtime_error("Database metadata truncated");
+        std::string s((const char*)&b[pos], n);
+        pos += n;
+        return s;
+    };
+
+    catalogText = bytes(pop_u32(b, pos));
+    segments.clear();
+    uint32_t count = pop_u32(b, pos);
+    for(uint32_t i = 0; i < count; i++){
+        std::string name = bytes(pop_u32(b, pos));
+        auto seg = std::make_unique<FileSegment>();
+        seg->pages = pop_u32(b, pos);
+        uint32_t runs = pop_u32(b, pos);
+        for(uint32_t r = 0; r < runs; r++){
+            Extent e;
+            e.start = pop_u32(b, pos);
+            e.len = pop_u32(b, pos);
+            e.first = seg->capacity;
+            seg->capacity += e.len;
+            seg->extents.push_back(e);
+        }
+        segments.emplace(std::move(name), std::move(seg));
+    }
+
+    freeRuns.clear();
+    uint32_t frees = pop_u32(b, pos);
+    for(uint32_t i = 0; i < frees; i++){
+        uint32_t start = pop_u32(b, pos);
+        uint32_t len = pop_u32(b, pos);
+        freeRun(Extent{start, len, 0});
+    }
+}
+
+// the metadata lists the run it is written to as in use, so its size is
+// only known once that run is allocated; a run that turns out too small
+// is given back and a larger one taken
+void DatabaseFile::commit() {
+    std::vector<Extent> pending = released;
+    if(metaRun.len) pending.push_back(metaRun);
+
+    uint32_t need = 1;
+    Extent run;
+    std::vector<uint8_t> blob;
+    for(;;){
+        run = allocateRun(need);
+        blob = encodeMeta(pending);
+        uint32_t pages = std::max<uint32_t>(1, (uint32_t)((blob.size() + pageSize() - 1) / pageSize()));
+        if(pages <= need) break;
+        freeRun(run);
+        need = pages;
+    }
+
+    std::vector<uint8_t> page(pageSize());
+    for(uint32_t i = 0; i < run.len; i++){
+        std::fill(page.begin(), page.end(), 0);
+        size_t off = (size_t)i * pageSize();
+        if(off < blob.size()) std::memcpy(page.data(), blob.data() + off, std::min<size_t>(pageSize(), blob.size() - off));
+        file.writePage(run.start + i, page.data());
+    }
+    file.sync();
+
+    uint64_t gen = generation + 1;
+    std::fill(page.begin(), page.end(), 0);
+    uint8_t* h = page.data();
+    write_u32(h, DB_MAGIC);
+    write_u32(h + 4, DB_VERSION);
+    write_u32(h + 8, pageSize());
+    write_u32(h + 12, totalPages);
+    std::memcpy(h + 16, &gen, 8);
+    write_u32(h + 24, run.start);
+    write_u32(h + 28, run.len);
+    write_u32(h + 32, (uint32_t)blob.size());
+    write_u32(h + 36, fnv1a(blob.data(), blob.size()));
+    write_u32(h + HEADER_BYTES, fnv1a(h, HEADER_BYTES));
+    file.writePage((uint32_t)(gen % 2), h);
+    file.sync();
+
+    generation = gen;
+    metaRun = run;
+    for(auto& e : pending) freeRun(e);
+    released.clear();
+    metaDirty = false;
+    unsynced = false;
+}
+
+}
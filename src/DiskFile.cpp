@@ -0,0 +1,202 @@
+#include "DiskFile.h"
+#include "Constants.h"
+#include "DatabaseFile.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#ifdef _WIN32
+  #include <io.h>
+  #include <fcntl.h>
+  #include <sys/stat.h>
+#else
+  #include <fcntl.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <unistd.h>
+#endif
+
+namespace tinydb {
+
+DiskFile::DiskFile(const std::string& p, uint32_t pageSize) : path(p), pageBytes(pageSize) {
+#ifdef _WIN32
+    fd = _open(path.c_str(), _O_RDWR | _O_CREAT | _O_BINARY, _S_IREAD | _S_IWRITE);
+    if(fd < 0) throw std::runtime_error("Cannot open " + path);
+    long long size = _lseeki64(fd, 0, SEEK_END);
+#else
+    fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if(fd < 0) throw std::runtime_error("Cannot open " + path);
+    struct stat st{};
+    if(fstat(fd, &st) != 0) throw std::runtime_error("Cannot stat " + path);
+    long long size = (long long)st.st_size;
+#endif
+    numPages = (uint32_t)(size < 0 ? 0 : size / pageBytes);
+    diskPages = numPages.load();
+}
+
+DiskFile::DiskFile(DatabaseFile& db, const std::string& p)
+    : path(p), pageBytes(db.pageSize()), store(&db), segment(db.openSegment(p)) {
+    numPages = db.segmentPages(segment);
+    diskPages = numPages.load();
+}
+
+DiskFile::~DiskFile() {
+#ifdef _WIN32
+    if(fd >= 0) _close(fd);
+#else
+    for(auto& m : mappings) ::munmap(m.first, m.second);
+    if(fd >= 0) ::close(fd);
+#endif
+}
+
+uint32_t DiskFile::allocatePage() {
+    uint32_t pageId = numPages.fetch_add(1);
+    if(store) store->ensurePages(segment, pageId + 1);
+    return pageId;
+}
+
+void DiskFile::ensurePageCount(uint32_t n) {
+    uint32_t cur = numPages.load();
+    while(cur < n && !numPages.compare_exchange_weak(cur, n)) {}
+    if(store) store->ensurePages(segment, n);
+}
+
+void DiskFile::truncate(uint32_t n) {
+    if(n >= numPages.load()) return;
+    if(store){
+        store->truncateSegment(segment, n);
+    } else {
+        long long size = (long long)n * pageBytes;
+#ifdef _WIN32
+        std::lock_guard<std::mutex> lk(ioMu);
+        if(_chsize_s(fd, size) != 0) throw std::runtime_error("Cannot truncate " + path);
+#else
+        if(::ftruncate(fd, (off_t)size) != 0) throw std::runtime_error("Cannot truncate " + path);
+#endif
+    }
+    numPages = n;
+    if(diskPages.load() > n) diskPages = n;
+}
+
+bool DiskFile::readPage(uint32_t pageId, uint8_t* buf) {
+    if(store) return store->readPage(segment, pageId, buf);
+    long long off = (long long)pageId * pageBytes;
+    size_t got = 0;
+#ifdef _WIN32
+    std::lock_guard<std::mutex> lk(ioMu);
+    _lseeki64(fd, off, SEEK_SET);
+    int n = _read(fd, buf, pageBytes);
+    if(n > 0) got = (size_t)n;
+#else
+    while(got < pageBytes){
+        ssize_t n = ::pread(fd, buf + got, pageBytes - got, (off_t)(off + got));
+        if(n <= 0) break;
+        got += (size_t)n;
+    }
+#endif
+    if(got != pageBytes){
+        std::memset(buf, 0, pageBytes);
+        return false;
+    }
+    return true;
+}
+
+bool DiskFile::locate(uint32_t pageId, int& fdOut, long long& offset) {
+    if(store) return store->locate(segment, pageId, fdOut, offset);
+    if(pageId >= numPages.load()) return false;
+    fdOut = fd;
+    offset = (long long)pageId * pageBytes;
+    return true;
+}
+
+void DiskFile::writePage(uint32_t pageId, const uint8_t* buf) {
+    if(store){
+        store->writePage(segment, pageId, buf);
+        return;
+    }
+    long long off = (long long)pageId * pageBytes;
+#ifdef _WIN32
+    std::lock_guard<std::mutex> lk(ioMu);
+    _lseeki64(fd, off, SEEK_SET);
+    if(_write(fd, buf, pageBytes) != (int)pageBytes) throw std::runtime_error("Cannot write " + path);
+#else
+    size_t done = 0;
+    while(done < pageBytes){
+        ssize_t n = ::pwrite(fd, buf + done, pageBytes - done, (off_t)(off + done));
+        if(n <= 0) throw std::runtime_error("Cannot write " + path);
+        done += (size_t)n;
+    }
+#endif
+    uint32_t seen = diskPages.load();
+    while(pageId >= seen && !diskPages.compare_exchange_weak(seen, pageId + 1)) {}
+}
+
+void DiskFile::sync() {
+    if(store){
+        store->sync();
+        return;
+    }
+#ifdef _WIN32
+    _commit(fd);
+#else
+    ::fsync(fd);
+#endif
+}
+
+void DiskFile::enableMmap() {
+#ifndef _WIN32
+    mmapOn = true;
+    if(store) store->enableMmap();
+#endif
+}
+
+const uint8_t* DiskFile::mappedPage(uint32_t pageId) {
+    if(store) return mmapOn ? store->mappedPage(segment, pageId) : nullptr;
+    if(!mmapOn || pageId >= diskPages.load()) return nullptr;
+    if(pageId >= mapCapacity.load()) remap(pageId + 1);
+    uint8_t* base = mapBase.load();
+    if(!base) return nullptr;
+    return base + (size_t)pageId * pageBytes;
+}
+
+void DiskFile::remap(uint32_t minPages) {
+#ifndef _WIN32
+    std::lock_guard<std::mutex> lk(mapMu);
+    if(minPages <= mapCapacity.load()) return;
+
+    // mapping past EOF is fine: those pages become readable as the file grows
+    uint32_t cap = std::max<uint32_t>(minPages, std::max<uint32_t>(256, mapCapacity.load() * 2));
+    size_t len = (size_t)cap * pageBytes;
+    void* m = ::mmap(nullptr, len, PROT_READ, MAP_SHARED, fd, 0);
+    if(m == MAP_FAILED) throw std::runtime_error("mmap failed for " + path);
+    mappings.emplace_back((uint8_t*)m, len);
+    mapBase = (uint8_t*)m;
+    mapCapacity = cap;
+    applyAdvice();
+#else
+    (void)minPages;
+#endif
+}
+
+void DiskFile::advise(AccessHint h) {
+    if(store){
+        store->advise(h);
+        return;
+    }
+    std::lock_guard<std::mutex> lk(mapMu);
+    if(h == hint) return;
+    hint = h;
+    applyAdvice();
+}
+
+void DiskFile::applyAdvice() {
+#ifndef _WIN32
+    if(mappings.empty()) return;
+    int adv = MADV_NORMAL;
+    if(hint == AccessHint::Sequential) adv = MADV_SEQUENTIAL;
+    else if(hint == AccessHint::Random) adv = MADV_RANDOM;
+    ::madvise(mappings.back().first, mappings.back().second, adv);
+#endif
+}
+
+}
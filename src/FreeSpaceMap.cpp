@@ -0,0 +1,83 @@
+#include "FreeSpaceMap.h"
+#include "Constants.h"
+#include <algorithm>
+
+namespace tinydb {
+
+FreeSpaceMap::FreeSpaceMap(BufferPool& bp, const std::string& path)
+    : pool(bp), file(bp.openFile(path)), pageBytes(bp.pageSize()), bucketBytes(bp.pageSize() / 256),
+      pagesByBucket(NUM_BUCKETS) {
+    uint32_t n = file.pageCount();
+    buckets.assign((size_t)n * pageBytes, 0);
+    for(uint32_t fp = 0; fp < n; fp++){
+        auto g = pool.fetch(file, fp);
+        std::copy(g.data(), g.data() + pageBytes, buckets.begin() + (size_t)fp * pageBytes);
+    }
+
+    while(covered < buckets.size() && buckets[covered] != 0) covered++;
+    for(uint32_t pid = 0; pid < covered; pid++){
+        uint8_t b = (uint8_t)(buckets[pid] - 1);
+        if(b > 0) pagesByBucket[b].insert(pid);
+    }
+}
+
+uint8_t FreeSpaceMap::bucketFor(uint32_t freeBytes) const {
+    return (uint8_t)std::min<uint32_t>(freeBytes / bucketBytes, NUM_BUCKETS - 1);
+}
+
+uint32_t FreeSpaceMap::findPage(uint32_t need, uint32_t below) const {
+    uint32_t first = (need + bucketBytes - 1) / bucketBytes;
+    if(first == 0) first = 1;
+    for(uint32_t b = first; b < NUM_BUCKETS; b++){
+        if(!pagesByBucket[b].empty() && *pagesByBucket[b].begin() < below) return *pagesByBucket[b].begin();
+    }
+    return NO_PAGE;
+}
+
+void FreeSpaceMap::update(uint32_t pageId, uint32_t freeBytes) {
+    if(pageId >= buckets.size()) buckets.resize(((size_t)pageId / pageBytes + 1) * pageBytes, 0);
+
+    uint8_t stored = (uint8_t)(bucketFor(freeBytes) + 1);
+    uint8_t old = buckets[pageId];
+    if(old == stored) return;
+
+    if(old != 0 && pageId < covered && old > 1) pagesByBucket[old - 1].erase(pageId);
+    buckets[pageId] = stored;
+    persist(pageId, stored);
+
+    if(pageId <= covered){
+        if(pageId == covered){
+            covered++;
+            while(covered < buckets.size() && buckets[covered] != 0){
+                uint8_t b = (uint8_t)(buckets[covered] - 1);
+                if(b > 0) pagesByBucket[b].insert(covered);
+                covered++;
+            }
+        }
+        if(stored > 1) pagesByBucket[stored - 1].insert(pageId);
+    }
+}
+
+void FreeSpaceMap::truncate(uint32_t pages) {
+    for(uint32_t pid = pages; pid < buckets.size(); pid++){
+        uint8_t old = buckets[pid];
+        if(old == 0) continue;
+        if(pid < covered && old > 1) pagesByBucket[old - 1].erase(pid);
+        buckets[pid] = 0;
+        persist(pid, 0);
+    }
+    covered = std::min(covered, pages);
+}
+
+void FreeSpaceMap::persist(uint32_t pageId, uint8_t stored) {
+    uint32_t fp = pageId / pageBytes;
+    while(file.pageCount() <= fp){
+        uint32_t np;
+        pool.allocate(file, np);
+    }
+    auto g = pool.fetch(file, fp);
+    g.data()[pageId % pageBytes] = stored;
+    g.markDirty();
+}
+
+}
@@ -1,28 +1,374 @@
 #include "HashIndex.h"
+#include "ByteUtil.h"
 #include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+
+#ifdef _WIN32
+  #include <io.h>
+  #include <fcntl.h>
+  #include <sys/stat.h>
+#else
+  #include <fcntl.h>
+  #include <unistd.h>
+#endif
 
 namespace tinydb {
 
-void HashIndex::add(const std::string& key, const RowId& rid){
-    idx[key].push_back(rid);
+static bool sameRow(const RowId& a, const RowId& b){
+    return a.pageId==b.pageId && a.slotId==b.slotId;
+}
+
+template<typename Key>
+void HashIndex<Key>::add(const Key& key, const RowId& rid){
+    auto it = idx.find(key);
+    if(it==idx.end()){
+        idx.emplace(key, Postings{rid, {}});
+        return;
+    }
+    it->second.more.push_back(rid);
 }
 
-void HashIndex::remove(const std::string& key, const RowId& rid){
+template<typename Key>
+void HashIndex<Key>::remove(const Key& key, const RowId& rid){
     auto it = idx.find(key);
     if(it==idx.end()) return;
-    auto& v = it->second;
-    v.erase(std::remove_if(v.begin(), v.end(), [&](const RowId& x){
-        return x.pageId==rid.pageId && x.slotId==rid.slotId;
-    }), v.end());
-    if(v.empty()) idx.erase(it);
+    auto& p = it->second;
+    auto& v = p.more;
+    v.erase(std::remove_if(v.begin(), v.end(), [&](const RowId& x){ return sameRow(x, rid); }), v.end());
+    if(!sameRow(p.first, rid)) return;
+    if(v.empty()){ idx.erase(it); return; }
+    p.first = v.front();
+    v.erase(v.begin());
 }
 
-std::vector<RowId> HashIndex::find(const std::string& key) const{
+template<typename Key>
+std::vector<RowId> HashIndex<Key>::find(const Key& key) const{
     auto it = idx.find(key);
     if(it==idx.end()) return {};
-    return it->second;
+    std::vector<RowId> out;
+    out.reserve(1 + it->second.more.size());
+    out.push_back(it->second.first);
+    out.insert(out.end(), it->second.more.begin(), it->second.more.end());
+    return out;
+}
+
+template<typename Key>
+void HashIndex<Key>::clear(){ idx.clear(); }
+
+template<typename Key>
+void HashIndex<Key>::reserve(size_t keys){ idx.reserve(keys); }
+
+template<typename Key>
+void HashIndex<Key>::forEach(const std::function<void(const Key&, const RowId&)>& fn) const{
+    for(auto& kv : idx){
+        fn(kv.first, kv.second.first);
+        for(auto& r : kv.second.more) fn(kv.first, r);
+    }
+}
+
+template class HashIndex<std::string>;
+
+// ---- INT32: Robin Hood open addressing ----
+
+size_t HashIndex<int32_t>::home(int32_t key) const{
+    // Fibonacci hashing; the top bits pick the slot
+    return (size_t)(((uint64_t)(uint32_t)key * 0x9E3779B97F4A7C15ULL) >> shift);
+}
+
+long HashIndex<int32_t>::locate(int32_t key) const{
+    if(slots.empty()) return -1;
+    size_t mask = slots.size() - 1;
+    size_t i = home(key);
+    for(uint16_t dist = 0;; dist++){
+        const Slot& s = slots[i];
+        // an empty slot or one closer to its home ends the probe
+        if(!s.meta || (uint16_t)((s.meta & DIST_MASK) - 1) < dist) return -1;
+        if(s.key==key) return (long)i;
+        i = (i + 1) & mask;
+    }
+}
+
+void HashIndex<int32_t>::place(Slot s){
+    size_t mask = slots.size() - 1;
+    size_t i = home(s.key);
+    for(uint16_t dist = 0;; dist++){
+        s.meta = (uint16_t)((s.meta & MULTI) | (dist + 1));
+        Slot& cur = slots[i];
+        if(!cur.meta){
+            cur = s;
+            used++;
+            return;
+        }
+        uint16_t curDist = (uint16_t)((cur.meta & DIST_MASK) - 1);
+        if(curDist < dist){
+            std::swap(cur, s);
+            dist = curDist;
+        }
+        i = (i + 1) & mask;
+    }
+}
+
+void HashIndex<int32_t>::erase(size_t pos){
+    // backward-shift deletion keeps probe sequences tombstone-free
+    size_t mask = slots.size() - 1;
+    size_t next = (pos + 1) & mask;
+    while(slots[next].meta && (slots[next].meta & DIST_MASK) > 1){
+        slots[pos] = slots[next];
+        slots[pos].meta--;
+        pos = next;
+        next = (next + 1) & mask;
+    }
+    slots[pos].meta = 0;
+    used--;
+}
+
+void HashIndex<int32_t>::grow(){
+    size_t size = slots.empty() ? 16 : slots.size() * 2;
+    std::vector<Slot> old;
+    old.swap(slots);
+    slots.assign(size, Slot{0, 0, 0, 0});
+    shift = 64;
+    for(size_t n = size; n > 1; n >>= 1) shift--;
+    used = 0;
+    for(auto& s : old){
+        if(s.meta) place(s);
+    }
+}
+
+void HashIndex<int32_t>::add(int32_t key, const RowId& rid){
+    long pos = locate(key);
+    if(pos >= 0){
+        Slot& s = slots[(size_t)pos];
+        if(s.meta & MULTI){
+            lists[s.page].push_back(rid);
+            return;
+        }
+        uint32_t li;
+        if(!freeLists.empty()){ li = freeLists.back(); freeLists.pop_back(); }
+        else { li = (uint32_t)lists.size(); lists.emplace_back(); }
+        lists[li] = {RowId{s.page, s.slot}, rid};
+        s.page = li;
+        s.meta |= MULTI;
+        return;
+    }
+    if((used + 1) * 8 > slots.size() * 7) grow(); // max load 7/8
+    place(Slot{key, rid.pageId, rid.slotId, 0});
+}
+
+void HashIndex<int32_t>::remove(int32_t key, const RowId& rid){
+    long pos = locate(key);
+    if(pos < 0) return;
+    Slot& s = slots[(size_t)pos];
+    if(!(s.meta & MULTI)){
+        if(s.page==rid.pageId && s.slot==rid.slotId) erase((size_t)pos);
+        return;
+    }
+
+    uint32_t li = s.page;
+    auto& v = lists[li];
+    v.erase(std::remove_if(v.begin(), v.end(), [&](const RowId& x){ return sameRow(x, rid); }), v.end());
+    if(v.size() > 1) return;
+    if(v.size()==1){
+        s.page = v[0].pageId;
+        s.slot = v[0].slotId;
+        s.meta &= (uint16_t)~MULTI;
+    } else {
+        erase((size_t)pos);
+    }
+    std::vector<RowId>().swap(v);
+    freeLists.push_back(li);
+}
+
+std::vector<RowId> HashIndex<int32_t>::find(int32_t key) const{
+    long pos = locate(key);
+    if(pos < 0) return {};
+    const Slot& s = slots[(size_t)pos];
+    if(s.meta & MULTI) return lists[s.page];
+    return {RowId{s.page, s.slot}};
+}
+
+void HashIndex<int32_t>::clear(){
+    slots.clear();
+    used = 0;
+    shift = 64;
+    lists.clear();
+    freeLists.clear();
 }
 
-void HashIndex::clear(){ idx.clear(); }
+void HashIndex<int32_t>::forEach(const std::function<void(int32_t, const RowId&)>& fn) const{
+    for(auto& s : slots){
+        if(!s.meta) continue;
+        if(s.meta & MULTI){
+            for(auto& r : lists[s.page]) fn(s.key, r);
+        } else {
+            fn(s.key, RowId{s.page, s.slot});
+        }
+    }
+}
+
+void HashIndex<int32_t>::reserve(size_t keys){
+    while(keys * 8 > slots.size() * 7) grow();
+}
+
+// ---- TypedHashIndex ----
+
+TypedHashIndex::TypedHashIndex(ColType t) : type(t) {
+    if(type==ColType::INT32) impl = HashIndex<int32_t>{};
+    else impl = HashIndex<std::string>{};
+}
+
+void TypedHashIndex::add(const Value& key, const RowId& rid){
+    changed = true;
+    if(auto* h = std::get_if<HashIndex<int32_t>>(&impl)) h->add(std::get<int32_t>(key), rid);
+    else std::get<HashIndex<std::string>>(impl).add(std::get<std::string>(key), rid);
+}
+
+void TypedHashIndex::remove(const Value& key, const RowId& rid){
+    changed = true;
+    if(auto* h = std::get_if<HashIndex<int32_t>>(&impl)) h->remove(std::get<int32_t>(key), rid);
+    else std::get<HashIndex<std::string>>(impl).remove(std::get<std::string>(key), rid);
+}
+
+std::vector<RowId> TypedHashIndex::find(const Value& key) const{
+    if(auto* h = std::get_if<HashIndex<int32_t>>(&impl)) return h->find(std::get<int32_t>(key));
+    return std::get<HashIndex<std::string>>(impl).find(std::get<std::string>(key));
+}
+
+void TypedHashIndex::clear(){
+    changed = true;
+    std::visit([](auto& h){ h.clear(); }, impl);
+}
+
+void TypedHashIndex::removeRows(const std::function<bool(const RowId&)>& pred){
+    std::vector<std::pair<Value, RowId>> doomed;
+    if(auto* h = std::get_if<HashIndex<int32_t>>(&impl)){
+        h->forEach([&](int32_t k, const RowId& r){ if(pred(r)) doomed.emplace_back(k, r); });
+    } else {
+        std::get<HashIndex<std::string>>(impl).forEach([&](const std::string& k, const RowId& r){
+            if(pred(r)) doomed.emplace_back(k, r);
+        });
+    }
+    for(auto& d : doomed) remove(d.first, d.second);
+}
+
+// ---- snapshots ----
+// magic | version | key type | reserved | lsn u64 | count u64 | entries | fnv1a
+// entry: INT32 key, or u32 len + bytes for TEXT; then page u32, slot u16
+
+static constexpr uint32_t SNAP_MAGIC = 0x58494854; // "THIX"
+static constexpr uint32_t SNAP_VERSION = 1;
+static constexpr size_t SNAP_HEADER = 32;
+
+static void writeDurably(const std::string& path, const std::vector<uint8_t>& bytes){
+    std::string tmp = path + ".tmp";
+#ifdef _WIN32
+    int fd = _open(tmp.c_str(), _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+#endif
+    if(fd < 0) throw std::runtime_error("Cannot create " + tmp);
+    size_t done = 0;
+    while(done < bytes.size()){
+#ifdef _WIN32
+        int n = _write(fd, bytes.data() + done, (unsigned)(bytes.size() - done));
+#else
+        ssize_t n = ::write(fd, bytes.data() + done, bytes.size() - done);
+#endif
+        if(n <= 0) break;
+        done += (size_t)n;
+    }
+#ifdef _WIN32
+    bool ok = done == bytes.size() && _commit(fd) == 0;
+    _close(fd);
+#else
+    bool ok = done == bytes.size() && ::fsync(fd) == 0;
+    ::close(fd);
+#endif
+    if(!ok) throw std::runtime_error("Cannot write " + tmp);
+    std::filesystem::rename(tmp, path);
+
+#ifndef _WIN32
+    // make the rename itself durable before the caller drops the log
+    std::string dir = std::filesystem::path(path).parent_path().string();
+    int dfd = ::open(dir.empty() ? "." : dir.c_str(), O_RDONLY);
+    if(dfd >= 0){ ::fsync(dfd); ::close(dfd); }
+#endif
+}
+
+void TypedHashIndex::save(const std::string& path, uint64_t lsn){
+    std::vector<uint8_t> out(SNAP_HEADER);
+    uint64_t count = 0;
+    auto appendRid = [&](const RowId& r){
+        append_u32(out, r.pageId);
+        uint8_t s[2]; write_u16(s, r.slotId);
+        out.insert(out.end(), s, s + 2);
+        count++;
+    };
+    if(auto* h = std::get_if<HashIndex<int32_t>>(&impl)){
+        h->forEach([&](int32_t k, const RowId& r){ append_i32(out, k); appendRid(r); });
+    } else {
+        std::get<HashIndex<std::string>>(impl).forEach([&](const std::string& k, const RowId& r){
+            append_u32(out, (uint32_t)k.size());
+            out.insert(out.end(), k.begin(), k.end());
+            appendRid(r);
+        });
+    }
+
+    write_u32(&out[0], SNAP_MAGIC);
+    write_u32(&out[4], SNAP_VERSION);
+    write_u32(&out[8], (uint32_t)type);
+    std::memcpy(&out[16], &lsn, 8);
+    std::memcpy(&out[24], &count, 8);
+    append_u32(out, fnv1a(out.data(), out.size()));
+
+    writeDurably(path, out);
+    changed = false;
+}
+
+bool TypedHashIndex::load(const std::string& path, uint64_t& lsn){
+    std::ifstream in(path, std::ios::binary | std::ios::ate);
+    if(!in.is_open()) return false;
+    std::vector<uint8_t> b((size_t)in.tellg());
+    in.seekg(0);
+    if(!in.read((char*)b.data(), (std::streamsize)b.size())) return false;
+    if(b.size() < SNAP_HEADER + 4) return false;
+    size_t body = b.size() - 4;
+    if(read_u32(&b[body]) != fnv1a(b.data(), body)) return false;
+    if(read_u32(&b[0]) != SNAP_MAGIC || read_u32(&b[4]) != SNAP_VERSION || read_u32(&b[8]) != (uint32_t)type) return false;
+
+    uint64_t count;
+    std::memcpy(&lsn, &b[16], 8);
+    std::memcpy(&count, &b[24], 8);
+
+    clear();
+    size_t pos = SNAP_HEADER;
+    auto popRid = [&](){
+        RowId r{read_u32(&b[pos]), read_u16(&b[pos + 4])};
+        pos += 6;
+        return r;
+    };
+    if(auto* h = std::get_if<HashIndex<int32_t>>(&impl)){
+        if(count * 10 != body - SNAP_HEADER) return false;
+        h->reserve((size_t)count);
+        for(uint64_t i = 0; i < count; i++){
+            int32_t k; std::memcpy(&k, &b[pos], 4); pos += 4;
+            h->add(k, popRid());
+        }
+    } else {
+        auto& th = std::get<HashIndex<std::string>>(impl);
+        th.reserve((size_t)count);
+        for(uint64_t i = 0; i < count; i++){
+            if(pos + 4 > body) { clear(); return false; }
+            uint32_t len = read_u32(&b[pos]); pos += 4;
+            if(pos + len + 6 > body) { clear(); return false; }
+            std::string k((const char*)&b[pos], len); pos += len;
+            th.add(k, popRid());
+        }
+    }
+    changed = false;
+    return true;
+}
 
 }
@@ -0,0 +1,121 @@
+#include "Kernels.h"
+
+#if !defined(TINYDB_NO_SIMD) && (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__) && defined(__SSE2__)
+  #define TINYDB_X86_SIMD 1
+  #include <immintrin.h>
+#endif
+
+namespace tinydb {
+
+// an unsigned distance test covers both bounds in one comparison; lo <= hi
+static inline bool within(int32_t x, int32_t lo, uint32_t span) {
+    return (uint32_t)x - (uint32_t)lo <= span;
+}
+
+static size_t betweenScalar(const int32_t* v, size_t n, int32_t lo, int32_t hi, uint32_t* sel) {
+    uint32_t span = (uint32_t)hi - (uint32_t)lo;
+    size_t k = 0;
+    for (size_t i = 0; i < n; i++) {
+        sel[k] = (uint32_t)i;
+        k += within(v[i], lo, span);
+    }
+    return k;
+}
+
+#ifdef TINYDB_X86_SIMD
+
+// lane numbers of the set bits of every 8-bit mask, lowest first
+struct CompactTable {
+    uint8_t lanes[256][8];
+    constexpr CompactTable() : lanes() {
+        for (int m = 0; m < 256; m++) {
+            int k = 0;
+            for (int b = 0; b < 8; b++) {
+                if (m & (1 << b)) lanes[m][k++] = (uint8_t)b;
+            }
+        }
+    }
+};
+static constexpr CompactTable COMPACT{};
+
+static size_t betweenSse2(const int32_t* v, size_t n, int32_t lo, int32_t hi, uint32_t* sel) {
+    const __m128i vlo = _mm_set1_epi32(lo), vhi = _mm_set1_epi32(hi);
+    size_t k = 0, i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i x = _mm_loadu_si128((const __m128i*)(v + i));
+        __m128i out = _mm_or_si128(_mm_cmpgt_epi32(vlo, x), _mm_cmpgt_epi32(x, vhi));
+        unsigned m = ~(unsigned)_mm_movemask_ps(_mm_castsi128_ps(out)) & 0xf;
+        const uint8_t* lanes = COMPACT.lanes[m];
+        for (int j = 0; j < 4; j++) sel[k + j] = (uint32_t)i + lanes[j];
+        k += (size_t)__builtin_popcount(m);
+    }
+    size_t tail = betweenScalar(v + i, n - i, lo, hi, sel + k);
+    for (size_t j = k; j < k + tail; j++) sel[j] += (uint32_t)i;
+    return k + tail;
+}
+
+__attribute__((target("avx2")))
+static size_t betweenAvx2(const int32_t* v, size_t n, int32_t lo, int32_t hi, uint32_t* sel) {
+    const __m256i vlo = _mm256_set1_epi32(lo), vhi = _mm256_set1_epi32(hi);
+    size_t k = 0, i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i x = _mm256_loadu_si256((const __m256i*)(v + i));
+        __m256i out = _mm256_or_si256(_mm256_cmpgt_epi32(vlo, x), _mm256_cmpgt_epi32(x, vhi));
+        unsigned m = ~(unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(out)) & 0xff;
+        __m256i lanes = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)COMPACT.lanes[m]));
+        _mm256_storeu_si256((__m256i*)(sel + k), _mm256_add_epi32(lanes, _mm256_set1_epi32((int32_t)i)));
+        k += (size_t)__builtin_popcount(m);
+    }
+    size_t tail = betweenScalar(v + i, n - i, lo, hi, sel + k);
+    for (size_t j = k; j < k + tail; j++) sel[j] += (uint32_t)i;
+    return k + tail;
+}
+
+#endif
+
+using BetweenFn = size_t (*)(const int32_t*, size_t, int32_t, int32_t, uint32_t*);
+
+struct Dispatch {
+    BetweenFn between = betweenScalar;
+    const char* name = "scalar";
+    Dispatch() {
+#ifdef TINYDB_X86_SIMD
+        between = betweenSse2;
+        name = "sse2";
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            between = betweenAvx2;
+            name = "avx2";
+        }
+#endif
+    }
+};
+
+static const Dispatch& dispatch() {
+    static const Dispatch d;
+    return d;
+}
+
+size_t Kernels::selectBetween(const int32_t* v, size_t n, int32_t lo, int32_t hi, uint32_t* sel) {
+    if (lo > hi) return 0;
+    return dispatch().between(v, n, lo, hi, sel);
+}
+
+size_t Kernels::refineBetween(const int32_t* v, uint32_t* sel, size_t n, int32_t lo, int32_t hi) {
+    if (lo > hi) return 0;
+    // gathers do not vectorise profitably at these widths; this stays branch-free
+    uint32_t span = (uint32_t)hi - (uint32_t)lo;
+    size_t k = 0;
+    for (size_t j = 0; j < n; j++) {
+        uint32_t i = sel[j];
+        sel[k] = i;
+        k += within(v[i], lo, span);
+    }
+    return k;
+}
+
+const char* Kernels::level() {
+    return dispatch().name;
+}
+
+}
@@ -0,0 +1,190 @@
+#include "Predicate.h"
+#include "ToastStore.h"
+#include <algorithm>
+#include <stdexcept>
+#include <string_view>
+
+namespace tinydb {
+
+static void flatten(const Predicate& p, std::vector<const Predicate*>& out) {
+    if (p.op != PredOp::AND) {
+        out.push_back(&p);
+        return;
+    }
+    for (auto& k : p.kids) flatten(k, out);
+}
+
+std::vector<const Predicate*> Predicate::conjuncts() const {
+    std::vector<const Predicate*> out;
+    flatten(*this, out);
+    return out;
+}
+
+static void tightenLo(ColumnRange& r, const KeyBound& b) {
+    if (r.hasLo) {
+        int c = RowCodec::compare(b.key, r.lo.key);
+        if (c < 0 || (c == 0 && b.inclusive)) return;
+    }
+    r.hasLo = true;
+    r.lo = b;
+}
+
+static void tightenHi(ColumnRange& r, const KeyBound& b) {
+    if (r.hasHi) {
+        int c = RowCodec::compare(b.key, r.hi.key);
+        if (c > 0 || (c == 0 && b.inclusive)) return;
+    }
+    r.hasHi = true;
+    r.hi = b;
+}
+
+bool asRange(const Predicate& p, const Schema& schema, ColumnRange& out) {
+    if (p.op == PredOp::AND) {
+        for (auto& k : p.kids) {
+            if (!asRange(k, schema, out)) return false;
+        }
+        return true;
+    }
+    if (p.op == PredOp::OR || p.op == PredOp::NOT) return false;
+    if (!out.col.empty() && out.col != p.col) return false;
+    int ci = schema.colIndex(p.col);
+    if (ci < 0) return false;
+    bool isInt = schema.columns[ci].type == ColType::INT32;
+    for (auto& v : p.values) {
+        if (std::holds_alternative<int32_t>(v) != isInt) return false;
+    }
+    switch (p.op) {
+    case PredOp::EQ: tightenLo(out, {p.values[0], true}); tightenHi(out, {p.values[0], true}); break;
+    case PredOp::LT: tightenHi(out, {p.values[0], false}); break;
+    case PredOp::LE: tightenHi(out, {p.values[0], true}); break;
+    case PredOp::GT: tightenLo(out, {p.values[0], false}); break;
+    case PredOp::GE: tightenLo(out, {p.values[0], true}); break;
+    case PredOp::BETWEEN: tightenLo(out, {p.values[0], true}); tightenHi(out, {p.values[1], true}); break;
+    default: return false;
+    }
+    out.col = p.col;
+    return true;
+}
+
+RowFilter::RowFilter(const Schema& s, const Predicate& where, ToastStore* t) : schema(s), toast(t) {
+    compile(where);
+}
+
+uint32_t RowFilter::compile(const Predicate& p) {
+    uint32_t at = (uint32_t)nodes.size();
+    nodes.emplace_back();
+    nodes[at].op = p.op;
+    if (p.op == PredOp::AND || p.op == PredOp::OR || p.op == PredOp::NOT) {
+        std::vector<uint32_t> kids;
+        for (auto& k : p.kids) kids.push_back(compile(k));
+        nodes[at].kids = std::move(kids);
+        return at;
+    }
+
+    Node& n = nodes[at];
+    n.col = schema.colIndex(p.col);
+    if (n.col < 0) throw std::runtime_error("column not found: " + p.col);
+    n.offset = RowCodec::fixedOffset(schema, n.col);
+    bool isInt = schema.columns[n.col].type == ColType::INT32;
+    for (auto& v : p.values) {
+        if (std::holds_alternative<int32_t>(v) == isInt) {
+            if (isInt) n.ints.push_back(std::get<int32_t>(v));
+            else n.texts.push_back(std::get<std::string>(v));
+            continue;
+        }
+        if (p.op != PredOp::EQ && p.op != PredOp::NE && p.op != PredOp::IN)
+            throw std::runtime_error(isInt ? "cannot compare INT32 with TEXT" : "cannot compare TEXT with INT32");
+        if (p.op != PredOp::IN) n.typed = false; // IN just drops it
+    }
+    if (p.op == PredOp::IN) {
+        std::sort(n.ints.begin(), n.ints.end());
+        std::sort(n.texts.begin(), n.texts.end());
+    }
+    return at;
+}
+
+bool RowFilter::matches(ByteSpan row) const { return eval(nodes[0], row); }
+
+bool RowFilter::test(const Node& n, int32_t v) const {
+    switch (n.op) {
+    case PredOp::EQ: return v == n.ints[0];
+    case PredOp::NE: return v != n.ints[0];
+    case PredOp::LT: return v < n.ints[0];
+    case PredOp::LE: return v <= n.ints[0];
+    case PredOp::GT: return v > n.ints[0];
+    case PredOp::GE: return v >= n.ints[0];
+    case PredOp::BETWEEN: return v >= n.ints[0] && v <= n.ints[1];
+    case PredOp::IN: return std::binary_search(n.ints.begin(), n.ints.end(), v);
+    default: return false;
+    }
+}
+
+bool RowFilter::test(const Node& n, const char* s, size_t len) const {
+    std::string_view v(s, len);
+    switch (n.op) {
+    case PredOp::EQ: return v == n.texts[0];
+    case PredOp::NE: return v != n.texts[0];
+    case PredOp::LT: return v < n.texts[0];
+    case PredOp::LE: return v <= n.texts[0];
+    case PredOp::GT: return v > n.texts[0];
+    case PredOp::GE: return v >= n.texts[0];
+    case PredOp::BETWEEN: return v >= n.texts[0] && v <= n.texts[1];
+    case PredOp::IN:
+        return std::binary_search(n.texts.begin(), n.texts.end(), v,
+                                  [](std::string_view a, std::string_view b) { return a < b; });
+    default: return false;
+    }
+}
+
+bool RowFilter::eval(const Node& n, ByteSpan row) const {
+    switch (n.op) {
+    case PredOp::AND:
+        for (uint32_t k : n.kids) {
+            if (!eval(nodes[k], row)) return false;
+        }
+        return true;
+    case PredOp::OR:
+        for (uint32_t k : n.kids) {
+            if (eval(nodes[k], row)) return true;
+        }
+        return false;
+    case PredOp::NOT: return !eval(nodes[n.kids[0]], row);
+    default: break;
+    }
+    if (!n.typed) return n.op == PredOp::NE;
+
+    size_t pos = n.offset;
+    if (!pos) {
+        pos = 4; // version
+        for (int i = 0; i < n.col; i++) {
+            if (schema.columns[i].type == ColType::INT32) {
+                pos += 4;
+                continue;
+            }
+            uint32_t len = pop_u32(row, pos);
+            pos += (len & RowCodec::TOAST_FLAG) ? RowCodec::TOAST_REF_SIZE - 4 : len;
+        }
+    }
+    if (schema.columns[n.col].type == ColType::INT32) return test(n, pop_i32(row, pos));
+
+    uint32_t len = pop_u32(row, pos);
+    if (!(len & RowCodec::TOAST_FLAG)) {
+        if (pos + len > row.size) throw std::runtime_error("decode TEXT overflow");
+        return test(n, (const char*)row.data + pos, len);
+    }
+    // out of line: a length no literal has settles equality without a fetch
+    len &= ~RowCodec::TOAST_FLAG;
+    if (n.op == PredOp::EQ || n.op == PredOp::NE || n.op == PredOp::IN) {
+        bool any = false;
+        for (auto& t : n.texts) any = any || t.size() == len;
+        if (!any) return n.op == PredOp::NE;
+    }
+    if (!toast) throw std::runtime_error("out-of-line value without a store");
+    ToastRef ref{len, 0, 0};
+    ref.pageId = pop_u32(row, pos);
+    ref.slotId = pop_u16(row, pos);
+    std::string v = toast->fetch(ref);
+    return test(n, v.data(), v.size());
+}
+
+}
@@ -0,0 +1,235 @@
+#include "ReadAhead.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#ifdef TINYDB_HAVE_IO_URING
+  #include <cerrno>
+  #include <linux/io_uring.h>
+  #include <sys/mman.h>
+  #include <sys/syscall.h>
+  #include <sys/uio.h>
+  #include <unistd.h>
+#endif
+
+namespace tinydb {
+
+static constexpr size_t READ_THREADS = 8;
+
+// shared by every scan; its tasks only read, so they never wait on each other
+static ThreadPool& readers(){
+    static ThreadPool pool(READ_THREADS);
+    return pool;
+}
+
+#ifdef TINYDB_HAVE_IO_URING
+
+// a submission and a completion queue shared with the kernel, driven through
+// the raw system calls. One scan is the only producer and consumer.
+struct ReadAhead::Ring {
+    int fd = -1;
+    uint8_t* sqMap = nullptr;
+    uint8_t* cqMap = nullptr;
+    size_t sqLen = 0, cqLen = 0, sqesLen = 0;
+    io_uring_sqe* sqes = nullptr;
+    unsigned *sqHead = nullptr, *sqTail = nullptr, *sqMask = nullptr, *sqArray = nullptr;
+    unsigned *cqHead = nullptr, *cqTail = nullptr, *cqMask = nullptr;
+    io_uring_cqe* cqes = nullptr;
+    unsigned sqEntries = 0;
+    std::vector<iovec> iov;
+    unsigned pending = 0;  // queued but not yet handed to the kernel
+    unsigned inflight = 0; // handed over, completion not yet seen
+
+    // false when the kernel (or a sandbox) refuses io_uring
+    bool open(unsigned entries){
+        io_uring_params p;
+        std::memset(&p, 0, sizeof(p));
+        fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+        if(fd < 0) return false;
+
+        sqLen = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        cqLen = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+        bool single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if(single) sqLen = cqLen = std::max(sqLen, cqLen);
+
+        void* sq = ::mmap(nullptr, sqLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        if(sq == MAP_FAILED) return false;
+        sqMap = (uint8_t*)sq;
+        if(single){
+            cqMap = sqMap;
+        } else {
+            void* cq = ::mmap(nullptr, cqLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+            if(cq == MAP_FAILED) return false;
+            cqMap = (uint8_t*)cq;
+        }
+        sqesLen = p.sq_entries * sizeof(io_uring_sqe);
+        void* e = ::mmap(nullptr, sqesLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+        if(e == MAP_FAILED) return false;
+        sqes = (io_uring_sqe*)e;
+
+        sqHead = (unsigned*)(sqMap + p.sq_off.head);
+        sqTail = (unsigned*)(sqMap + p.sq_off.tail);
+        sqMask = (unsigned*)(sqMap + p.sq_off.ring_mask);
+        sqArray = (unsigned*)(sqMap + p.sq_off.array);
+        cqHead = (unsigned*)(cqMap + p.cq_off.head);
+        cqTail = (unsigned*)(cqMap + p.cq_off.tail);
+        cqMask = (unsigned*)(cqMap + p.cq_off.ring_mask);
+        cqes = (io_uring_cqe*)(cqMap + p.cq_off.cqes);
+        sqEntries = p.sq_entries;
+        iov.resize(entries);
+        return true;
+    }
+
+    ~Ring(){
+        if(sqes) ::munmap(sqes, sqesLen);
+        if(cqMap && cqMap != sqMap) ::munmap(cqMap, cqLen);
+        if(sqMap) ::munmap(sqMap, sqLen);
+        if(fd >= 0) ::close(fd);
+    }
+
+    bool push(int file, long long offset, uint8_t* buf, uint32_t len, size_t slot){
+        unsigned tail = *sqTail;
+        if(tail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) >= sqEntries) return false;
+        unsigned idx = tail & *sqMask;
+        iov[slot].iov_base = buf;
+        iov[slot].iov_len = len;
+        io_uring_sqe& e = sqes[idx];
+        std::memset(&e, 0, sizeof(e));
+        e.opcode = IORING_OP_READV;
+        e.fd = file;
+        e.off = (uint64_t)offset;
+        e.addr = (uint64_t)(uintptr_t)&iov[slot];
+        e.len = 1;
+        e.user_data = slot;
+        sqArray[idx] = idx;
+        __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+        pending++;
+        inflight++;
+        return true;
+    }
+
+    // hands queued reads to the kernel; with `wait`, blocks until at least
+    // one completion is there
+    void enter(bool wait){
+        for(;;){
+            unsigned flags = wait ? IORING_ENTER_GETEVENTS : 0;
+            long n = syscall(__NR_io_uring_enter, fd, pending, wait ? 1 : 0, flags, nullptr, 0);
+            if(n < 0){
+                if(errno == EINTR) continue;
+                throw std::runtime_error("io_uring_enter failed");
+            }
+            pending -= std::min<unsigned>(pending, (unsigned)n);
+            return;
+        }
+    }
+
+    template<class Fn> void reap(Fn done){
+        unsigned head = *cqHead;
+        while(head != __atomic_load_n(cqTail, __ATOMIC_ACQUIRE)){
+            const io_uring_cqe& c = cqes[head & *cqMask];
+            done((size_t)c.user_data, c.res);
+            head++;
+            inflight--;
+        }
+        __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+    }
+};
+
+#else
+
+struct ReadAhead::Ring {};
+
+#endif
+
+ReadAhead::ReadAhead(DiskFile& f, uint32_t first, uint32_t e, uint32_t d, CachedFn c)
+    : file(f), end(e), depth(std::max<uint32_t>(1, std::min(d, e > first ? e - first : 1))),
+      pageBytes(f.pageSize()), cached(std::move(c)), nextIssue(first), firstPage(first) {
+    buffers.resize((size_t)depth * pageBytes);
+    slots.resize(depth);
+    for(size_t s = 0; s < depth && nextIssue < end; s++) issue(s);
+#ifdef TINYDB_HAVE_IO_URING
+    if(ring && ring->pending) ring->enter(false);
+#endif
+}
+
+ReadAhead::~ReadAhead(){
+    for(auto& s : slots){
+        if(s.read.valid()) s.read.wait();
+    }
+#ifdef TINYDB_HAVE_IO_URING
+    try {
+        while(ring && ring->inflight) {
+            ring->enter(true);
+            ring->reap([](size_t, int){});
+        }
+    } catch(...) {}
+#endif
+}
+
+void ReadAhead::issue(size_t slot){
+    Slot& s = slots[slot];
+    s.pageId = nextIssue++;
+    s.issued = s.done = false;
+    if(cached && cached(s.pageId)) return;
+#ifdef TINYDB_HAVE_IO_URING
+    // opened on the first page that needs a read; scans of resident pages never pay for it
+    if(!ringTried){
+        ringTried = true;
+        ring = std::make_unique<Ring>();
+        if(!ring->open(depth)) ring.reset();
+    }
+    if(ring){
+        int fd;
+        long long offset;
+        s.issued = file.locate(s.pageId, fd, offset) && ring->push(fd, offset, buffer(slot), pageBytes, slot);
+        return;
+    }
+#endif
+    uint8_t* buf = buffer(slot);
+    uint32_t pid = s.pageId;
+    s.read = readers().submit([this, pid, buf]{ file.readPage(pid, buf); });
+    s.issued = true;
+}
+
+void ReadAhead::wait(size_t slot){
+    Slot& s = slots[slot];
+#ifdef TINYDB_HAVE_IO_URING
+    if(ring){
+        while(!s.done){
+            ring->enter(true);
+            ring->reap([&](size_t done, int res){
+                slots[done].done = true;
+                slots[done].result = res;
+            });
+        }
+        // a short or failed read is redone the ordinary way
+        if(s.result != (int)pageBytes) file.readPage(s.pageId, buffer(slot));
+        return;
+    }
+#endif
+    s.read.get();
+    s.done = true;
+}
+
+const uint8_t* ReadAhead::next(uint32_t pageId){
+    // the buffer handed out last is free again and takes the next page
+    if(lastSlot >= 0){
+        if(nextIssue < end){
+            issue((size_t)lastSlot);
+#ifdef TINYDB_HAVE_IO_URING
+            if(ring && ring->pending) ring->enter(false);
+#endif
+        }
+        lastSlot = -1;
+    }
+    size_t slot = (pageId - firstPage) % depth;
+    Slot& s = slots[slot];
+    if(pageId >= end || s.pageId != pageId) return nullptr;
+    lastSlot = (int)slot;
+    if(!s.issued) return nullptr;
+    wait(slot);
+    return buffer(slot);
+}
+
+}
@@ -1,57 +1,207 @@
 #include "RowCodec.h"
 #include "ByteUtil.h"
+#include "ToastStore.h"
+#include <algorithm>
 #include <stdexcept>
 #include <sstream>
 
 namespace tinydb {
 
-std::vector<uint8_t> RowCodec::encode(const Schema& schema, const std::vector<Value>& values) {
+static void checkType(const Column& col, const Value& v) {
+    if (col.type == ColType::INT32) {
+        if (!std::holds_alternative<int32_t>(v))
+            throw std::runtime_error("type mismatch INT32 at " + col.name);
+    } else if (col.type == ColType::TEXT) {
+        if (!std::holds_alternative<std::string>(v))
+            throw std::runtime_error("type mismatch TEXT at " + col.name);
+        if (std::get<std::string>(v).size() >= RowCodec::TOAST_FLAG)
+            throw std::runtime_error("TEXT value too long at " + col.name);
+    } else {
+        throw std::runtime_error("Unknown column type");
+    }
+}
+
+static size_t encodedSize(const Value& v, bool outOfLine) {
+    if (std::holds_alternative<int32_t>(v)) return 4;
+    return outOfLine ? RowCodec::TOAST_REF_SIZE : 4 + std::get<std::string>(v).size();
+}
+
+static void appendValue(std::vector<uint8_t>& out, const Value& v, bool outOfLine, ToastStore* toast) {
+    if (std::holds_alternative<int32_t>(v)) {
+        append_i32(out, std::get<int32_t>(v));
+        return;
+    }
+    const std::string& s = std::get<std::string>(v);
+    if (outOfLine) {
+        ToastRef ref = toast->store(s);
+        append_u32(out, RowCodec::TOAST_FLAG | ref.length);
+        append_u32(out, ref.pageId);
+        append_u16(out, ref.slotId);
+        return;
+    }
+    append_u32(out, (uint32_t)s.size());
+    out.insert(out.end(), s.begin(), s.end());
+}
+
+// moves the largest inline TEXT value out of line; false when none is left
+// whose move would shrink the row
+static bool moveLargest(const std::vector<Value>& values, std::vector<bool>& outOfLine, size_t& size) {
+    int big = -1;
+    for (size_t i = 0; i < values.size(); i++) {
+        if (outOfLine[i] || !std::holds_alternative<std::string>(values[i])) continue;
+        if (encodedSize(values[i], false) <= RowCodec::TOAST_REF_SIZE) continue;
+        if (big < 0 || encodedSize(values[i], false) > encodedSize(values[big], false)) big = (int)i;
+    }
+    if (big < 0) return false;
+    size -= encodedSize(values[big], false) - RowCodec::TOAST_REF_SIZE;
+    outOfLine[big] = true;
+    return true;
+}
+
+std::vector<uint8_t> RowCodec::encode(const Schema& schema, const std::vector<Value>& values, ToastStore* toast) {
     if (values.size() != schema.columns.size()) {
         throw std::runtime_error("values count mismatch schema");
     }
 
+    std::vector<bool> outOfLine(values.size(), false);
+    size_t size = 4;
+    for (size_t i = 0; i < values.size(); i++) {
+        checkType(schema.columns[i], values[i]);
+        outOfLine[i] = toast && encodedSize(values[i], false) > 4 + toast->threshold();
+        size += encodedSize(values[i], outOfLine[i]);
+    }
+    while (toast && size > toast->rowLimit() && moveLargest(values, outOfLine, size)) {}
+
     std::vector<uint8_t> out;
+    out.reserve(size);
     append_u32(out, 1); // row version
+    for (size_t i = 0; i < values.size(); i++) appendValue(out, values[i], outOfLine[i], toast);
+    return out;
+}
 
-    for (size_t i = 0; i < schema.columns.size(); i++) {
-        auto& col = schema.columns[i];
-
-        if (col.type == ColType::INT32) {
-            if (!std::holds_alternative<int32_t>(values[i]))
-                throw std::runtime_error("type mismatch INT32 at " + col.name);
-            append_i32(out, std::get<int32_t>(values[i]));
-        } else if (col.type == ColType::TEXT) {
-            if (!std::holds_alternative<std::string>(values[i]))
-                throw std::runtime_error("type mismatch TEXT at " + col.name);
-            auto s = std::get<std::string>(values[i]);
-            append_u32(out, (uint32_t)s.size());
-            out.insert(out.end(), s.begin(), s.end());
-        } else {
-            throw std::runtime_error("Unknown column type");
-        }
+static Value readValue(const Column& col, ByteSpan bytes, size_t& pos, ToastStore* toast) {
+    if (col.type == ColType::INT32) return pop_i32(bytes, pos);
+
+    uint32_t len = pop_u32(bytes, pos);
+    if (len & RowCodec::TOAST_FLAG) {
+        ToastRef ref{len & ~RowCodec::TOAST_FLAG, 0, 0};
+        ref.pageId = pop_u32(bytes, pos);
+        ref.slotId = pop_u16(bytes, pos);
+        if (!toast) throw std::runtime_error("out-of-line value without a store");
+        return toast->fetch(ref);
     }
-    return out;
+    if (pos + len > bytes.size) throw std::runtime_error("decode TEXT overflow");
+    std::string s((const char*)bytes.data + pos, len);
+    pos += len;
+    return s;
 }
 
-std::vector<Value> RowCodec::decode(const Schema& schema, const std::vector<uint8_t>& bytes) {
+// position just past the value starting at `pos`
+static size_t skipValue(const Column& col, ByteSpan bytes, size_t pos) {
+    if (col.type == ColType::INT32) return pos + 4;
+    uint32_t len = pop_u32(bytes, pos);
+    pos += (len & RowCodec::TOAST_FLAG) ? RowCodec::TOAST_REF_SIZE - 4 : len;
+    if (pos > bytes.size) throw std::runtime_error("decode TEXT overflow");
+    return pos;
+}
+
+std::vector<Value> RowCodec::decode(const Schema& schema, ByteSpan bytes, ToastStore* toast) {
     std::vector<Value> out;
+    out.reserve(schema.columns.size());
     size_t pos = 0;
     (void)pop_u32(bytes, pos); // version
 
-    for (auto& col : schema.columns) {
-        if (col.type == ColType::INT32) {
-            out.push_back(pop_i32(bytes, pos));
-        } else if (col.type == ColType::TEXT) {
-            uint32_t len = pop_u32(bytes, pos);
-            if (pos + len > bytes.size()) throw std::runtime_error("decode TEXT overflow");
-            std::string s(bytes.begin() + pos, bytes.begin() + pos + len);
-            pos += len;
-            out.push_back(s);
+    for (auto& col : schema.columns) out.push_back(readValue(col, bytes, pos, toast));
+    return out;
+}
+
+Value RowCodec::decodeColumn(const Schema& schema, ByteSpan bytes, int col, ToastStore* toast) {
+    size_t pos = 4; // version
+    for (int i = 0; i < col; i++) pos = skipValue(schema.columns[i], bytes, pos);
+    return readValue(schema.columns[col], bytes, pos, toast);
+}
+
+std::vector<Value> RowCodec::decodeColumns(const Schema& schema, ByteSpan bytes, const std::vector<int>& cols,
+                                           ToastStore* toast) {
+    std::vector<Value> out(cols.size());
+    int last = -1;
+    for (int c : cols) last = std::max(last, c);
+    size_t pos = 4; // version
+    for (int i = 0; i <= last; i++) {
+        size_t first = cols.size();
+        for (size_t k = 0; k < cols.size(); k++) {
+            if (cols[k] != i) continue;
+            if (first == cols.size()) {
+                first = k;
+                out[k] = readValue(schema.columns[i], bytes, pos, toast);
+            } else {
+                out[k] = out[first];
+            }
         }
+        if (first == cols.size()) pos = skipValue(schema.columns[i], bytes, pos);
     }
     return out;
 }
 
+std::string RowCodec::columnKey(const Schema& schema, ByteSpan bytes, int col, ToastStore* toast) {
+    size_t pos = 4; // version
+    for (int i = 0; i < col; i++) pos = skipValue(schema.columns[i], bytes, pos);
+    if (schema.columns[col].type == ColType::INT32) return std::to_string(pop_i32(bytes, pos));
+    return std::get<std::string>(readValue(schema.columns[col], bytes, pos, toast));
+}
+
+size_t RowCodec::fixedOffset(const Schema& schema, int col) {
+    size_t pos = 4; // version
+    for (int i = 0; i < col; i++) {
+        if (schema.columns[i].type != ColType::INT32) return 0;
+        pos += 4;
+    }
+    return pos;
+}
+
+std::vector<uint8_t> RowCodec::replaceColumn(const Schema& schema, ByteSpan bytes, int col, const Value& v,
+                                             ToastStore* toast) {
+    checkType(schema.columns[col], v);
+    size_t from = 4;
+    for (int i = 0; i < col; i++) from = skipValue(schema.columns[i], bytes, from);
+    size_t to = skipValue(schema.columns[col], bytes, from);
+
+    std::vector<bool> outOfLine{toast && encodedSize(v, false) > 4 + toast->threshold()};
+    size_t size = bytes.size - (to - from) + encodedSize(v, outOfLine[0]);
+    while (toast && size > toast->rowLimit() && moveLargest({v}, outOfLine, size)) {}
+
+    std::vector<uint8_t> out(bytes.begin(), bytes.begin() + from);
+    out.reserve(size);
+    appendValue(out, v, outOfLine[0], toast);
+    out.insert(out.end(), bytes.begin() + to, bytes.end());
+    return out;
+}
+
+std::vector<ToastRef> RowCodec::toastRefs(const Schema& schema, ByteSpan bytes, int col) {
+    std::vector<ToastRef> refs;
+    size_t pos = 4; // version
+    for (int i = 0; i < (int)schema.columns.size(); i++) {
+        size_t at = pos;
+        pos = skipValue(schema.columns[i], bytes, pos);
+        if (schema.columns[i].type != ColType::TEXT || (col >= 0 && i != col)) continue;
+        uint32_t len = pop_u32(bytes, at);
+        if (!(len & TOAST_FLAG)) continue;
+        ToastRef ref{len & ~TOAST_FLAG, 0, 0};
+        ref.pageId = pop_u32(bytes, at);
+        ref.slotId = pop_u16(bytes, at);
+        refs.push_back(ref);
+    }
+    return refs;
+}
+
+void RowCodec::setToastRef(const Schema& schema, std::vector<uint8_t>& bytes, int col, const ToastRef& ref) {
+    size_t pos = 4; // version
+    for (int i = 0; i < col; i++) pos = skipValue(schema.columns[i], ByteSpan(bytes), pos);
+    if (!(read_u32(&bytes[pos]) & TOAST_FLAG)) throw std::runtime_error("Column is stored inline");
+    write_u32(&bytes[pos + 4], ref.pageId);
+    write_u16(&bytes[pos + 8], ref.slotId);
+}
+
 std::string RowCodec::toString(const Schema& schema, const std::vector<Value>& values) {
     std::ostringstream oss;
     oss << "{ ";
@@ -70,4 +220,16 @@ std::string RowCodec::valueToKey(const Value& v){
     return std::get<std::string>(v);
 }
 
+int RowCodec::compare(const Value& a, const Value& b){
+    if(std::holds_alternative<int32_t>(a) && std::holds_alternative<int32_t>(b)){
+        int32_t x = std::get<int32_t>(a), y = std::get<int32_t>(b);
+        return x < y ? -1 : (x > y ? 1 : 0);
+    }
+    if(std::holds_alternative<std::string>(a) && std::holds_alternative<std::string>(b)){
+        int c = std::get<std::string>(a).compare(std::get<std::string>(b));
+        return c < 0 ? -1 : (c > 0 ? 1 : 0);
+    }
+    throw std::runtime_error("cannot compare INT32 with TEXT");
+}
+
 }
@@ -1,25 +1,30 @@
 #include "SQLParser.h"
 #include "ByteUtil.h"
+#include <cctype>
 #include <sstream>
 #include <stdexcept>
 
 namespace tinydb {
 
 bool SQLParser::isCreateTable(const std::string& sql){ return upper(trim(sql)).rfind("CREATE TABLE",0)==0; }
+bool SQLParser::isCreateIndex(const std::string& sql){ return upper(trim(sql)).rfind("CREATE INDEX",0)==0; }
+bool SQLParser::isDropIndex(const std::string& sql){ return upper(trim(sql)).rfind("DROP INDEX",0)==0; }
+bool SQLParser::isVacuum(const std::string& sql){ return upper(trim(sql)).rfind("VACUUM",0)==0; }
 bool SQLParser::isInsert(const std::string& sql){ return upper(trim(sql)).rfind("INSERT INTO",0)==0; }
 bool SQLParser::isSelectAll(const std::string& sql){ 
     auto u = upper(trim(sql));
     return u.rfind("SELECT * FROM",0)==0 && u.find("WHERE")==std::string::npos && u.find("JOIN")==std::string::npos;
 }
-bool SQLParser::isSelectWhereEq(const std::string& sql){
+bool SQLParser::isSelectWhere(const std::string& sql){
     auto u = upper(trim(sql));
-    return u.rfind("SELECT * FROM",0)==0 && u.find("WHERE")!=std::string::npos;
+    if(u.rfind("SELECT * FROM",0)!=0 || u.find("JOIN")!=std::string::npos) return false;
+    return u.find("WHERE")!=std::string::npos || u.find("ORDER BY")!=std::string::npos;
 }
-bool SQLParser::isUpdateWhereEq(const std::string& sql){
+bool SQLParser::isUpdateWhere(const std::string& sql){
     auto u = upper(trim(sql));
     return u.rfind("UPDATE",0)==0 && u.find("SET")!=std::string::npos && u.find("WHERE")!=std::string::npos;
 }
-bool SQLParser::isDeleteWhereEq(const std::string& sql){
+bool SQLParser::isDeleteWhere(const std::string& sql){
     auto u = upper(trim(sql));
     return u.rfind("DELETE FROM",0)==0 && u.find("WHERE")!=std::string::npos;
 }
@@ -27,6 +32,17 @@ bool SQLParser::isJoinEq(const std::string& sql){
     auto u = upper(trim(sql));
     return u.rfind("SELECT * FROM",0)==0 && u.find("JOIN")!=std::string::npos && u.find("ON")!=std::string::npos;
 }
+bool SQLParser::isSelectColumns(const std::string& sql){
+    auto u = upper(trim(sql));
+    if(u.rfind("SELECT ",0)!=0 || u.rfind("SELECT * FROM",0)==0) return false;
+    size_t fromPos = u.find(" FROM ");
+    if(fromPos==std::string::npos || u.find(" GROUP BY ")!=std::string::npos) return false;
+    return u.find('(')>fromPos;
+}
+bool SQLParser::isSelectAggregate(const std::string& sql){
+    auto u = upper(trim(sql));
+    return u.rfind("SELECT ",0)==0 && u.rfind("SELECT * FROM",0)!=0 && u.find(" FROM ")!=std::string::npos;
+}
 
 CreateTableStmt SQLParser::parseCreateTable(const std::string& sql){
     std::string s = trim(sql);
@@ -63,6 +79,54 @@ CreateTableStmt SQLParser::parseCreateTable(const std::string& sql){
     return CreateTableStmt{schema};
 }
 
+CreateIndexStmt SQLParser::parseCreateIndex(const std::string& sql){
+    std::string s = trim(sql);
+    if(!s.empty() && s.back()==';') s.pop_back();
+    auto up = upper(s);
+    if(up.rfind("CREATE INDEX",0)!=0) throw std::runtime_error("Not CREATE INDEX");
+
+    size_t onPos = up.find(" ON ");
+    if(onPos==std::string::npos) throw std::runtime_error("CREATE INDEX needs ON");
+    size_t open = s.find('(', onPos);
+    size_t close = s.find(')', onPos);
+    if(open==std::string::npos || close==std::string::npos || close<open) throw std::runtime_error("CREATE INDEX needs table(col)");
+
+    IndexDef def;
+    def.name = trim(s.substr(std::string("CREATE INDEX").size(), onPos-std::string("CREATE INDEX").size()));
+    def.table = trim(s.substr(onPos+4, open-(onPos+4)));
+    def.col = trim(s.substr(open+1, close-open-1));
+    if(def.name.empty() || def.table.empty() || def.col.empty()) throw std::runtime_error("CREATE INDEX needs name ON table(col)");
+
+    std::string tail = upper(trim(s.substr(close+1)));
+    if(tail=="USING BTREE") def.kind = IndexKind::BTREE;
+    else if(tail.empty() || tail=="USING HASH") def.kind = IndexKind::HASH;
+    else throw std::runtime_error("USING must be HASH or BTREE");
+    return CreateIndexStmt{def};
+}
+
+DropIndexStmt SQLParser::parseDropIndex(const std::string& sql){
+    std::string s = trim(sql);
+    if(!s.empty() && s.back()==';') s.pop_back();
+    if(upper(s).rfind("DROP INDEX",0)!=0) throw std::runtime_error("Not DROP INDEX");
+    std::string name = trim(s.substr(std::string("DROP INDEX").size()));
+    if(name.empty()) throw std::runtime_error("DROP INDEX needs a name");
+    return DropIndexStmt{name};
+}
+
+VacuumStmt SQLParser::parseVacuum(const std::string& sql){
+    std::string s = trim(sql);
+    if(!s.empty() && s.back()==';') s.pop_back();
+    if(upper(s).rfind("VACUUM",0)!=0) throw std::runtime_error("Not VACUUM");
+    VacuumStmt stmt;
+    stmt.table = trim(s.substr(std::string("VACUUM").size()));
+    if(upper(stmt.table).rfind("FULL ",0)==0){
+        stmt.full = true;
+        stmt.table = trim(stmt.table.substr(5));
+    }
+    if(stmt.table.empty()) throw std::runtime_error("VACUUM needs a table name");
+    return stmt;
+}
+
 InsertStmt SQLParser::parseInsert(const std::string& sql){
     std::string s = trim(sql);
     if(!s.empty() && s.back()==';') s.pop_back();
@@ -113,37 +177,230 @@ SelectAllStmt SQLParser::parseSelectAll(const std::string& sql){
     return SelectAllStmt{table};
 }
 
-static WhereEq parseWhereEqPart(const std::string& right){
-    size_t eq = right.find('=');
-    if(eq==std::string::npos) throw std::runtime_error("WHERE must have =");
-    std::string col = trim(right.substr(0, eq));
-    std::string valRaw = trim(right.substr(eq+1));
+static Value parseLiteral(const std::string& raw){
+    std::string valRaw = trim(raw);
+    if(valRaw.size()>=2 && valRaw.front()=='"' && valRaw.back()=='"'){
+        return valRaw.substr(1, valRaw.size()-2);
+    }
+    return (int32_t)std::stoi(valRaw);
+}
+
+// col = literal, as in SET
+static std::pair<std::string, Value> parseAssignment(const std::string& part){
+    size_t eq = part.find('=');
+    if(eq==std::string::npos) throw std::runtime_error("SET must have =");
+    return {trim(part.substr(0, eq)), parseLiteral(part.substr(eq+1))};
+}
+
+namespace {
+
+struct Token {
+    enum Kind { Word, Number, Text, Symbol, End } kind;
+    std::string text;
+};
+
+// recursive descent over the tokens of a WHERE condition
+class WhereParser {
+public:
+    explicit WhereParser(const std::string& cond){ lex(cond); }
+
+    Predicate parse(){
+        Predicate p = orExpr();
+        if(toks[at].kind!=Token::End) throw std::runtime_error("unexpected " + toks[at].text + " in WHERE");
+        return p;
+    }
+
+private:
+    std::vector<Token> toks;
+    size_t at = 0;
+
+    void lex(const std::string& s){
+        size_t i = 0;
+        while(i < s.size()){
+            char c = s[i];
+            if(std::isspace((unsigned char)c)){ i++; continue; }
+            if(c=='"'){
+                size_t close = s.find('"', i+1);
+                if(close==std::string::npos) throw std::runtime_error("unterminated string in WHERE");
+                toks.push_back({Token::Text, s.substr(i+1, close-i-1)});
+                i = close+1;
+            } else if(std::isdigit((unsigned char)c) || (c=='-' && i+1<s.size() && std::isdigit((unsigned char)s[i+1]))){
+                size_t j = i+1;
+                while(j<s.size() && std::isdigit((unsigned char)s[j])) j++;
+                toks.push_back({Token::Number, s.substr(i, j-i)});
+                i = j;
+            } else if(std::isalpha((unsigned char)c) || c=='_'){
+                size_t j = i+1;
+                while(j<s.size() && (std::isalnum((unsigned char)s[j]) || s[j]=='_' || s[j]=='.')) j++;
+                toks.push_back({Token::Word, s.substr(i, j-i)});
+                i = j;
+            } else {
+                std::string two = s.substr(i, 2);
+                size_t n = (two=="<=" || two==">=" || two=="<>" || two=="!=") ? 2 : 1;
+                if(n==1 && std::string("=<>(),").find(c)==std::string::npos)
+                    throw std::runtime_error(std::string("unexpected ") + c + " in WHERE");
+                toks.push_back({Token::Symbol, s.substr(i, n)});
+                i += n;
+            }
+        }
+        toks.push_back({Token::End, "end of WHERE"});
+    }
+
+    bool keyword(const char* kw){
+        if(toks[at].kind!=Token::Word || upper(toks[at].text)!=kw) return false;
+        at++;
+        return true;
+    }
+    bool symbol(const char* sym){
+        if(toks[at].kind!=Token::Symbol || toks[at].text!=sym) return false;
+        at++;
+        return true;
+    }
+    void expect(const char* sym){
+        if(!symbol(sym)) throw std::runtime_error(std::string("expected ") + sym + " in WHERE");
+    }
+
+    Predicate orExpr(){
+        Predicate p = andExpr();
+        if(toks[at].kind!=Token::Word || upper(toks[at].text)!="OR") return p;
+        Predicate any;
+        any.op = PredOp::OR;
+        any.kids.push_back(std::move(p));
+        while(keyword("OR")) any.kids.push_back(andExpr());
+        return any;
+    }
+
+    Predicate andExpr(){
+        Predicate p = notExpr();
+        if(toks[at].kind!=Token::Word || upper(toks[at].text)!="AND") return p;
+        Predicate all;
+        all.op = PredOp::AND;
+        all.kids.push_back(std::move(p));
+        while(keyword("AND")) all.kids.push_back(notExpr());
+        return all;
+    }
 
-    Value v;
-    if(!valRaw.empty() && valRaw.front()=='"' && valRaw.back()=='"'){
-        v = valRaw.substr(1, valRaw.size()-2);
-    } else {
-        v = (int32_t)std::stoi(valRaw);
+    Predicate notExpr(){
+        if(keyword("NOT")) return negate(notExpr());
+        if(symbol("(")){
+            Predicate p = orExpr();
+            expect(")");
+            return p;
+        }
+        return comparison();
     }
-    return WhereEq{col, v};
+
+    static Predicate negate(Predicate p){
+        Predicate n;
+        n.op = PredOp::NOT;
+        n.kids.push_back(std::move(p));
+        return n;
+    }
+
+    Value literal(){
+        const Token& t = toks[at];
+        if(t.kind==Token::Number){ at++; return (int32_t)std::stoi(t.text); }
+        if(t.kind==Token::Text){ at++; return t.text; }
+        throw std::runtime_error("expected a value in WHERE, got " + t.text);
+    }
+
+    Predicate comparison(){
+        static const char* reserved[] = {"AND", "OR", "NOT", "BETWEEN", "IN"};
+        if(toks[at].kind!=Token::Word) throw std::runtime_error("expected a column in WHERE, got " + toks[at].text);
+        for(const char* r : reserved){
+            if(upper(toks[at].text)==r) throw std::runtime_error(std::string("expected a column in WHERE, got ") + r);
+        }
+        Predicate p;
+        p.col = toks[at++].text;
+
+        bool negated = keyword("NOT");
+        if(keyword("BETWEEN")){
+            p.op = PredOp::BETWEEN;
+            p.values.push_back(literal());
+            if(!keyword("AND")) throw std::runtime_error("BETWEEN needs AND");
+            p.values.push_back(literal());
+        } else if(keyword("IN")){
+            p.op = PredOp::IN;
+            expect("(");
+            do p.values.push_back(literal()); while(symbol(","));
+            expect(")");
+        } else {
+            if(negated) throw std::runtime_error("NOT must precede BETWEEN or IN here");
+            static const std::pair<const char*, PredOp> ops[] = {
+                {"=", PredOp::EQ}, {"!=", PredOp::NE}, {"<>", PredOp::NE}, {"<", PredOp::LT},
+                {"<=", PredOp::LE}, {">", PredOp::GT}, {">=", PredOp::GE}};
+            bool found = false;
+            for(auto& o : ops){
+                if(symbol(o.first)){ p.op = o.second; found = true; break; }
+            }
+            if(!found) throw std::runtime_error("WHERE needs =, !=, <, <=, >, >=, BETWEEN or IN after " + p.col);
+            p.values.push_back(literal());
+        }
+        return negated ? negate(std::move(p)) : p;
+    }
+};
+
 }
 
-SelectWhereStmt SQLParser::parseSelectWhereEq(const std::string& sql){
-    std::string s=trim(sql);
-    if(!s.empty() && s.back()==';') s.pop_back();
+Predicate SQLParser::parseWhere(const std::string& cond){
+    return WhereParser(cond).parse();
+}
+
+// what follows FROM in a row SELECT: t [WHERE <predicate>] [ORDER BY col [ASC|DESC]]
+static void parseSelectFrom(std::string s, SelectWhereStmt& stmt){
     auto up=upper(s);
-    if(up.rfind("SELECT * FROM",0)!=0) throw std::runtime_error("Not SELECT");
+    size_t orderPos = up.find("ORDER BY");
+    if(orderPos!=std::string::npos){
+        std::stringstream os(s.substr(orderPos+8));
+        std::string dir;
+        os >> stmt.orderCol >> dir;
+        if(stmt.orderCol.empty()) throw std::runtime_error("ORDER BY needs a column");
+        dir = upper(dir);
+        if(dir=="DESC") stmt.desc = true;
+        else if(!dir.empty() && dir!="ASC") throw std::runtime_error("ORDER BY takes ASC or DESC");
+        s = trim(s.substr(0, orderPos));
+        up = upper(s);
+    }
 
     size_t wherePos = up.find("WHERE");
-    if(wherePos==std::string::npos) throw std::runtime_error("Missing WHERE");
-    std::string left = trim(s.substr(0, wherePos));
-    std::string right = trim(s.substr(wherePos + 5));
+    stmt.table = trim(s.substr(0, wherePos));
+    if(wherePos==std::string::npos) return;
+
+    stmt.hasWhere = true;
+    stmt.where = SQLParser::parseWhere(s.substr(wherePos+5));
+}
+
+SelectWhereStmt SQLParser::parseSelectWhere(const std::string& sql){
+    std::string s=trim(sql);
+    if(!s.empty() && s.back()==';') s.pop_back();
+    if(upper(s).rfind("SELECT * FROM",0)!=0) throw std::runtime_error("Not SELECT");
 
-    std::string table = trim(left.substr(std::string("SELECT * FROM").size()));
-    return SelectWhereStmt{table, parseWhereEqPart(right)};
+    SelectWhereStmt stmt;
+    parseSelectFrom(s.substr(std::string("SELECT * FROM").size()), stmt);
+    return stmt;
 }
 
-UpdateWhereStmt SQLParser::parseUpdateWhereEq(const std::string& sql){
+SelectWhereStmt SQLParser::parseSelectColumns(const std::string& sql){
+    std::string s=trim(sql);
+    if(!s.empty() && s.back()==';') s.pop_back();
+    auto up=upper(s);
+    if(up.rfind("SELECT ",0)!=0) throw std::runtime_error("Not SELECT");
+    size_t fromPos = up.find(" FROM ");
+    if(fromPos==std::string::npos) throw std::runtime_error("SELECT needs FROM");
+
+    SelectWhereStmt stmt;
+    std::stringstream cols(s.substr(7, fromPos-7));
+    std::string col;
+    while(std::getline(cols, col, ',')){
+        col = trim(col);
+        if(col.empty()) throw std::runtime_error("empty select item");
+        stmt.cols.push_back(col);
+    }
+    parseSelectFrom(s.substr(fromPos+6), stmt);
+    return stmt;
+}
+
+UpdateWhereStmt SQLParser::parseUpdateWhere(const std::string& sql){
     std::string s=trim(sql);
     if(!s.empty() && s.back()==';') s.pop_back();
     auto up=upper(s);
@@ -153,16 +410,12 @@ UpdateWhereStmt SQLParser::parseUpdateWhereEq(const std::string& sql){
     size_t wherePos = up.find("WHERE");
     if(setPos==std::string::npos || wherePos==std::string::npos) throw std::runtime_error("UPDATE needs SET + WHERE");
     std::string table = trim(s.substr(std::string("UPDATE").size(), setPos-std::string("UPDATE").size()));
-    std::string setPart = trim(s.substr(setPos+3, wherePos-(setPos+3)));
-    std::string wherePart = trim(s.substr(wherePos+5));
-
-    auto setEq = parseWhereEqPart(setPart);
-    auto whereEq = parseWhereEqPart(wherePart);
+    auto set = parseAssignment(trim(s.substr(setPos+3, wherePos-(setPos+3))));
 
-    return UpdateWhereStmt{table, setEq.col, setEq.value, whereEq};
+    return UpdateWhereStmt{table, set.first, set.second, parseWhere(s.substr(wherePos+5))};
 }
 
-DeleteWhereStmt SQLParser::parseDeleteWhereEq(const std::string& sql){
+DeleteWhereStmt SQLParser::parseDeleteWhere(const std::string& sql){
     std::string s=trim(sql);
     if(!s.empty() && s.back()==';') s.pop_back();
     auto up=upper(s);
@@ -171,8 +424,63 @@ DeleteWhereStmt SQLParser::parseDeleteWhereEq(const std::string& sql){
     size_t wherePos = up.find("WHERE");
     if(wherePos==std::string::npos) throw std::runtime_error("DELETE needs WHERE");
     std::string table = trim(s.substr(std::string("DELETE FROM").size(), wherePos-std::string("DELETE FROM").size()));
-    std::string wherePart = trim(s.substr(wherePos+5));
-    return DeleteWhereStmt{table, parseWhereEqPart(wherePart)};
+    return DeleteWhereStmt{table, parseWhere(s.substr(wherePos+5))};
+}
+
+static SelectItem parseSelectItem(const std::string& raw){
+    std::string item = trim(raw);
+    if(item.empty()) throw std::runtime_error("empty select item");
+    size_t open = item.find('(');
+    if(open==std::string::npos) return SelectItem{AggFunc::NONE, item, item};
+    if(item.back()!=')') throw std::runtime_error("missing ) in " + item);
+
+    std::string fn = upper(trim(item.substr(0, open)));
+    std::string arg = trim(item.substr(open+1, item.size()-open-2));
+    SelectItem out{AggFunc::NONE, arg, fn + "(" + arg + ")"};
+    if(fn=="COUNT") out.func = AggFunc::COUNT;
+    else if(fn=="SUM") out.func = AggFunc::SUM;
+    else if(fn=="MIN") out.func = AggFunc::MIN;
+    else if(fn=="MAX") out.func = AggFunc::MAX;
+    else if(fn=="AVG") out.func = AggFunc::AVG;
+    else throw std::runtime_error("unknown function " + fn);
+    if(arg=="*"){
+        if(out.func!=AggFunc::COUNT) throw std::runtime_error(fn + "(*) is not supported");
+        out.col.clear();
+    }
+    if(arg.empty()) throw std::runtime_error(fn + " needs a column");
+    return out;
+}
+
+SelectAggStmt SQLParser::parseSelectAggregate(const std::string& sql){
+    std::string s=trim(sql);
+    if(!s.empty() && s.back()==';') s.pop_back();
+    auto up=upper(s);
+    if(up.rfind("SELECT ",0)!=0) throw std::runtime_error("Not SELECT");
+
+    SelectAggStmt stmt;
+    size_t groupPos = up.find(" GROUP BY ");
+    if(groupPos!=std::string::npos){
+        stmt.groupCol = trim(s.substr(groupPos+10));
+        if(stmt.groupCol.empty()) throw std::runtime_error("GROUP BY needs a column");
+        s = trim(s.substr(0, groupPos));
+        up = upper(s);
+    }
+
+    size_t fromPos = up.find(" FROM ");
+    if(fromPos==std::string::npos) throw std::runtime_error("SELECT needs FROM");
+    std::stringstream items(s.substr(7, fromPos-7));
+    std::string item;
+    while(std::getline(items, item, ',')) stmt.items.push_back(parseSelectItem(item));
+
+    size_t wherePos = up.find(" WHERE ", fromPos);
+    size_t tableEnd = wherePos==std::string::npos ? s.size() : wherePos;
+    stmt.table = trim(s.substr(fromPos+6, tableEnd-(fromPos+6)));
+    if(stmt.table.empty()) throw std::runtime_error("SELECT needs a table");
+    if(wherePos!=std::string::npos){
+        stmt.hasWhere = true;
+        stmt.where = parseWhere(s.substr(wherePos+7));
+    }
+    return stmt;
 }
 
 JoinStmt SQLParser::parseJoinEq(const std::string& sql){
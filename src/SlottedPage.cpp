@@ -1,113 +1,326 @@
 #include "SlottedPage.h"
 #include "ByteUtil.h"
+#include <algorithm>
 #include <stdexcept>
 #include <cstring>
+#include <utility>
 
 namespace tinydb {
 
-static constexpr uint16_t HEADER_SIZE = 6;
-static constexpr uint16_t SLOT_ENTRY_SIZE = 4;
+// header: slotCount | freeStart | freeEnd | deadBytes | pageLSN u64
+// slot entry: offset | length, whose top two bits hold the SlotKind
+// The first four header fields and both slot fields are u16 on pages up to
+// 16 KB and u32 on larger ones. Rows are packed down from the end of the
+// page; deadBytes counts the bytes of deleted or shrunk rows still sitting
+// between live ones.
+static constexpr uint32_t NARROW_PAGE_LIMIT = 16384;
 
-SlottedPage::SlottedPage() {
-    data.assign(PAGE_SIZE, 0);
-    setSlotCount(0);
-    setFreeStart(HEADER_SIZE);
-    setFreeEnd(PAGE_SIZE);
+static bool wideLayout(uint32_t pageSize) { return pageSize > NARROW_PAGE_LIMIT; }
+static uint32_t fieldWidth(bool wide) { return wide ? 4 : 2; }
+static uint32_t headerSize(bool wide) { return 4 * fieldWidth(wide) + 8; }
+static uint32_t slotEntrySize(bool wide) { return 2 * fieldWidth(wide); }
+static uint32_t lenMask(bool wide) { return wide ? 0x3FFFFFFFu : 0x3FFFu; }
+static int kindShift(bool wide) { return wide ? 30 : 14; }
+
+static uint32_t slotEntryAt(bool wide, uint16_t slotId) {
+    return headerSize(wide) + slotId * slotEntrySize(wide);
+}
+
+static uint32_t getField(const uint8_t* p, bool wide) {
+    return wide ? read_u32(p) : read_u16(p);
+}
+
+static void putField(uint8_t* p, bool wide, uint32_t v) {
+    if(wide) write_u32(p, v);
+    else write_u16(p, (uint16_t)v);
+}
+
+uint16_t PageView::slotCount() const { return (uint16_t)getField(data, wideLayout(size)); }
+
+uint64_t PageView::pageLSN() const {
+    uint64_t v; std::memcpy(&v, data + 4 * fieldWidth(wideLayout(size)), 8); return v;
+}
+
+ByteSpan PageView::record(uint16_t slotId) const {
+    if(slotId>=slotCount()) return {};
+    bool wide = wideLayout(size);
+    uint32_t entry = slotEntryAt(wide, slotId);
+    uint32_t len = getField(data + entry + fieldWidth(wide), wide) & lenMask(wide);
+    if(len==0) return {};
+    uint32_t off = getField(data + entry, wide);
+    if(off+len > size) return {};
+    return ByteSpan(data + off, len);
+}
+
+SlotKind PageView::kind(uint16_t slotId) const {
+    if(slotId>=slotCount()) return SlotKind::Row;
+    bool wide = wideLayout(size);
+    uint32_t entry = slotEntryAt(wide, slotId);
+    return (SlotKind)(getField(data + entry + fieldWidth(wide), wide) >> kindShift(wide));
+}
+
+uint16_t PageView::liveRows() const {
+    uint16_t n = 0, sc = slotCount();
+    for(uint16_t sid = 0; sid < sc; sid++){
+        if(kind(sid) != SlotKind::Moved && !record(sid).empty()) n++;
+    }
+    return n;
+}
+
+ByteSpan PageView::read(uint16_t slotId) const {
+    ByteSpan rec = record(slotId);
+    switch(kind(slotId)){
+    case SlotKind::Row: return rec;
+    case SlotKind::Moved:
+        if(rec.size <= SlottedPage::LINK_SIZE) return {};
+        return ByteSpan(rec.data + SlottedPage::LINK_SIZE, rec.size - SlottedPage::LINK_SIZE);
+    default: return {};
+    }
+}
+
+RowId PageView::link(uint16_t slotId) const {
+    return SlottedPage::linkOf(record(slotId));
+}
+
+SlottedPage::SlottedPage(uint32_t pageSize) : owned(pageSize, 0), data(owned.data()), size(pageSize) {
+    format(data, size);
+}
+
+SlottedPage::SlottedPage(uint8_t* frame, uint32_t pageSize) : data(frame), size(pageSize) {}
+
+SlottedPage::SlottedPage(const SlottedPage& o) : owned(o.owned), size(o.size) {
+    data = owned.empty() ? o.data : owned.data();
+}
+
+SlottedPage& SlottedPage::operator=(const SlottedPage& o) {
+    if(this != &o){
+        owned = o.owned;
+        data = owned.empty() ? o.data : owned.data();
+        size = o.size;
+    }
+    return *this;
+}
+
+void SlottedPage::format(uint8_t* page, uint32_t pageSize) {
+    bool wide = wideLayout(pageSize);
+    uint32_t w = fieldWidth(wide);
+    std::memset(page, 0, pageSize);
+    putField(&page[0], wide, 0);
+    putField(&page[w], wide, headerSize(wide));
+    putField(&page[2 * w], wide, pageSize);
+}
+
+uint32_t SlottedPage::maxRowSize(uint32_t pageSize) {
+    bool wide = wideLayout(pageSize);
+    return pageSize - headerSize(wide) - slotEntrySize(wide);
+}
+
+std::vector<uint8_t> SlottedPage::linkRecord(const RowId& rid, ByteSpan row) {
+    std::vector<uint8_t> rec(LINK_SIZE + row.size);
+    write_u32(&rec[0], rid.pageId);
+    write_u16(&rec[4], rid.slotId);
+    if(!row.empty()) std::memcpy(&rec[LINK_SIZE], row.data, row.size);
+    return rec;
+}
+
+RowId SlottedPage::linkOf(ByteSpan rec) {
+    if(rec.size < LINK_SIZE) throw std::runtime_error("Record holds no link");
+    return RowId{read_u32(rec.data), read_u16(rec.data + 4)};
 }
 
 void SlottedPage::loadFromBytes(const std::vector<uint8_t>& bytes) {
-    if(bytes.size()!=PAGE_SIZE) throw std::runtime_error("Invalid page size");
-    data = bytes;
+    if(bytes.size()!=size) throw std::runtime_error("Invalid page size");
+    loadFromBytes(bytes.data());
+}
+
+void SlottedPage::loadFromBytes(const uint8_t* bytes) {
+    if(owned.empty()) std::memcpy(data, bytes, size);
+    else { owned.assign(bytes, bytes + size); data = owned.data(); }
 }
 
-std::vector<uint8_t> SlottedPage::toBytes() const { return data; }
+std::vector<uint8_t> SlottedPage::toBytes() const { return std::vector<uint8_t>(data, data + size); }
+
+void SlottedPage::writeTo(uint8_t* out) const {
+    std::memcpy(out, data, size);
+}
 
-uint16_t SlottedPage::getSlotCount() const { return read_u16(&data[0]); }
-uint16_t SlottedPage::getFreeStart() const { return read_u16(&data[2]); }
-uint16_t SlottedPage::getFreeEnd() const { return read_u16(&data[4]); }
+uint32_t SlottedPage::field(uint32_t pos) const { return getField(&data[pos], wideLayout(size)); }
+void SlottedPage::setField(uint32_t pos, uint32_t v) { putField(&data[pos], wideLayout(size), v); }
 
-void SlottedPage::setSlotCount(uint16_t v){ write_u16(&data[0], v); }
-void SlottedPage::setFreeStart(uint16_t v){ write_u16(&data[2], v); }
-void SlottedPage::setFreeEnd(uint16_t v){ write_u16(&data[4], v); }
+uint32_t SlottedPage::getSlotCount() const { return field(0); }
+uint32_t SlottedPage::getFreeStart() const { return field(fieldWidth(wideLayout(size))); }
+uint32_t SlottedPage::getFreeEnd() const { return field(2 * fieldWidth(wideLayout(size))); }
+uint32_t SlottedPage::deadBytes() const { return field(3 * fieldWidth(wideLayout(size))); }
+
+void SlottedPage::setSlotCount(uint32_t v){ setField(0, v); }
+void SlottedPage::setFreeStart(uint32_t v){ setField(fieldWidth(wideLayout(size)), v); }
+void SlottedPage::setFreeEnd(uint32_t v){ setField(2 * fieldWidth(wideLayout(size)), v); }
+void SlottedPage::setDeadBytes(uint32_t v){ setField(3 * fieldWidth(wideLayout(size)), v); }
 
 uint32_t SlottedPage::slotEntryOffset(uint16_t slotId) const {
-    return HEADER_SIZE + slotId * SLOT_ENTRY_SIZE;
+    return slotEntryAt(wideLayout(size), slotId);
 }
-uint16_t SlottedPage::getSlotOffset(uint16_t slotId) const {
-    return read_u16(&data[slotEntryOffset(slotId)]);
+uint32_t SlottedPage::getSlotOffset(uint16_t slotId) const {
+    return field(slotEntryOffset(slotId));
 }
-uint16_t SlottedPage::getSlotLength(uint16_t slotId) const {
-    return read_u16(&data[slotEntryOffset(slotId)+2]);
+uint32_t SlottedPage::getSlotLength(uint16_t slotId) const {
+    bool wide = wideLayout(size);
+    return field(slotEntryOffset(slotId) + fieldWidth(wide)) & lenMask(wide);
 }
-void SlottedPage::setSlotOffset(uint16_t slotId, uint16_t off){
-    write_u16(&data[slotEntryOffset(slotId)], off);
+void SlottedPage::setSlotOffset(uint16_t slotId, uint32_t off){
+    setField(slotEntryOffset(slotId), off);
 }
-void SlottedPage::setSlotLength(uint16_t slotId, uint16_t len){
-    write_u16(&data[slotEntryOffset(slotId)+2], len);
+void SlottedPage::setSlotLength(uint16_t slotId, uint32_t len, SlotKind kind){
+    bool wide = wideLayout(size);
+    setField(slotEntryOffset(slotId) + fieldWidth(wide), len | ((uint32_t)kind << kindShift(wide)));
 }
 
-uint16_t SlottedPage::slotCount() const { return getSlotCount(); }
+uint16_t SlottedPage::slotCount() const { return (uint16_t)getSlotCount(); }
 
-int SlottedPage::insert(const std::vector<uint8_t>& row) {
-    uint16_t rowLen = (uint16_t)row.size();
-    if(rowLen==0) return -1;
+bool SlottedPage::formatted() const { return getFreeStart() >= headerSize(wideLayout(size)); }
 
-    uint16_t sc = getSlotCount();
-    uint16_t fs = getFreeStart();
-    uint16_t fe = getFreeEnd();
+uint64_t SlottedPage::pageLSN() const { return PageView(data, size).pageLSN(); }
 
-    uint16_t need = SLOT_ENTRY_SIZE + rowLen;
-    if(fe < fs || (fe-fs) < need) return -1;
+void SlottedPage::setPageLSN(uint64_t lsn) { std::memcpy(&data[4 * fieldWidth(wideLayout(size))], &lsn, 8); }
 
-    uint16_t rowOff = (uint16_t)(fe - rowLen);
-    std::memcpy(&data[rowOff], row.data(), rowLen);
+uint32_t SlottedPage::freeSpace() const {
+    uint32_t fs = getFreeStart();
+    uint32_t avail = getFreeEnd() + deadBytes();
+    uint32_t entry = slotEntrySize(wideLayout(size));
+    if(avail < fs + entry) return 0;
+    return avail - fs - entry;
+}
 
-    setSlotOffset(sc, rowOff);
-    setSlotLength(sc, rowLen);
+void SlottedPage::compact() {
+    uint16_t sc = slotCount();
+    std::vector<std::pair<uint32_t, uint16_t>> live; // (offset, slot)
+    for(uint16_t s = 0; s < sc; s++){
+        if(getSlotLength(s) != 0) live.emplace_back(getSlotOffset(s), s);
+    }
+    // highest row first, so each move only ever goes up past space already vacated
+    std::sort(live.begin(), live.end(), [](const std::pair<uint32_t, uint16_t>& a, const std::pair<uint32_t, uint16_t>& b){
+        return a.first > b.first;
+    });
 
-    setSlotCount(sc+1);
-    setFreeStart(fs + SLOT_ENTRY_SIZE);
-    setFreeEnd(rowOff);
+    uint32_t end = size;
+    for(auto& r : live){
+        uint32_t len = getSlotLength(r.second);
+        end -= len;
+        if(end != r.first) std::memmove(&data[end], &data[r.first], len);
+        setSlotOffset(r.second, end);
+    }
+    setFreeEnd(end);
+    setDeadBytes(0);
+}
+
+int SlottedPage::insert(const std::vector<uint8_t>& rec, SlotKind kind) {
+    uint16_t sc = slotCount();
+    uint16_t sid = 0;
+    while(sid < sc && getSlotLength(sid) != 0) sid++;
+    return insertAt(sid, rec, kind) ? sid : -1;
+}
+
+bool SlottedPage::insertAt(uint16_t slotId, const std::vector<uint8_t>& rec, SlotKind kind) {
+    bool wide = wideLayout(size);
+    if(rec.empty() || rec.size() > lenMask(wide)) return false;
+    uint32_t rowLen = (uint32_t)rec.size();
+
+    uint16_t sc = slotCount();
+    if(slotId < sc && getSlotLength(slotId)!=0) return false;
+
+    uint32_t fs = getFreeStart();
+    uint32_t fe = getFreeEnd();
+
+    uint32_t newSlots = slotId >= sc ? (uint32_t)(slotId - sc + 1) : 0;
+    uint32_t need = newSlots * slotEntrySize(wide) + rowLen;
+    if(fe < fs || fe - fs < need){
+        if(fe < fs || fe - fs + deadBytes() < need) return false;
+        compact();
+        fe = getFreeEnd();
+    }
 
-    return sc;
+    // slots skipped over (only during redo) start out deleted
+    for(uint16_t s = sc; s < slotId; s++){ setSlotOffset(s, 0); setSlotLength(s, 0); }
+
+    uint32_t rowOff = fe - rowLen;
+    std::memcpy(&data[rowOff], rec.data(), rowLen);
+
+    setSlotOffset(slotId, rowOff);
+    setSlotLength(slotId, rowLen, kind);
+
+    if(newSlots){
+        setSlotCount((uint32_t)slotId + 1);
+        setFreeStart(fs + newSlots * slotEntrySize(wide));
+    }
+    setFreeEnd(rowOff);
+    return true;
 }
 
 std::vector<uint8_t> SlottedPage::read(uint16_t slotId) const {
-    uint16_t sc = getSlotCount();
-    if(slotId>=sc) return {};
-    uint16_t len = getSlotLength(slotId);
-    if(len==0) return {};
-    uint16_t off = getSlotOffset(slotId);
-    if(off+len > PAGE_SIZE) return {};
-    std::vector<uint8_t> out(len);
-    std::memcpy(out.data(), &data[off], len);
-    return out;
+    return view(slotId).toVector();
+}
+
+ByteSpan SlottedPage::view(uint16_t slotId) const {
+    return PageView(data, size).read(slotId);
 }
 
-bool SlottedPage::update(uint16_t slotId, const std::vector<uint8_t>& newRow) {
-    uint16_t sc = getSlotCount();
+bool SlottedPage::update(uint16_t slotId, const std::vector<uint8_t>& rec, SlotKind kind) {
+    uint16_t sc = slotCount();
     if(slotId>=sc) return false;
-    uint16_t oldLen = getSlotLength(slotId);
-    if(oldLen==0) return false;
+    uint32_t oldLen = getSlotLength(slotId);
+    if(oldLen==0 || rec.empty() || rec.size() > lenMask(wideLayout(size))) return false;
 
-    uint16_t oldOff = getSlotOffset(slotId);
-    uint16_t newLen = (uint16_t)newRow.size();
+    uint32_t oldOff = getSlotOffset(slotId);
+    uint32_t newLen = (uint32_t)rec.size();
 
     if(newLen <= oldLen){
-        std::memcpy(&data[oldOff], newRow.data(), newLen);
-        setSlotLength(slotId, newLen);
+        std::memcpy(&data[oldOff], rec.data(), newLen);
+        setSlotLength(slotId, newLen, kind);
+        setDeadBytes(deadBytes() + oldLen - newLen);
         return true;
     }
-    return false;
+
+    // the old bytes are given up first, so they count towards the room
+    uint32_t fs = getFreeStart();
+    uint32_t fe = getFreeEnd();
+    if(fe - fs + deadBytes() + oldLen < newLen) return false;
+    if(oldOff == fe) fe += oldLen;
+    else setDeadBytes(deadBytes() + oldLen);
+    setFreeEnd(fe);
+    setSlotOffset(slotId, 0);
+    setSlotLength(slotId, 0);
+    if(fe - fs < newLen){
+        compact();
+        fe = getFreeEnd();
+    }
+
+    uint32_t off = fe - newLen;
+    std::memcpy(&data[off], rec.data(), newLen);
+    setSlotOffset(slotId, off);
+    setSlotLength(slotId, newLen, kind);
+    setFreeEnd(off);
+    return true;
 }
 
 bool SlottedPage::remove(uint16_t slotId) {
-    uint16_t sc = getSlotCount();
+    uint16_t sc = slotCount();
     if(slotId>=sc) return false;
-    uint16_t len = getSlotLength(slotId);
+    uint32_t len = getSlotLength(slotId);
     if(len==0) return false;
+
+    // the lowest row just widens the free gap; any other leaves a hole
+    uint32_t off = getSlotOffset(slotId);
+    if(off == getFreeEnd()) setFreeEnd(off + len);
+    else setDeadBytes(deadBytes() + len);
     setSlotLength(slotId, 0);
     setSlotOffset(slotId, 0);
+
+    // trailing free slots give their entries back; redo recreates them if needed
+    while(sc > 0 && getSlotLength((uint16_t)(sc - 1)) == 0) sc--;
+    if(sc != slotCount()){
+        setSlotCount(sc);
+        setFreeStart(headerSize(wideLayout(size)) + sc * slotEntrySize(wideLayout(size)));
+    }
     return true;
 }
 
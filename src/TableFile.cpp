@@ -1,84 +1,332 @@
 #include "TableFile.h"
 #include "Constants.h"
-#include <filesystem>
-#include <fstream>
 #include <stdexcept>
 
 namespace tinydb {
 
-TableFile::TableFile(const std::string& p) : path(p) { ensureExists(); }
-
-void TableFile::ensureExists() const {
-    if(!std::filesystem::exists(path)){
-        std::ofstream out(path, std::ios::binary);
-        out.close();
+TableFile::TableFile(BufferPool& bp, const std::string& p, FreeSpaceMap& fm)
+    : pool(bp), file(bp.openFile(p)), fsm(fm), pageBytes(bp.pageSize()) {
+    // pages written before the map existed (or lost in a crash) are measured once
+    for(uint32_t pid = fsm.coveredPages(); pid < pageCount(); pid++){
+        auto g = pinPage(pid);
+        fsm.update(pid, SlottedPage(g.data(), pageBytes).freeSpace());
     }
 }
 
+uint32_t TableFile::pageSize() const {
+    return pageBytes;
+}
+
 uint32_t TableFile::pageCount() const {
-    std::ifstream in(path, std::ios::binary | std::ios::ate);
-    auto size = in.tellg();
-    if(size < 0) return 0;
-    return (uint32_t)(size / PAGE_SIZE);
+    return file.pageCount();
 }
 
-std::vector<uint8_t> TableFile::readPageRaw(uint32_t pageId){
-    std::ifstream in(path, std::ios::binary);
-    std::vector<uint8_t> buf(PAGE_SIZE, 0);
-    in.seekg((std::streamoff)pageId * PAGE_SIZE, std::ios::beg);
-    in.read((char*)buf.data(), PAGE_SIZE);
-    if(in.gcount()!=PAGE_SIZE){
-        SlottedPage p; return p.toBytes();
-    }
-    return buf;
+PageGuard TableFile::pinPage(uint32_t pageId){
+    return pool.fetch(file, pageId);
 }
 
-void TableFile::writePageRaw(uint32_t pageId, const std::vector<uint8_t>& bytes){
-    std::fstream f(path, std::ios::in|std::ios::out|std::ios::binary);
-    if(!f.is_open()) throw std::runtime_error("Cannot open file for write");
-    f.seekp((std::streamoff)pageId * PAGE_SIZE, std::ios::beg);
-    f.write((const char*)bytes.data(), PAGE_SIZE);
-    f.flush();
+PageGuard TableFile::readPage(uint32_t pageId){
+    return pool.fetchRead(file, pageId);
 }
 
-RowId TableFile::insertRow(const std::vector<uint8_t>& row){
-    uint32_t n = pageCount();
-    for(uint32_t pid=0; pid<n; pid++){
-        SlottedPage p;
-        p.loadFromBytes(readPageRaw(pid));
-        int sid = p.insert(row);
+void TableFile::enableMmap(){
+    file.enableMmap();
+}
+
+void TableFile::adviseAccess(AccessHint hint){
+    if(file.mmapEnabled()) file.advise(hint);
+}
+
+std::unique_ptr<ReadAhead> TableFile::readAhead(uint32_t first, uint32_t end){
+    if(readAheadPages == 0 || file.mmapEnabled() || end <= first + 1) return nullptr;
+    BufferPool& bp = pool;
+    DiskFile& f = file;
+    // resident pages may be newer than the disk; the pool serves those
+    return std::make_unique<ReadAhead>(file, first, end, readAheadPages,
+                                       [&bp, &f](uint32_t pid){ return bp.resident(f, pid); });
+}
+
+std::vector<uint8_t> TableFile::readPageRaw(uint32_t pageId){
+    auto g = readPage(pageId);
+    return std::vector<uint8_t>(g.data(), g.data() + pageBytes);
+}
+
+
+RowId TableFile::place(const std::vector<uint8_t>& rec, SlotKind kind, uint32_t below){
+    // a stale bucket only costs one extra probe: the page is re-measured and skipped
+    for(uint32_t pid = fsm.findPage((uint32_t)rec.size(), below); pid != FreeSpaceMap::NO_PAGE;
+        pid = fsm.findPage((uint32_t)rec.size(), below)){
+        auto g = pinPage(pid);
+        SlottedPage p(g.data(), pageBytes);
+        int sid = p.insert(rec, kind);
+        fsm.update(pid, p.freeSpace());
         if(sid!=-1){
-            writePageRaw(pid, p.toBytes());
+            if(wal) p.setPageLSN(wal->logInsert(logName, pid, (uint16_t)sid, rec, (uint8_t)kind));
+            g.markDirty();
             return RowId{pid,(uint16_t)sid};
         }
     }
-    SlottedPage np;
-    int sid=np.insert(row);
-    if(sid==-1) throw std::runtime_error("Row too large");
-    writePageRaw(n, np.toBytes());
-    return RowId{n,(uint16_t)sid};
+    if(below != FreeSpaceMap::NO_PAGE) return RowId{FreeSpaceMap::NO_PAGE, 0};
+    if(rec.size() > SlottedPage::maxRowSize(pageBytes)) throw std::runtime_error("Row too large");
+    uint32_t pid;
+    auto g = pool.allocate(file, pid);
+    SlottedPage::format(g.data(), pageBytes);
+    SlottedPage p(g.data(), pageBytes);
+    int sid=p.insert(rec, kind);
+    if(wal) p.setPageLSN(wal->logInsert(logName, pid, (uint16_t)sid, rec, (uint8_t)kind));
+    fsm.update(pid, p.freeSpace());
+    return RowId{pid,(uint16_t)sid};
+}
+
+bool TableFile::rewrite(PageGuard& g, const RowId& rid, const std::vector<uint8_t>& rec, SlotKind kind){
+    SlottedPage p(g.data(), pageBytes);
+    if(!p.update(rid.slotId, rec, kind)) return false;
+    if(wal) p.setPageLSN(wal->logUpdate(logName, rid.pageId, rid.slotId, rec, (uint8_t)kind));
+    g.markDirty();
+    fsm.update(rid.pageId, p.freeSpace());
+    return true;
+}
+
+void TableFile::erase(PageGuard& g, const RowId& rid){
+    SlottedPage p(g.data(), pageBytes);
+    if(!p.remove(rid.slotId)) return;
+    if(wal) p.setPageLSN(wal->logDelete(logName, rid.pageId, rid.slotId));
+    g.markDirty();
+    fsm.update(rid.pageId, p.freeSpace());
+}
+
+RowId TableFile::settle(PageGuard& home, const RowId& rid){
+    RowId at = PageView(home.data(), pageBytes).link(rid.slotId);
+    auto g = pinPage(at.pageId);
+    // dropping the home RowId only shrinks the record, so this always fits
+    rewrite(g, at, PageView(g.data(), pageBytes).read(at.slotId).toVector(), SlotKind::Row);
+    erase(home, rid);
+    return at;
+}
+
+RowId TableFile::insertRow(const std::vector<uint8_t>& row, uint32_t below){
+    return place(row, SlotKind::Row, below);
 }
 
 std::vector<uint8_t> TableFile::readRow(const RowId& rid){
-    SlottedPage p;
-    p.loadFromBytes(readPageRaw(rid.pageId));
-    return p.read(rid.slotId);
+    auto g = readPage(rid.pageId);
+    PageView v(g.data(), pageBytes);
+    switch(v.kind(rid.slotId)){
+    case SlotKind::Row:
+        return v.read(rid.slotId).toVector();
+    case SlotKind::Forward: {
+        if(v.record(rid.slotId).empty()) return {};
+        RowId at = v.link(rid.slotId);
+        auto t = readPage(at.pageId);
+        return PageView(t.data(), pageBytes).read(at.slotId).toVector();
+    }
+    default:
+        return {}; // a moved row is only reached through its home
+    }
 }
 
 bool TableFile::updateRow(const RowId& rid, const std::vector<uint8_t>& newRow){
-    SlottedPage p;
-    p.loadFromBytes(readPageRaw(rid.pageId));
-    bool ok=p.update(rid.slotId,newRow);
-    if(ok) writePageRaw(rid.pageId,p.toBytes());
-    return ok;
+    auto g = pinPage(rid.pageId);
+    PageView v(g.data(), pageBytes);
+    ByteSpan old = v.record(rid.slotId);
+    if(old.empty()) return false;
+
+    switch(v.kind(rid.slotId)){
+    case SlotKind::Row: {
+        if(rewrite(g, rid, newRow, SlotKind::Row)) return true;
+        // the stub must fit where the row was
+        if(old.size < SlottedPage::LINK_SIZE && SlottedPage(g.data(), pageBytes).freeSpace() < SlottedPage::LINK_SIZE) return false;
+        auto rec = SlottedPage::linkRecord(rid, newRow);
+        if(rec.size() > SlottedPage::maxRowSize(pageBytes)) return false;
+        RowId to = place(rec, SlotKind::Moved);
+        if(!rewrite(g, rid, SlottedPage::linkRecord(to), SlotKind::Forward)){
+            auto t = pinPage(to.pageId);
+            erase(t, to);
+            return false;
+        }
+        return true;
+    }
+    case SlotKind::Forward: {
+        RowId at = v.link(rid.slotId);
+        // back home when the page has room again, else in place at the moved
+        // row, else somewhere new; the stub is re-pointed before the old copy goes
+        if(rewrite(g, rid, newRow, SlotKind::Row)){
+            auto t = pinPage(at.pageId);
+            erase(t, at);
+            return true;
+        }
+        auto rec = SlottedPage::linkRecord(rid, newRow);
+        {
+            auto t = pinPage(at.pageId);
+            if(rewrite(t, at, rec, SlotKind::Moved)) return true;
+        }
+        if(rec.size() > SlottedPage::maxRowSize(pageBytes)) return false;
+        RowId to = place(rec, SlotKind::Moved);
+        if(!rewrite(g, rid, SlottedPage::linkRecord(to), SlotKind::Forward)){
+            auto t = pinPage(to.pageId);
+            erase(t, to);
+            return false;
+        }
+        auto t = pinPage(at.pageId);
+        erase(t, at);
+        return true;
+    }
+    default:
+        return false;
+    }
 }
 
 bool TableFile::deleteRow(const RowId& rid){
-    SlottedPage p;
-    p.loadFromBytes(readPageRaw(rid.pageId));
-    bool ok=p.remove(rid.slotId);
-    if(ok) writePageRaw(rid.pageId,p.toBytes());
-    return ok;
+    auto g = pinPage(rid.pageId);
+    PageView v(g.data(), pageBytes);
+    if(v.record(rid.slotId).empty()) return false;
+    SlotKind kind = v.kind(rid.slotId);
+    if(kind==SlotKind::Moved) return false;
+    if(kind==SlotKind::Forward){
+        RowId at = v.link(rid.slotId);
+        auto t = pinPage(at.pageId);
+        erase(t, at);
+    }
+    erase(g, rid);
+    return true;
+}
+
+uint32_t TableFile::compact(){
+    uint32_t n = pageCount();
+    uint32_t end = 0;
+    for(uint32_t pid = 0; pid < n; pid++){
+        auto g = pinPage(pid);
+        SlottedPage p(g.data(), pageBytes);
+        if(!p.formatted()) continue;
+        if(p.slotCount() != 0) end = pid + 1;
+        if(p.deadBytes() == 0) continue;
+        // only row positions change; slot ids and the logged state stay valid
+        p.compact();
+        g.markDirty();
+        fsm.update(pid, p.freeSpace());
+    }
+    return end;
+}
+
+uint32_t TableFile::vacuum(const MovedFn& moved, bool collapse){
+    uint32_t n = pageCount();
+    compact();
+
+    // a moved row whose home no longer points at it was left by a crash
+    auto orphaned = [&](const RowId& rid, const RowId& home){
+        auto h = pinPage(home.pageId);
+        PageView hv(h.data(), pageBytes);
+        if(hv.record(home.slotId).empty() || hv.kind(home.slotId)!=SlotKind::Forward) return true;
+        RowId at = hv.link(home.slotId);
+        return at.pageId!=rid.pageId || at.slotId!=rid.slotId;
+    };
+
+    if(collapse){
+        for(uint32_t pid = 0; pid < n; pid++){
+            auto g = pinPage(pid);
+            for(uint16_t s = 0; s < PageView(g.data(), pageBytes).slotCount(); s++){
+                PageView v(g.data(), pageBytes);
+                if(v.record(s).empty()) continue;
+                RowId rid{pid, s};
+                if(v.kind(s)==SlotKind::Moved){
+                    if(orphaned(rid, v.link(s))) erase(g, rid);
+                    continue;
+                }
+                if(v.kind(s)!=SlotKind::Forward) continue;
+
+                RowId at = v.link(s);
+                auto t = pinPage(at.pageId);
+                std::vector<uint8_t> row = PageView(t.data(), pageBytes).read(at.slotId).toVector();
+                if(rewrite(g, rid, row, SlotKind::Row)){
+                    erase(t, at);
+                    continue;
+                }
+                t.release();
+                moved(rid, settle(g, rid), row);
+            }
+        }
+    }
+
+    uint32_t end = n;
+    while(end > 0){
+        uint32_t pid = end - 1;
+        auto src = pinPage(pid);
+        for(uint16_t s = 0; s < PageView(src.data(), pageBytes).slotCount(); s++){
+            PageView v(src.data(), pageBytes);
+            if(v.record(s).empty()) continue;
+            RowId rid{pid, s};
+
+            switch(v.kind(s)){
+            case SlotKind::Forward: {
+                // the home itself has to go, so the moved row stays where it is
+                std::vector<uint8_t> row = readRow(rid);
+                moved(rid, settle(src, rid), row);
+                break;
+            }
+            case SlotKind::Moved: {
+                RowId home = v.link(s);
+                if(orphaned(rid, home)){
+                    erase(src, rid);
+                    break;
+                }
+                RowId to = place(v.record(s).toVector(), SlotKind::Moved, pid);
+                if(to.pageId == FreeSpaceMap::NO_PAGE) return end;
+                auto h = pinPage(home.pageId);
+                rewrite(h, home, SlottedPage::linkRecord(to), SlotKind::Forward);
+                erase(src, rid);
+                break;
+            }
+            default: {
+                std::vector<uint8_t> row = v.read(s).toVector();
+                RowId to = place(row, SlotKind::Row, pid);
+                if(to.pageId == FreeSpaceMap::NO_PAGE) return end;
+                erase(src, rid);
+                moved(rid, to, row);
+                break;
+            }
+            }
+        }
+        // a settled row may have landed on this page behind the loop
+        if(PageView(src.data(), pageBytes).slotCount() != 0) return end;
+        end = pid;
+    }
+    return end;
+}
+
+void TableFile::truncate(uint32_t pages){
+    // the map goes first: a page it no longer lists is simply measured again
+    fsm.truncate(pages);
+    pool.truncateFile(file, pages);
+}
+
+void TableFile::attachLog(WAL& w, const std::string& table){
+    wal = &w;
+    logName = table;
+}
+
+bool TableFile::redo(const LogRecord& rec){
+    // the page may never have reached disk before the crash
+    file.ensurePageCount(rec.page + 1);
+    auto g = pinPage(rec.page);
+    SlottedPage p(g.data(), pageBytes);
+    if(!p.formatted()) SlottedPage::format(g.data(), pageBytes);
+    if(p.pageLSN() >= rec.lsn) return false;
+
+    switch(rec.op){
+    case OP_INSERT:
+        p.insertAt(rec.slot, rec.bytes, (SlotKind)rec.kind);
+        break;
+    case OP_UPDATE:
+        p.update(rec.slot, rec.bytes, (SlotKind)rec.kind);
+        break;
+    case OP_DELETE:
+        p.remove(rec.slot);
+        break;
+    }
+    p.setPageLSN(rec.lsn);
+    g.markDirty();
+    fsm.update(rec.page, p.freeSpace());
+    return true;
 }
 
 }
@@ -1,25 +1,156 @@
 #include "TableScanner.h"
+#include "Predicate.h"
 #include "SlottedPage.h"
+#include <algorithm>
+#include <cstring>
+#include <mutex>
 
 namespace tinydb {
 
-TableScanner::TableScanner(TableFile& t) : table(t) {}
+ScanCursor::ScanCursor(TableFile& t, uint32_t first, uint32_t end, std::shared_mutex* w, bool seq)
+    : table(t), pageSize(t.pageSize()), pageId(first), endPage(end), writers(w), sequential(seq),
+      copy(w ? t.pageSize() : 0) {
+    if (sequential) table.adviseAccess(AccessHint::Sequential);
+    // with writers about, only pages read under their lock can be trusted
+    if (!writers) ahead = table.readAhead(first, end);
+}
+
+ScanCursor::~ScanCursor() {
+    guard.release();
+    if (sequential) table.adviseAccess(AccessHint::Random);
+}
+
+bool ScanCursor::load() {
+    guard.release();
+    page = nullptr;
+    if (pageId >= endPage) return false;
+    if (writers) {
+        std::shared_lock<std::shared_mutex> lk(*writers);
+        auto g = table.readPage(pageId);
+        std::memcpy(copy.data(), g.data(), pageSize);
+        page = copy.data();
+    } else {
+        page = ahead ? ahead->next(pageId) : nullptr;
+        if (!page) {
+            guard = table.readPage(pageId);
+            page = guard.data();
+        }
+    }
+    slotId = 0;
+    slotCount = PageView(page, pageSize).slotCount();
+    return true;
+}
 
-std::vector<ScanRow> TableScanner::scanAll() {
-    std::vector<ScanRow> out;
-    uint32_t pages = table.pageCount();
-
-    for (uint32_t pid = 0; pid < pages; pid++) {
-        SlottedPage p;
-        p.loadFromBytes(table.readPageRaw(pid));
-        uint16_t sc = p.slotCount();
-        for (uint16_t sid = 0; sid < sc; sid++) {
-            auto bytes = p.read(sid);
-            if (bytes.empty()) continue;
-            out.push_back(ScanRow{RowId{pid, sid}, bytes});
+const ScanRow* ScanCursor::next() {
+    for (;;) {
+        if (!page && !load()) return nullptr;
+        PageView view(page, pageSize);
+        while (slotId < slotCount) {
+            uint16_t sid = slotId++;
+            SlotKind kind = view.kind(sid);
+            if (kind == SlotKind::Moved) continue;
+            if (kind == SlotKind::Row) {
+                ByteSpan bytes = view.read(sid);
+                if (bytes.empty() || (filter && !filter->matches(bytes))) continue;
+                row = ScanRow{RowId{pageId, sid}, bytes};
+                return &row;
+            }
+            if (view.record(sid).empty()) continue;
+            RowId at = view.link(sid);
+            {
+                std::shared_lock<std::shared_mutex> lk;
+                if (writers) lk = std::shared_lock<std::shared_mutex>(*writers);
+                auto g = table.readPage(at.pageId);
+                moved = PageView(g.data(), pageSize).read(at.slotId).toVector();
+            }
+            if (moved.empty() || (filter && !filter->matches(ByteSpan(moved)))) continue;
+            row = ScanRow{RowId{pageId, sid}, ByteSpan(moved)};
+            return &row;
         }
+        page = nullptr;
+        pageId++;
+    }
+}
+
+uint64_t ScanCursor::countRest() {
+    uint64_t n = 0;
+    if (filter) {
+        while (next()) n++;
+        return n;
+    }
+    if (page) {
+        PageView view(page, pageSize);
+        for (; slotId < slotCount; slotId++) {
+            if (view.kind(slotId) != SlotKind::Moved && !view.record(slotId).empty()) n++;
+        }
+        page = nullptr;
+        pageId++;
+    }
+    while (load()) {
+        n += PageView(page, pageSize).liveRows();
+        pageId++;
+    }
+    page = nullptr;
+    return n;
+}
+
+TableScanner::TableScanner(TableFile& t) : table(t) {}
+
+ScanCursor TableScanner::scan() {
+    return ScanCursor(table, 0, table.pageCount(), nullptr, true);
+}
+
+ScanCursor TableScanner::scan(uint32_t first, uint32_t end, std::shared_mutex* writers) const {
+    return ScanCursor(table, first, end, writers);
+}
+
+MorselPlan TableScanner::plan(uint32_t morselPages) const {
+    return MorselPlan{table.pageCount(), morselPages};
+}
+
+void TableScanner::scanParallel(ThreadPool& threads, const MorselPlan& plan,
+                                const std::function<void(size_t, ScanCursor&)>& fn, std::shared_mutex* writers) {
+    scanMorsels(threads, plan, [&](size_t m, size_t, ScanCursor& cursor) { fn(m, cursor); }, writers);
+}
+
+void TableScanner::scanPerRunner(ThreadPool& threads, const MorselPlan& plan,
+                                 const std::function<void(size_t, ScanCursor&)>& fn) {
+    scanMorsels(threads, plan, [&](size_t, size_t r, ScanCursor& cursor) { fn(r, cursor); }, nullptr);
+}
+
+uint64_t TableScanner::countRows(ThreadPool& threads, const RowFilter* filter) {
+    MorselPlan p = plan();
+    std::vector<uint64_t> counts(runners(threads, p), 0);
+    scanPerRunner(threads, p, [&](size_t r, ScanCursor& cursor) {
+        cursor.setFilter(filter);
+        counts[r] += cursor.countRest();
+    });
+    uint64_t n = 0;
+    for (uint64_t c : counts) n += c;
+    return n;
+}
+
+void TableScanner::scanMorsels(ThreadPool& threads, const MorselPlan& plan,
+                               const std::function<void(size_t, size_t, ScanCursor&)>& fn,
+                               std::shared_mutex* writers) {
+    auto morsel = [&](size_t m, size_t r) {
+        uint32_t first = (uint32_t)(m * plan.size);
+        ScanCursor cursor(table, first, std::min(plan.pages, first + plan.size), writers);
+        fn(m, r, cursor);
+    };
+    size_t n = plan.count();
+    if (n <= 1) {
+        if (n) morsel(0, 0);
+        return;
+    }
+    if (!writers) table.adviseAccess(AccessHint::Sequential);
+    try {
+        threads.parallelForRunners(n, morsel);
+    } catch (...) {
+        if (!writers) table.adviseAccess(AccessHint::Random);
+        throw;
     }
-    return out;
+    if (!writers) table.adviseAccess(AccessHint::Random);
 }
 
 }
@@ -0,0 +1,73 @@
+#include "ThreadPool.h"
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <memory>
+
+namespace tinydb {
+
+ThreadPool::ThreadPool(size_t threads) {
+    if(threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+    workers.reserve(threads);
+    for(size_t i = 0; i < threads; i++) workers.emplace_back([this]{ workerLoop(); });
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lk(mu);
+        stopping = true;
+    }
+    wake.notify_all();
+    for(auto& t : workers) t.join();
+}
+
+void ThreadPool::workerLoop() {
+    for(;;){
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lk(mu);
+            wake.wait(lk, [this]{ return stopping || !tasks.empty(); });
+            if(tasks.empty()) return; // stopping and drained
+            task = std::move(tasks.front());
+            tasks.pop();
+        }
+        task();
+    }
+}
+
+std::future<void> ThreadPool::submit(std::function<void()> task) {
+    auto job = std::make_shared<std::packaged_task<void()>>(std::move(task));
+    std::future<void> done = job->get_future();
+    {
+        std::lock_guard<std::mutex> lk(mu);
+        tasks.push([job]{ (*job)(); });
+    }
+    wake.notify_one();
+    return done;
+}
+
+void ThreadPool::parallelFor(size_t n, const std::function<void(size_t)>& fn) {
+    parallelForRunners(n, [&](size_t i, size_t){ fn(i); });
+}
+
+void ThreadPool::parallelForRunners(size_t n, const std::function<void(size_t, size_t)>& fn) {
+    if(n == 0) return;
+    // one task per worker, each pulling indexes until none are left
+    std::atomic<size_t> next{0};
+    size_t runners = std::min(n, workers.size());
+    std::vector<std::future<void>> done;
+    done.reserve(runners);
+    for(size_t r = 0; r < runners; r++){
+        done.push_back(submit([&, r]{
+            for(size_t i = next++; i < n; i = next++) fn(i, r);
+        }));
+    }
+
+    std::exception_ptr first;
+    for(auto& f : done){
+        try { f.get(); } catch(...) { if(!first) first = std::current_exception(); }
+    }
+    if(first) std::rethrow_exception(first);
+}
+
+}
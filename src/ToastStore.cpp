@@ -0,0 +1,127 @@
+#include "ToastStore.h"
+#include "FreeSpaceMap.h"
+#include <algorithm>
+#include <stdexcept>
+
+namespace tinydb {
+
+static const std::string LOG_SUFFIX = "\ntoast";
+
+ToastStore::ToastStore(uint32_t ps, Opener open, std::shared_mutex* w)
+    : pageBytes(ps), lazy(std::make_shared<Lazy>()), writers(w) {
+    lazy->open = std::move(open);
+}
+
+ToastStore::ToastStore(const ToastStore& other, std::shared_mutex* w)
+    : pageBytes(other.pageBytes), lazy(other.lazy), writers(w) {}
+
+TableFile& ToastStore::table(){
+    std::call_once(lazy->once, [&]{ lazy->chunks.emplace(lazy->open()); });
+    return *lazy->chunks;
+}
+
+uint32_t ToastStore::threshold() const {
+    return pageBytes / 8;
+}
+
+uint32_t ToastStore::rowLimit() const {
+    // room for the home RowId should the row ever have to move
+    return SlottedPage::maxRowSize(pageBytes) - SlottedPage::LINK_SIZE;
+}
+
+uint32_t ToastStore::chunkBytes() const {
+    // just under a page, but small enough that pages emptied by free() are reused
+    uint32_t ps = pageBytes;
+    return std::min(SlottedPage::maxRowSize(ps), FreeSpaceMap::largestReusable(ps)) - NEXT_SIZE;
+}
+
+ToastRef ToastStore::store(const std::string& value){
+    return put(value, FreeSpaceMap::NO_PAGE);
+}
+
+ToastRef ToastStore::put(const std::string& value, uint32_t below){
+    uint32_t per = chunkBytes();
+    size_t count = std::max<size_t>(1, (value.size() + per - 1) / per);
+    TableFile& chunks = table();
+    RowId next{FreeSpaceMap::NO_PAGE, 0};
+    for(size_t i = count; i-- > 0;){
+        size_t at = i * per;
+        size_t len = std::min<size_t>(per, value.size() - at);
+        std::vector<uint8_t> rec;
+        rec.reserve(NEXT_SIZE + len);
+        append_u32(rec, next.pageId);
+        append_u16(rec, next.slotId);
+        rec.insert(rec.end(), value.begin() + at, value.begin() + at + len);
+        RowId rid = chunks.insertRow(rec, below);
+        if(rid.pageId == FreeSpaceMap::NO_PAGE){
+            free(ToastRef{0, next.pageId, next.slotId});
+            return ToastRef{0, FreeSpaceMap::NO_PAGE, 0};
+        }
+        next = rid;
+    }
+    return ToastRef{(uint32_t)value.size(), next.pageId, next.slotId};
+}
+
+std::string ToastStore::fetch(const ToastRef& ref){
+    std::shared_lock<std::shared_mutex> lk;
+    if(writers) lk = std::shared_lock<std::shared_mutex>(*writers);
+
+    TableFile& chunks = table();
+    std::string out;
+    out.reserve(ref.length);
+    RowId at{ref.pageId, ref.slotId};
+    while(at.pageId != FreeSpaceMap::NO_PAGE && out.size() < ref.length){
+        auto rec = chunks.readRow(at);
+        if(rec.size() < NEXT_SIZE) break;
+        size_t pos = 0;
+        at.pageId = pop_u32(rec, pos);
+        at.slotId = pop_u16(rec, pos);
+        out.append((const char*)rec.data() + NEXT_SIZE, rec.size() - NEXT_SIZE);
+    }
+    if(out.size() != ref.length) throw std::runtime_error("Broken out-of-line value");
+    return out;
+}
+
+void ToastStore::free(const ToastRef& ref){
+    TableFile& chunks = table();
+    RowId at{ref.pageId, ref.slotId};
+    while(at.pageId != FreeSpaceMap::NO_PAGE){
+        auto rec = chunks.readRow(at);
+        if(rec.size() < NEXT_SIZE) return;
+        chunks.deleteRow(at);
+        size_t pos = 0;
+        at.pageId = pop_u32(rec, pos);
+        at.slotId = pop_u16(rec, pos);
+    }
+}
+
+uint32_t ToastStore::lastPage(const ToastRef& ref){
+    TableFile& chunks = table();
+    uint32_t last = 0;
+    RowId at{ref.pageId, ref.slotId};
+    while(at.pageId != FreeSpaceMap::NO_PAGE){
+        last = std::max(last, at.pageId);
+        auto rec = chunks.readRow(at);
+        if(rec.size() < NEXT_SIZE) break;
+        size_t pos = 0;
+        at.pageId = pop_u32(rec, pos);
+        at.slotId = pop_u16(rec, pos);
+    }
+    return last;
+}
+
+ToastRef ToastStore::copyBelow(const ToastRef& ref, uint32_t below){
+    return put(fetch(ref), below);
+}
+
+std::string ToastStore::logName(const std::string& table){
+    return table + LOG_SUFFIX;
+}
+
+std::string ToastStore::tableOf(const std::string& log){
+    if(log.size() <= LOG_SUFFIX.size()) return "";
+    if(log.compare(log.size() - LOG_SUFFIX.size(), LOG_SUFFIX.size(), LOG_SUFFIX) != 0) return "";
+    return log.substr(0, log.size() - LOG_SUFFIX.size());
+}
+
+}
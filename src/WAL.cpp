@@ -1,49 +1,315 @@
 #include "WAL.h"
+#include "ByteUtil.h"
+#include <chrono>
+#include <cstring>
+#include <filesystem>
 #include <fstream>
+#include <stdexcept>
+
+#ifdef _WIN32
+  #include <io.h>
+  #include <fcntl.h>
+  #include <sys/stat.h>
+#else
+  #include <fcntl.h>
+  #include <sys/stat.h>
+  #include <unistd.h>
+#endif
 
 namespace tinydb {
 
-enum OpType : uint32_t { OP_INSERT=1, OP_DELETE=2, OP_UPDATE=3 };
-
-WAL::WAL(const std::string& walPath) : path(walPath) {
-    std::ofstream out(path, std::ios::app | std::ios::binary);
-    out.close();
-}
-
-void WAL::logInsert(const std::string& table, const std::vector<uint8_t>& rowBytes) {
-    std::ofstream out(path, std::ios::app | std::ios::binary);
-    uint32_t op=OP_INSERT;
-    uint32_t tlen=(uint32_t)table.size();
-    uint32_t rlen=(uint32_t)rowBytes.size();
-    out.write((char*)&op,4);
-    out.write((char*)&tlen,4); out.write(table.data(), tlen);
-    out.write((char*)&rlen,4); out.write((const char*)rowBytes.data(), rlen);
-    out.flush();
-}
-
-void WAL::logDelete(const std::string& table, uint32_t page, uint16_t slot){
-    std::ofstream out(path, std::ios::app | std::ios::binary);
-    uint32_t op=OP_DELETE;
-    uint32_t tlen=(uint32_t)table.size();
-    out.write((char*)&op,4);
-    out.write((char*)&tlen,4); out.write(table.data(), tlen);
-    out.write((char*)&page,4);
-    out.write((char*)&slot,2);
-    out.flush();
-}
-
-void WAL::logUpdate(const std::string& table, uint32_t page, uint16_t slot, const std::vector<uint8_t>& newBytes){
-    std::ofstream out(path, std::ios::app | std::ios::binary);
-    uint32_t op=OP_UPDATE;
-    uint32_t tlen=(uint32_t)table.size();
-    uint32_t rlen=(uint32_t)newBytes.size();
-    out.write((char*)&op,4);
-    out.write((char*)&tlen,4); out.write(table.data(), tlen);
-    out.write((char*)&page,4);
-    out.write((char*)&slot,2);
-    out.write((char*)&rlen,4);
-    out.write((const char*)newBytes.data(), rlen);
-    out.flush();
+static constexpr uint32_t WAL_MAGIC = 0x4C415754; // "TWAL"
+static constexpr uint32_t WAL_VERSION = 1;
+static constexpr uint32_t WAL_HEADER_SIZE = 16;    // magic, version, base LSN
+
+static void appendBytes(std::vector<uint8_t>& b, const void* p, size_t n){
+    b.insert(b.end(), (const uint8_t*)p, (const uint8_t*)p + n);
+}
+
+static void writeAll(int fd, const std::vector<uint8_t>& bytes){
+    size_t done = 0;
+    while(done < bytes.size()){
+#ifdef _WIN32
+        int n = _write(fd, bytes.data() + done, (unsigned)(bytes.size() - done));
+#else
+        ssize_t n = ::write(fd, bytes.data() + done, bytes.size() - done);
+#endif
+        if(n <= 0) throw std::runtime_error("WAL write failed");
+        done += (size_t)n;
+    }
+}
+
+static void dataSync(int fd){
+#if defined(_WIN32)
+    int rc = _commit(fd);
+#elif defined(__APPLE__)
+    int rc = ::fsync(fd);
+#else
+    int rc = ::fdatasync(fd);
+#endif
+    if(rc != 0) throw std::runtime_error("WAL sync failed");
+}
+
+WAL::WAL(const std::string& walPath, const WALOptions& o) : path(walPath), opts(o) {
+    uint8_t hdr[WAL_HEADER_SIZE];
+    std::ifstream in(path, std::ios::binary | std::ios::ate);
+    long long size = in.is_open() ? (long long)in.tellg() : -1;
+    bool valid = false;
+    if(size >= (long long)WAL_HEADER_SIZE){
+        in.seekg(0);
+        in.read((char*)hdr, WAL_HEADER_SIZE);
+        valid = in.gcount()==WAL_HEADER_SIZE && read_u32(hdr)==WAL_MAGIC && read_u32(hdr+4)==WAL_VERSION;
+    }
+    in.close();
+
+    if(valid){
+        std::memcpy(&baseLSN, hdr+8, 8);
+        appendedPos = durablePos = baseLSN + (uint64_t)(size - WAL_HEADER_SIZE);
+        openForAppend();
+    } else {
+        // missing or pre-LSN log: nothing in it can be replayed
+        startFresh(0);
+    }
+
+    if(opts.policy == SyncPolicy::Interval) flusher = std::thread([this]{ flusherLoop(); });
+}
+
+WAL::~WAL() {
+    {
+        std::lock_guard<std::mutex> lk(mu);
+        stopping = true;
+    }
+    flusherWake.notify_all();
+    if(flusher.joinable()) flusher.join();
+    flushError = nullptr; // the final flush retries whatever it left behind
+    try { flush(); } catch(...) {}
+    closeFd();
+}
+
+void WAL::openForAppend() {
+#ifdef _WIN32
+    fd = _open(path.c_str(), _O_WRONLY | _O_CREAT | _O_APPEND | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+    fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+#endif
+    if(fd < 0) throw std::runtime_error("Cannot open WAL " + path);
+}
+
+void WAL::closeFd() {
+#ifdef _WIN32
+    if(fd >= 0) _close(fd);
+#else
+    if(fd >= 0) ::close(fd);
+#endif
+    fd = -1;
+}
+
+// replaces the log with an empty one whose first LSN is `base`; the new
+// header is made durable before it atomically takes the old file's place
+void WAL::startFresh(uint64_t base) {
+    std::string tmp = path + ".tmp";
+    {
+        std::vector<uint8_t> hdr(WAL_HEADER_SIZE);
+        write_u32(&hdr[0], WAL_MAGIC);
+        write_u32(&hdr[4], WAL_VERSION);
+        std::memcpy(&hdr[8], &base, 8);
+#ifdef _WIN32
+        int tfd = _open(tmp.c_str(), _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+        int tfd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+#endif
+        if(tfd < 0) throw std::runtime_error("Cannot create " + tmp);
+        writeAll(tfd, hdr);
+        dataSync(tfd);
+#ifdef _WIN32
+        _close(tfd);
+#else
+        ::close(tfd);
+#endif
+    }
+    closeFd();
+    std::filesystem::rename(tmp, path);
+#ifndef _WIN32
+    // the rename must reach disk too, or a crash may bring the old log back
+    std::string dir = std::filesystem::path(path).parent_path().string();
+    int dfd = ::open(dir.empty() ? "." : dir.c_str(), O_RDONLY);
+    if(dfd >= 0){ ::fsync(dfd); ::close(dfd); }
+#endif
+    openForAppend();
+
+    baseLSN = appendedPos = durablePos = base;
+    buffer.clear();
+}
+
+uint64_t WAL::append(OpType op, const std::string& table, uint32_t page, uint16_t slot,
+                     const std::vector<uint8_t>* row, uint8_t kind) {
+    // len | op (kind in bits 16-23) | lsn | tlen table | page | slot | rlen row | checksum
+    uint32_t tlen = (uint32_t)table.size();
+    uint32_t rlen = row ? (uint32_t)row->size() : 0;
+    uint32_t len = 4+4+8 + 4+tlen + 4+2 + 4+rlen + 4;
+
+    std::vector<uint8_t> rec;
+    rec.reserve(len);
+    uint32_t code = (uint32_t)op | ((uint32_t)kind << 16);
+    appendBytes(rec, &len, 4);
+    appendBytes(rec, &code, 4);
+    rec.resize(rec.size() + 8); // lsn, filled in under the lock
+    appendBytes(rec, &tlen, 4); appendBytes(rec, table.data(), tlen);
+    appendBytes(rec, &page, 4);
+    appendBytes(rec, &slot, 2);
+    appendBytes(rec, &rlen, 4);
+    if(rlen) appendBytes(rec, row->data(), rlen);
+
+    std::lock_guard<std::mutex> lk(mu);
+    uint64_t lsn = appendedPos + len;
+    std::memcpy(&rec[8], &lsn, 8);
+    uint32_t sum = fnv1a(rec.data(), rec.size());
+    appendBytes(rec, &sum, 4);
+
+    buffer.insert(buffer.end(), rec.begin(), rec.end());
+    appendedPos = lsn;
+    return lsn;
+}
+
+uint64_t WAL::currentLSN() {
+    std::lock_guard<std::mutex> lk(mu);
+    return appendedPos;
+}
+
+uint64_t WAL::bytesSinceCheckpoint() {
+    std::lock_guard<std::mutex> lk(mu);
+    return appendedPos - baseLSN;
+}
+
+// leader/follower group commit: the first committer writes out everything
+// buffered so far and syncs once; commits arriving meanwhile wait for it
+// and are usually covered by the same sync
+void WAL::syncUpTo(std::unique_lock<std::mutex>& lk, uint64_t pos) {
+    while(durablePos < pos){
+        if(syncing){ synced.wait(lk); continue; }
+
+        syncing = true;
+        std::vector<uint8_t> batch;
+        batch.swap(buffer);
+        uint64_t end = appendedPos;
+        lk.unlock();
+        try {
+            writeAll(fd, batch);
+            dataSync(fd);
+        } catch(...) {
+            lk.lock();
+            buffer.insert(buffer.begin(), batch.begin(), batch.end());
+            syncing = false;
+            synced.notify_all();
+            throw;
+        }
+        lk.lock();
+        durablePos = end;
+        syncing = false;
+        synced.notify_all();
+    }
+}
+
+// hands a sync failure of the background flusher to the next caller
+void WAL::rethrowFlushError() {
+    if(!flushError) return;
+    std::exception_ptr e = flushError;
+    flushError = nullptr;
+    std::rethrow_exception(e);
+}
+
+void WAL::commit(uint64_t lsn) {
+    std::unique_lock<std::mutex> lk(mu);
+    rethrowFlushError();
+    switch(opts.policy){
+    case SyncPolicy::EveryCommit:
+        syncUpTo(lk, lsn);
+        break;
+    case SyncPolicy::Bytes:
+        if(appendedPos - durablePos >= opts.syncBytes) syncUpTo(lk, appendedPos);
+        break;
+    case SyncPolicy::Interval:
+        break;
+    }
+}
+
+void WAL::flush() {
+    std::unique_lock<std::mutex> lk(mu);
+    rethrowFlushError();
+    syncUpTo(lk, appendedPos);
+}
+
+void WAL::flusherLoop() {
+    std::unique_lock<std::mutex> lk(mu);
+    while(!stopping){
+        flusherWake.wait_for(lk, std::chrono::milliseconds(opts.intervalMs));
+        if(appendedPos <= durablePos) continue;
+        // the batch is back in the buffer; the next interval retries it
+        try { syncUpTo(lk, appendedPos); }
+        catch(...) { flushError = std::current_exception(); }
+    }
+}
+
+void WAL::truncate() {
+    std::unique_lock<std::mutex> lk(mu);
+    syncUpTo(lk, appendedPos);
+    startFresh(appendedPos);
+}
+
+size_t WAL::replay(const std::function<void(const LogRecord&)>& fn) {
+    std::vector<uint8_t> log;
+    {
+        std::lock_guard<std::mutex> lk(mu);
+        std::ifstream in(path, std::ios::binary);
+        log.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+
+    size_t count = 0;
+    size_t pos = WAL_HEADER_SIZE;
+    uint64_t expect = baseLSN;
+    while(pos + 4 <= log.size()){
+        uint32_t len = read_u32(&log[pos]);
+        if(len < 34 || pos + len > log.size()) break;
+        const uint8_t* r = &log[pos];
+        if(read_u32(r + len - 4) != fnv1a(r, len - 4)) break;
+
+        LogRecord rec;
+        size_t p = 4;
+        uint32_t code = read_u32(r + p); p += 4;
+        rec.op = (OpType)(code & 0xFFFF);
+        rec.kind = (uint8_t)(code >> 16);
+        std::memcpy(&rec.lsn, r + p, 8); p += 8;
+        uint32_t tlen = read_u32(r + p); p += 4;
+        if(p + tlen + 10 > len - 4) break;
+        rec.table.assign((const char*)r + p, tlen); p += tlen;
+        rec.page = read_u32(r + p); p += 4;
+        rec.slot = read_u16(r + p); p += 2;
+        uint32_t rlen = read_u32(r + p); p += 4;
+        if(p + rlen != len - 4) break;
+        rec.bytes.assign(r + p, r + p + rlen);
+
+        expect += len;
+        if(rec.lsn != expect) break;
+
+        fn(rec);
+        count++;
+        pos += len;
+    }
+    return count;
+}
+
+uint64_t WAL::logInsert(const std::string& table, uint32_t page, uint16_t slot, const std::vector<uint8_t>& rowBytes,
+                        uint8_t kind) {
+    return append(OP_INSERT, table, page, slot, &rowBytes, kind);
+}
+
+uint64_t WAL::logDelete(const std::string& table, uint32_t page, uint16_t slot){
+    return append(OP_DELETE, table, page, slot, nullptr);
+}
+
+uint64_t WAL::logUpdate(const std::string& table, uint32_t page, uint16_t slot, const std::vector<uint8_t>& newBytes,
+                        uint8_t kind){
+    return append(OP_UPDATE, table, page, slot, &newBytes, kind);
 }
 
 }
@@ -0,0 +1,61 @@
+// Rows inserted just before a crash, with a checkpoint after every
+// statement, must still be found through a hash index and a B+tree once the
+// database is reopened. The child process dies without running destructors,
+// so nothing is checkpointed on the way out.
+#include "DBEngine.h"
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace tinydb;
+
+int main() {
+    std::string dir = "test_crash_restart_db";
+    std::filesystem::remove_all(dir);
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        std::cerr << "fork failed\n";
+        return 1;
+    }
+    if (pid == 0) {
+        DBOptions opts;
+        opts.checkpointBytes = 1;
+        DBEngine db(dir, opts);
+        db.execute("CREATE TABLE t (id INT, name TEXT)");
+        db.execute("CREATE INDEX t_id ON t(id)");
+        db.execute("CREATE INDEX t_name ON t(name) USING BTREE");
+        for (int i = 0; i < 5; i++) {
+            db.execute("INSERT INTO t VALUES (" + std::to_string(i) + ", \"a" + std::to_string(i) + "\")");
+        }
+        _exit(0);
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        std::cerr << "writer did not finish\n";
+        return 1;
+    }
+
+    int failures = 0;
+    {
+        DBEngine db(dir);
+        for (int i = 0; i < 5; i++) {
+            std::string n = std::to_string(i);
+            const std::string queries[] = {
+                "SELECT * FROM t WHERE id = " + n,             // hash index
+                "SELECT * FROM t WHERE name = \"a" + n + "\"", // B+tree
+            };
+            for (auto& q : queries) {
+                std::string r = db.execute(q);
+                if (r.find("id=" + n) != std::string::npos) continue;
+                std::cerr << q << " -> " << r << "\n";
+                failures++;
+            }
+        }
+    }
+    std::filesystem::remove_all(dir);
+    return failures ? 1 : 0;
+}